@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+// Arithmetic-heavy loop: multiplies and divides by constants, the same
+// subexpressions computed more than once, and intermediate results which are
+// never used
+
+unsigned iterations = 50000000;
+unsigned seed = 12345;
+
+unsigned mix(unsigned x, unsigned i) {
+
+    unsigned a = x * 8 + i; // Strength reduction (mul -> shl)
+    unsigned b = a / 16; // Strength reduction (udiv -> lshr)
+    unsigned c = a % 64; // Strength reduction (urem -> and)
+    unsigned d = (x + i) * 9; // Strength reduction (mul -> shl + add)
+    unsigned e = (x + i) * 3; // CSE (x + i)
+    unsigned f = x * 1 + 0; // Constant folding
+    unsigned g = x * 5; // Dead code
+    return b + c + d + e + f;
+}
+
+int main() {
+
+    unsigned x = seed;
+    for (unsigned i = 0; i < iterations; i++) {
+        x = mix(x, i);
+    }
+
+    printf("%u\n", x);
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+
+// Division-heavy formatting: integers converted to decimal and hexadecimal
+// digits, one division and remainder by a constant per digit
+
+unsigned count = 1500000;
+
+unsigned formatDecimal(char* out, unsigned value) {
+
+    char digits[10];
+    unsigned n = 0;
+    do {
+        digits[n++] = (char) ('0' + value % 10); // Strength reduction (urem -> multiply-high)
+        value /= 10; // Strength reduction (udiv -> multiply-high)
+    } while (value != 0);
+
+    for (unsigned i = 0; i < n; i++) {
+        out[i] = digits[n - 1 - i];
+    }
+    return n;
+}
+
+unsigned formatSigned(char* out, int value) {
+
+    unsigned n = 0;
+    if (value < 0) {
+        out[n++] = '-';
+    }
+    int q = value / 100; // Strength reduction (sdiv -> multiply-high + sign fix-up)
+    int r = value % 100; // Strength reduction (srem)
+    n += formatDecimal(out + n, (unsigned) (q < 0 ? -q : q));
+    out[n++] = (char) ('0' + (r < 0 ? -r : r) / 10);
+    out[n++] = (char) ('0' + (r < 0 ? -r : r) % 10);
+    return n;
+}
+
+unsigned formatHex(char* out, unsigned value) {
+
+    unsigned n = 0;
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        unsigned digit = (value / (1u << shift)) % 16; // Strength reduction (udiv, urem by powers of two)
+        out[n++] = "0123456789abcdef"[digit];
+    }
+    return n;
+}
+
+int main() {
+
+    char text[64];
+    unsigned checksum = 0;
+
+    for (unsigned i = 0; i < count; i++) {
+        unsigned value = i * 2654435761u;
+        unsigned n = formatDecimal(text, value);
+        n += formatSigned(text + n, (int) value);
+        n += formatHex(text + n, value);
+        for (unsigned j = 0; j < n; j++) {
+            checksum = checksum * 31 + (unsigned char) text[j];
+        }
+    }
+
+    printf("%u\n", checksum);
+
+    return 0;
+}
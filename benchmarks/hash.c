@@ -0,0 +1,45 @@
+#include <stdio.h>
+
+// Hashing: FNV-1a and a multiply-xorshift finalizer over a generated buffer
+
+unsigned rounds = 1500;
+unsigned length = 65536;
+
+static unsigned char buffer[65536];
+
+unsigned fnv1a(const unsigned char* data, unsigned n) {
+
+    unsigned hash = 2166136261u;
+    for (unsigned i = 0; i < n; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+unsigned finalize(unsigned h) {
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+int main() {
+
+    for (unsigned i = 0; i < length; i++) {
+        buffer[i] = (unsigned char) (i * 31 + i / 7);
+    }
+
+    unsigned hash = 0;
+    for (unsigned r = 0; r < rounds; r++) {
+        buffer[r % length] ^= (unsigned char) hash;
+        hash = finalize(hash ^ fnv1a(buffer, length));
+    }
+
+    printf("%08x\n", hash);
+
+    return 0;
+}
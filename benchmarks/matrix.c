@@ -0,0 +1,66 @@
+#include <stdio.h>
+
+// Matrix walks: row-major and column-major traversals, whose index computations
+// (i * N + j) repeat in every statement
+
+#define N 256
+
+unsigned passes = 8;
+
+static int a[N * N];
+static int b[N * N];
+static int c[N * N];
+
+void transpose(int* out, const int* in) {
+
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            out[j * N + i] = in[i * N + j];
+        }
+    }
+}
+
+void multiply(int* out, const int* x, const int* y) {
+
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            int sum = 0;
+            for (int k = 0; k < N; k++) {
+                sum += x[i * N + k] * y[k * N + j];
+            }
+            out[i * N + j] = sum / 4; // Strength reduction (sdiv by a power of two)
+        }
+    }
+}
+
+void stencil(int* out, const int* in) {
+
+    for (int i = 1; i < N - 1; i++) {
+        for (int j = 1; j < N - 1; j++) {
+            out[i * N + j] = (in[i * N + j] * 4 + in[(i - 1) * N + j] + in[(i + 1) * N + j]
+                + in[i * N + j - 1] + in[i * N + j + 1]) / 8; // CSE (i * N)
+        }
+    }
+}
+
+int main() {
+
+    for (int i = 0; i < N * N; i++) {
+        a[i] = (i * 7) % 13 - 6;
+        b[i] = (i * 5) % 11 - 5;
+    }
+
+    unsigned checksum = 0;
+    for (unsigned p = 0; p < passes; p++) {
+        multiply(c, a, b);
+        stencil(a, c);
+        transpose(b, a);
+        for (int i = 0; i < N * N; i++) {
+            checksum = checksum * 31 + (unsigned) c[i];
+        }
+    }
+
+    printf("%u\n", checksum);
+
+    return 0;
+}
@@ -1,8 +1,8 @@
 #!/bin/sh
 
-export CC=/usr/bin/clang-10
-export CXX=/usr/bin/clang++-10
-export LLVM_DIR=/usr/lib/llvm-10/lib/cmake/llvm
+export CC=/usr/bin/clang-14
+export CXX=/usr/bin/clang++-14
+export LLVM_DIR=/usr/lib/llvm-14/lib/cmake/llvm
 rm -rf build
 mkdir build
 cd build
@@ -0,0 +1,246 @@
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/StringSet.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include "CustomOpt.h"
+#include "Driver.h"
+#include "FunctionCache.h"
+
+using namespace llvm;
+
+// Optimizes many modules in one process, in place of a chain of opt invocations:
+//
+// customopt-batch -output-dir out/ a.bc b.bc c.ll ...
+//
+// Bitcode is read lazily: each function body is only materialized when the
+// pipeline reaches it. The optimized modules are written as bitcode, one as
+// soon as it is done, to <output-dir>/<name>.bc (<name>.opt.bc next to the
+// input without -output-dir). With -cache-dir, functions optimized by an
+// earlier run are not optimized again (FunctionCache.h).
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::OneOrMore,
+    cl::desc("<input .ll/.bc files>"));
+
+static cl::opt<std::string> OutputDirectory("output-dir", cl::value_desc("directory"),
+    cl::desc("Directory to write the optimized modules to"));
+
+static cl::opt<std::string> PassPipeline("passes", cl::init("mem2reg,dcelim,srcf,cse"),
+    cl::desc("Pipeline of passes to run on each function, as in opt -passes"));
+
+static cl::opt<unsigned> Threads("j", cl::init(0),
+    cl::desc("Number of modules optimized at the same time (default: all cores)"));
+
+static cl::opt<std::string> CacheDirectory("cache-dir", cl::value_desc("directory"),
+    cl::desc("Reuse the optimized functions of earlier runs, cached in this directory"));
+
+// The description lists the debug types of the passes, and is set in main()
+static cl::opt<bool> Verbose("v");
+
+static ExitOnError ExitOnErr;
+
+namespace {
+
+    // Messages from the threads, one line at a time
+    std::mutex outputLock;
+
+    // Shared by all the threads, with -cache-dir
+    std::unique_ptr<customopt::FunctionCache> cache;
+
+    std::string getOutputFilename(StringRef input) {
+
+        SmallString<128> output;
+
+        if (OutputDirectory.empty()) {
+            output = input;
+            sys::path::replace_extension(output, "opt.bc");
+        }
+        else {
+            output = OutputDirectory;
+            sys::path::append(output, sys::path::stem(input) + ".bc");
+        }
+
+        return output.str().str();
+
+    }
+
+    // Returns false if the module could not be read or written
+    bool optimizeFile(StringRef input, StringRef output) {
+
+        auto start = std::chrono::steady_clock::now();
+
+        // Each module has a context of its own, so that the modules can be optimized
+        // in parallel, and the types and constants of one are freed with it
+        LLVMContext context;
+        SMDiagnostic error;
+
+        std::unique_ptr<Module> module = getLazyIRFileModule(input, error, context);
+        if (!module) {
+            std::lock_guard<std::mutex> lock(outputLock);
+            error.print("customopt-batch", errs());
+            return false;
+        }
+
+        customopt::Pipeline pipeline(*module);
+
+        FunctionPassManager FPM;
+        ExitOnErr(pipeline.PB.parsePassPipeline(FPM, PassPipeline));
+
+        // Prints the functions for the keys of the cache
+        ModuleSlotTracker MST(module.get());
+
+        unsigned functions = 0;
+
+        // Materialize and optimize one function at a time
+        for (Function& function: *module) {
+
+            if (Error error = function.materialize()) {
+                std::lock_guard<std::mutex> lock(outputLock);
+                logAllUnhandledErrors(std::move(error), errs(), input + ": ");
+                return false;
+            }
+
+            if (function.isDeclaration()) {
+                continue;
+            }
+
+            if (cache) {
+                cache->optimize(function, FPM, pipeline.FAM, MST);
+            }
+            else {
+                FPM.run(function, pipeline.FAM);
+            }
+            functions++;
+        }
+
+        // Global initializers and metadata
+        if (Error error = module->materializeAll()) {
+            std::lock_guard<std::mutex> lock(outputLock);
+            logAllUnhandledErrors(std::move(error), errs(), input + ": ");
+            return false;
+        }
+
+        std::error_code errorCode;
+        ToolOutputFile out(output, errorCode, sys::fs::OF_None);
+        if (errorCode) {
+            std::lock_guard<std::mutex> lock(outputLock);
+            errs() << output << ": " << errorCode.message() << "\n";
+            return false;
+        }
+
+        WriteBitcodeToFile(*module, out.os());
+        out.keep();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(outputLock);
+        errs() << input << " -> " << output << ": " << functions << " functions in "
+            << format("%.3f", seconds) << "s\n";
+
+        return true;
+
+    }
+}
+
+int main(int argc, char** argv) {
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+
+    std::string verboseDescription = "Print the transformations made by the passes (-debug-only=" +
+        customopt::getDebugTypes() + ")";
+    Verbose.setDescription(verboseDescription);
+
+    cl::ParseCommandLineOptions(argc, argv, "batch custom optimization driver\n");
+
+    ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+
+    // The debug output of the passes interleaves between threads, so it is only
+    // printed on request
+    if (Verbose) {
+        customopt::enableDebugOutput();
+    }
+
+    // Check the pipeline once, before it is parsed for every module
+    {
+        PassBuilder PB;
+        customopt::registerPasses(PB);
+        FunctionPassManager FPM;
+        ExitOnErr(PB.parsePassPipeline(FPM, PassPipeline));
+    }
+
+    if (!OutputDirectory.empty()) {
+        if (std::error_code error = sys::fs::create_directories(OutputDirectory)) {
+            errs() << OutputDirectory << ": " << error.message() << "\n";
+            return 1;
+        }
+    }
+
+    if (!CacheDirectory.empty()) {
+        if (std::error_code error = sys::fs::create_directories(CacheDirectory)) {
+            errs() << CacheDirectory << ": " << error.message() << "\n";
+            return 1;
+        }
+        cache = std::make_unique<customopt::FunctionCache>(CacheDirectory, PassPipeline);
+    }
+
+    // Inputs with the same name in different directories would overwrite each other
+    std::vector<std::string> outputs;
+    StringSet<> seen;
+    for (const std::string& input: InputFilenames) {
+
+        outputs.push_back(getOutputFilename(input));
+
+        if (!seen.insert(outputs.back()).second) {
+            errs() << "error: more than one input is written to " << outputs.back() << "\n";
+            return 1;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::atomic<unsigned> failures(0);
+    {
+        ThreadPool pool(hardware_concurrency(Threads));
+        for (size_t i = 0; i < InputFilenames.size(); i++) {
+            pool.async([&outputs, &failures, i]() {
+                if (!optimizeFile(InputFilenames[i], outputs[i])) {
+                    failures++;
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    errs() << "Optimized " << InputFilenames.size() - failures << " of " << InputFilenames.size()
+        << " modules in " << format("%.3f", seconds) << "s\n";
+
+    if (cache) {
+        cache->printStatistics(errs());
+    }
+
+    return failures ? 1 : 0;
+
+}
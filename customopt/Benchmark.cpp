@@ -0,0 +1,566 @@
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <random>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "CustomOpt.h"
+#include "Driver.h"
+
+using namespace llvm;
+
+// Measures how the passes scale with the size of a function:
+//
+// customopt-bench -shapes=straight,domtree -sizes=1000,100000 -o results.json
+//
+// For every shape, size and pass, a function of about that many instructions is
+// generated, and the pass is run on it in a child process of its own, so that the
+// peak RSS of the child belongs to that run alone, and a crash or an assertion in
+// one run does not end the others. The time includes the analyses the pass asks for.
+// The sizes are measured in increasing order, so that once a pass runs out of time,
+// the sizes after it are skipped.
+
+static cl::list<std::string> Shapes("shapes", cl::CommaSeparated,
+    cl::desc("Shapes of the generated functions (default: all of them): "
+        "straight, domtree, deadchain, redundant"));
+
+static cl::list<unsigned> Sizes("sizes", cl::CommaSeparated,
+    cl::desc("Number of instructions of the generated functions "
+        "(default: 1000,10000,100000,1000000)"));
+
+static cl::list<std::string> Passes("passes", cl::CommaSeparated,
+    cl::desc("Passes to time, each on its own (default: dcelim,srcf,cse)"));
+
+static cl::opt<unsigned> Repeat("repeat", cl::init(3),
+    cl::desc("Number of runs of each measurement, the fastest one is reported"));
+
+static cl::opt<unsigned> Timeout("timeout", cl::init(60),
+    cl::desc("Seconds after which a run is stopped, and the larger sizes of the same "
+        "shape and pass are skipped (0: no limit)"));
+
+static cl::opt<unsigned> Seed("seed", cl::init(1),
+    cl::desc("Seed of the generator, the same seed generates the same functions"));
+
+static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename"),
+    cl::value_desc("filename"), cl::init("-"));
+
+enum class OutputFormat { JSON, CSV };
+
+static cl::opt<OutputFormat> Format("format", cl::init(OutputFormat::JSON),
+    cl::desc("Format of the results"),
+    cl::values(clEnumValN(OutputFormat::JSON, "json", "One JSON document"),
+        clEnumValN(OutputFormat::CSV, "csv", "One line per measurement")));
+
+static cl::opt<std::string> EmitDirectory("emit-ir", cl::value_desc("directory"),
+    cl::desc("Also write the generated functions to <directory>/<shape>-<size>.ll"));
+
+static ExitOnError ExitOnErr;
+
+namespace {
+
+    // Generates define i32 @bench(i32 %a, i32 %b, i32* %p) with a body of the
+    // given shape, of about size instructions
+    class Generator {
+    public:
+        Generator(LLVMContext& context, unsigned seed) : context(context), random(seed) {}
+
+        std::unique_ptr<Module> generate(StringRef shape, unsigned size) {
+
+            auto module = std::make_unique<Module>((shape + "-" + Twine(size)).str(), context);
+            module->setTargetTriple(sys::getDefaultTargetTriple());
+
+            Type* int32 = Type::getInt32Ty(context);
+            FunctionType* type = FunctionType::get(int32,
+                {int32, int32, int32->getPointerTo()}, false);
+
+            function = Function::Create(type, GlobalValue::ExternalLinkage, "bench", module.get());
+            a = function->getArg(0);
+            b = function->getArg(1);
+            p = function->getArg(2);
+            a->setName("a");
+            b->setName("b");
+            p->setName("p");
+
+            if (shape == "straight") {
+                straightLine(size);
+            }
+            else if (shape == "domtree") {
+                dominatorTree(size);
+            }
+            else if (shape == "deadchain") {
+                deadChains(size);
+            }
+            else {
+                redundantExpressions(size);
+            }
+
+            return module;
+
+        }
+
+    private:
+        LLVMContext& context;
+        std::mt19937 random;
+
+        Function* function = nullptr;
+        Value* a = nullptr;
+        Value* b = nullptr;
+        Value* p = nullptr;
+
+        unsigned pick(unsigned n) {
+            return std::uniform_int_distribution<unsigned>(0, n - 1)(random);
+        }
+
+        // One random arithmetic instruction on value. Some of the constants make
+        // it a candidate for Strength Reduction (powers of two, 0 and 1).
+        Value* arithmetic(IRBuilder<>& builder, Value* value, Value* other) {
+
+            static const uint32_t constants[] = {0, 1, 2, 3, 7, 8, 10, 64, 1000, 4096};
+            Value* operand = pick(2) ? other : builder.getInt32(constants[pick(10)]);
+
+            switch (pick(7)) {
+            case 0: return builder.CreateAdd(value, operand);
+            case 1: return builder.CreateSub(value, operand);
+            case 2: return builder.CreateMul(value, operand);
+            case 3: return builder.CreateXor(value, operand);
+            case 4: return builder.CreateAnd(value, operand);
+            case 5: return builder.CreateShl(value, builder.getInt32(pick(31)));
+            default: return builder.CreateUDiv(value, builder.getInt32(constants[2 + pick(8)]));
+            }
+
+        }
+
+        // One block, in which every instruction is used by the next one, so
+        // nothing is dead: the passes scan it all, and only SRCF finds work
+        void straightLine(unsigned size) {
+
+            IRBuilder<> builder(BasicBlock::Create(context, "entry", function));
+
+            std::vector<Value *> values = {a, b};
+            Value* value = a;
+
+            for (unsigned i = 1; i < size; i++) {
+                Value* other = values[values.size() - 1 - pick(std::min<size_t>(values.size(), 16))];
+                value = arithmetic(builder, value, other);
+                values.push_back(value);
+            }
+
+            builder.CreateRet(value);
+
+        }
+
+        // A chain of blocks, each one dominating the next: the dominator tree is
+        // as deep as there are blocks. Every block computes a + b again, which
+        // CSE replaces with the value of the entry block.
+        void dominatorTree(unsigned size) {
+
+            BasicBlock* entry = BasicBlock::Create(context, "entry", function);
+            BasicBlock* exit = BasicBlock::Create(context, "exit", function);
+
+            IRBuilder<> builder(entry);
+            builder.CreateAdd(a, b);
+
+            IRBuilder<> exitBuilder(exit);
+            exitBuilder.CreateRet(builder.getInt32(0));
+
+            // 5 instructions per block
+            unsigned blocks = std::max(size / 5, 1u);
+            for (unsigned i = 0; i < blocks; i++) {
+
+                Value* sum = builder.CreateAdd(a, b);
+                Value* product = builder.CreateMul(sum, builder.getInt32(1 + pick(16)));
+                builder.CreateStore(product, p);
+                Value* condition = builder.CreateICmpULT(product, b);
+
+                BasicBlock* next = BasicBlock::Create(context, "", function, exit);
+                builder.CreateCondBr(condition, next, exit);
+                builder.SetInsertPoint(next);
+            }
+
+            builder.CreateBr(exit);
+
+        }
+
+        // Chains of 64 instructions, each one used only by the next, and the last
+        // one by nothing: DCE has to delete them one link at a time
+        void deadChains(unsigned size) {
+
+            IRBuilder<> builder(BasicBlock::Create(context, "entry", function));
+
+            for (unsigned i = 1; i < size; i++) {
+
+                Value* value = a;
+                for (unsigned j = 0; j < 64 && i < size; j++, i++) {
+                    value = arithmetic(builder, value, b);
+                }
+            }
+
+            builder.CreateRet(a);
+
+        }
+
+        // A sum of 16 different expressions, each one repeated many times: CSE
+        // keeps the first instance of each one, and deletes half of the function
+        void redundantExpressions(unsigned size) {
+
+            IRBuilder<> builder(BasicBlock::Create(context, "entry", function));
+
+            Value* sum = b;
+            for (unsigned i = 2; i < size; i += 2) {
+                unsigned expression = pick(16);
+                Value* value = expression < 8
+                    ? builder.CreateMul(a, builder.getInt32(3 + expression))
+                    : builder.CreateXor(a, builder.getInt32(1000 + expression));
+                sum = builder.CreateAdd(sum, value);
+            }
+
+            builder.CreateRet(sum);
+
+        }
+    };
+
+    // Filled in by the child process, and read by the parent from a pipe
+    struct Measurement {
+        double seconds;
+        uint64_t instructionsBefore;
+        uint64_t instructionsAfter;
+        long generatedRSS;
+        long peakRSS;
+    };
+
+    enum class Status { OK, Failed, Timeout, Skipped };
+
+    const char* getStatusName(Status status) {
+
+        switch (status) {
+        case Status::OK: return "ok";
+        case Status::Failed: return "failed";
+        case Status::Timeout: return "timeout";
+        case Status::Skipped: return "skipped";
+        }
+        return "";
+
+    }
+
+    struct Result {
+        std::string shape;
+        unsigned size;
+        std::string pass;
+        Status status;
+        Measurement best;
+    };
+
+    uint64_t countInstructions(const Function& function) {
+
+        uint64_t count = 0;
+        for (const BasicBlock& block: function) {
+            count += block.size();
+        }
+        return count;
+
+    }
+
+    // Peak resident set size of this process in KB
+    long getPeakRSS() {
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+
+    }
+
+    Measurement measure(StringRef shape, unsigned size, StringRef pass) {
+
+        LLVMContext context;
+        Generator generator(context, Seed);
+        std::unique_ptr<Module> module = generator.generate(shape, size);
+        Function& function = *module->getFunction("bench");
+
+        customopt::Pipeline pipeline(*module);
+        FunctionPassManager FPM;
+        ExitOnErr(pipeline.PB.parsePassPipeline(FPM, pass));
+
+        Measurement measurement;
+        measurement.instructionsBefore = countInstructions(function);
+        measurement.generatedRSS = getPeakRSS();
+
+        auto start = std::chrono::steady_clock::now();
+        FPM.run(function, pipeline.FAM);
+        measurement.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        measurement.peakRSS = getPeakRSS();
+        measurement.instructionsAfter = countInstructions(function);
+
+        return measurement;
+
+    }
+
+    // Runs measure in a child process, which is killed by SIGALRM after -timeout seconds
+    Status measureInChild(StringRef shape, unsigned size, StringRef pass, Measurement& measurement) {
+
+        int fds[2];
+        if (pipe(fds) != 0) {
+            return Status::Failed;
+        }
+
+        pid_t child = fork();
+        if (child < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return Status::Failed;
+        }
+
+        if (child == 0) {
+            close(fds[0]);
+            alarm(Timeout);
+            Measurement result = measure(shape, size, pass);
+            bool written = write(fds[1], &result, sizeof(result)) == sizeof(result);
+            close(fds[1]);
+            _exit(written ? 0 : 1);
+        }
+
+        close(fds[1]);
+        bool received = read(fds[0], &measurement, sizeof(measurement)) == sizeof(measurement);
+        close(fds[0]);
+
+        int status;
+        waitpid(child, &status, 0);
+
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) {
+            return Status::Timeout;
+        }
+        if (!received || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            return Status::Failed;
+        }
+        return Status::OK;
+
+    }
+
+    void emitIR(StringRef shape, unsigned size) {
+
+        LLVMContext context;
+        Generator generator(context, Seed);
+        std::unique_ptr<Module> module = generator.generate(shape, size);
+
+        SmallString<128> path(EmitDirectory);
+        sys::path::append(path, shape + "-" + Twine(size) + ".ll");
+
+        std::error_code error;
+        ToolOutputFile out(path, error, sys::fs::OF_TextWithCRLF);
+        if (error) {
+            errs() << path << ": " << error.message() << "\n";
+            return;
+        }
+
+        module->print(out.os(), nullptr);
+        out.keep();
+
+    }
+
+    void writeJSON(raw_ostream& OS, const std::vector<Result>& results) {
+
+        json::OStream J(OS, 2);
+
+        J.object([&] {
+            J.attribute("version", customopt::version);
+            J.attribute("seed", int64_t(Seed));
+            J.attribute("repeat", int64_t(Repeat));
+            J.attribute("timeout", int64_t(Timeout));
+            J.attribute("triple", sys::getDefaultTargetTriple());
+
+            J.attributeArray("results", [&] {
+                for (const Result& result: results) {
+                    J.object([&] {
+                        J.attribute("shape", result.shape);
+                        J.attribute("size", int64_t(result.size));
+                        J.attribute("pass", result.pass);
+                        J.attribute("status", getStatusName(result.status));
+                        if (result.status != Status::OK) {
+                            return;
+                        }
+                        J.attribute("seconds", result.best.seconds);
+                        J.attribute("instructions_before", int64_t(result.best.instructionsBefore));
+                        J.attribute("instructions_after", int64_t(result.best.instructionsAfter));
+                        J.attribute("instructions_removed",
+                            int64_t(result.best.instructionsBefore) - int64_t(result.best.instructionsAfter));
+                        J.attribute("generated_rss_kb", int64_t(result.best.generatedRSS));
+                        J.attribute("peak_rss_kb", int64_t(result.best.peakRSS));
+                    });
+                }
+            });
+        });
+
+        OS << "\n";
+
+    }
+
+    void writeCSV(raw_ostream& OS, const std::vector<Result>& results) {
+
+        OS << "shape,size,pass,status,seconds,instructions_before,instructions_after,"
+            "instructions_removed,generated_rss_kb,peak_rss_kb\n";
+
+        for (const Result& result: results) {
+
+            OS << result.shape << "," << result.size << "," << result.pass << ","
+                << getStatusName(result.status);
+
+            if (result.status == Status::OK) {
+                const Measurement& best = result.best;
+                OS << "," << format("%.6f", best.seconds) << "," << best.instructionsBefore
+                    << "," << best.instructionsAfter
+                    << "," << int64_t(best.instructionsBefore) - int64_t(best.instructionsAfter)
+                    << "," << best.generatedRSS << "," << best.peakRSS;
+            }
+            else {
+                OS << ",,,,,,";
+            }
+            OS << "\n";
+        }
+
+    }
+}
+
+int main(int argc, char** argv) {
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+
+    cl::ParseCommandLineOptions(argc, argv, "benchmark of the custom optimization passes\n");
+
+    ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+
+    std::vector<std::string> shapes(Shapes.begin(), Shapes.end());
+    if (shapes.empty()) {
+        shapes = {"straight", "domtree", "deadchain", "redundant"};
+    }
+
+    std::vector<unsigned> sizes(Sizes.begin(), Sizes.end());
+    if (sizes.empty()) {
+        sizes = {1000, 10000, 100000, 1000000};
+    }
+
+    std::vector<std::string> passes(Passes.begin(), Passes.end());
+    if (passes.empty()) {
+        passes = {"dcelim", "srcf", "cse"};
+    }
+
+    for (const std::string& shape: shapes) {
+        if (shape != "straight" && shape != "domtree" && shape != "deadchain" && shape != "redundant") {
+            errs() << "error: unknown shape '" << shape << "'\n";
+            return 1;
+        }
+    }
+
+    // Check the passes before the first child parses them
+    for (const std::string& pass: passes) {
+        PassBuilder PB;
+        customopt::registerPasses(PB);
+        FunctionPassManager FPM;
+        ExitOnErr(PB.parsePassPipeline(FPM, pass));
+    }
+
+    if (!EmitDirectory.empty()) {
+        if (std::error_code error = sys::fs::create_directories(EmitDirectory)) {
+            errs() << EmitDirectory << ": " << error.message() << "\n";
+            return 1;
+        }
+        for (const std::string& shape: shapes) {
+            for (unsigned size: sizes) {
+                emitIR(shape, size);
+            }
+        }
+    }
+
+    llvm::sort(sizes);
+
+    std::vector<Result> results;
+    bool failed = false;
+
+    for (const std::string& shape: shapes) {
+
+        // The passes which ran out of time on a smaller function of this shape
+        StringSet<> outOfTime;
+
+        for (unsigned size: sizes) {
+            for (const std::string& pass: passes) {
+
+                Result result = {shape, size, pass, Status::Skipped, {}};
+
+                for (unsigned i = 0; i < std::max(Repeat.getValue(), 1u) && !outOfTime.count(pass); i++) {
+
+                    Measurement measurement;
+                    Status status = measureInChild(shape, size, pass, measurement);
+
+                    if (status == Status::Timeout) {
+                        outOfTime.insert(pass);
+                    }
+                    if (status != Status::OK) {
+                        result.status = status;
+                        failed |= status == Status::Failed;
+                        break;
+                    }
+
+                    if (result.status != Status::OK || measurement.seconds < result.best.seconds) {
+                        result.best = measurement;
+                    }
+                    result.status = Status::OK;
+                }
+
+                // Progress, as the largest sizes take a while
+                errs() << format("%-10s %8u %-8s ", shape.c_str(), size, pass.c_str());
+                if (result.status == Status::OK) {
+                    errs() << format("%10.4fs %8ld KB %8ld removed\n", result.best.seconds,
+                        result.best.peakRSS, long(result.best.instructionsBefore)
+                            - long(result.best.instructionsAfter));
+                }
+                else {
+                    errs() << getStatusName(result.status) << "\n";
+                }
+
+                results.push_back(result);
+            }
+        }
+    }
+
+    std::error_code error;
+    ToolOutputFile out(OutputFilename, error, sys::fs::OF_TextWithCRLF);
+    if (error) {
+        errs() << OutputFilename << ": " << error.message() << "\n";
+        return 1;
+    }
+
+    if (Format == OutputFormat::JSON) {
+        writeJSON(out.os(), results);
+    }
+    else {
+        writeCSV(out.os(), results);
+    }
+    out.keep();
+
+    return failed ? 1 : 0;
+
+}
@@ -5,167 +5,143 @@
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/CodeGen/Passes.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
+#include "ValueNumbering.h"
 
 using namespace llvm;
+using namespace customopt;
 
-namespace {
-    struct CSEPass : public FunctionPass {
-        static char ID;
-        CSEPass() : FunctionPass(ID) {}
+#define DEBUG_TYPE "cse"
 
-        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+STATISTIC(NumCommonSubexpressions, "Number of common subexpressions eliminated");
 
-            // AU.setPreservesCFG();
-            AU.addRequired<DominatorTreeWrapperPass>();
-            return;
+namespace {
+    struct CommonSubexpressionElimination {
 
-        }
+        OptimizationRemarkEmitter& ORE;
 
-        virtual bool runOnFunction(Function& function) override {
+        CommonSubexpressionElimination(OptimizationRemarkEmitter& ORE) : ORE(ORE) {}
+
+        bool run(Function& function, DominatorTree* DT) {
 
             // Vector of instructions to delete at the end of the pass (void instructions)
             std::vector<Instruction *> instsToDelete;
 
-            // Vector of previously seen instructions (globally)
-            std::vector<Instruction *> globalSeenInstructions;
-
-            // Get dominator tree for the function
-            DominatorTree *DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+            ValueTableTy availableValues;
 
-            errs() << "Starting Common Subexpression Elimination pass "
-                "for function: '" << function.getName() << "':\n";
+            LLVM_DEBUG(dbgs() << "Starting Common Subexpression Elimination pass "
+                "for function: '" << function.getName() << "':\n");
 
-            // Iterate through each basic block of the function
-            for (auto& block: function) {
+            // Visit each block in dominator tree preorder, with the values of its dominators available
+            walkDominatorTree(*DT, availableValues, [&](BasicBlock& block) {
+                processBlock(block, availableValues, instsToDelete);
+            });
 
-                // Vector of previously seen instructions (locally)
-                std::vector<Instruction *> localSeenInstructions;
+            LLVM_DEBUG(dbgs() << "Common Subexpression Elimination pass complete!\n\n");
 
-                // Iterate through each instruction in the basic block
-                for (auto& instruction: block) {
-
-                    // errs() << "Current instruction: " << instruction << "\n";
-
-                    Instruction* ins = &instruction;
-                    Instruction* identical;
-
-                    // Common subexpression elimination
-                    bool localSeen = false;
-                    bool globalSeen = false;
-
-                    // We cannot replace a terminating instruction
-                    if(ins->isTerminator()) {
-                        continue;
-                    }
-
-                    // We cannot replace a landing pad instruction either
-                    LandingPadInst *lp = dyn_cast<LandingPadInst>(ins);
-                    if (lp) {
-                        continue;
-                    }
-
-                    // As it is SSA we dont need to worry about instructions being modified
-                    for (auto& i: localSeenInstructions) {
+            // Delete all the unnecessary instructions
+            for(auto i: instsToDelete) {
+                i->eraseFromParent();
+            }
 
-                        if (ins->isIdenticalTo(i)) {
-                            
-                            // errs() << "Found local instruction: " << instruction << "!\n";
+            return !instsToDelete.empty();
 
-                            // Mark locally seen as true, and save the identical instruction
-                            identical = i;
-                            localSeen = true;
-                            break;
-                            
-                        }
+        }
 
-                    }
+        void processBlock(BasicBlock& block, ValueTableTy& availableValues,
+                std::vector<Instruction *>& instsToDelete) {
 
-                    if (localSeen) {
+            // Iterate through each instruction in the basic block
+            for (auto& instruction: block) {
 
-                        // Replace all uses of the instruction with the identical one
-                        ins->replaceAllUsesWith(identical);
+                Instruction* ins = &instruction;
 
-                        // Delete instruction
-                        instsToDelete.push_back(ins);
-                        errs() << "Found Local Common Subexpression: " << instruction << ", Deleting\n";
+                // Terminators, landing pads, phis and memory operations are never numbered
+                if (!SimpleValue::canHandle(ins)) {
+                    continue;
+                }
 
-                        continue;
+                // An available equivalent is defined in this block or a dominating one,
+                // so it can replace every use of the instruction
+                if (Value* identical = availableValues.lookup(ins)) {
 
-                    }
+                    NumCommonSubexpressions++;
+                    LLVM_DEBUG(dbgs() << "Found Common Subexpression: " << instruction << ", Deleting\n");
+                    ORE.emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, "CommonSubexpression", ins)
+                            << "replaced " << ore::NV("Opcode", ins->getOpcodeName())
+                            << " with an identical dominating one";
+                    });
 
-                    for (auto& i: globalSeenInstructions) {
+                    // Replace all uses of the instruction with the identical one
+                    ins->replaceAllUsesWith(identical);
 
-                        if (ins->isIdenticalTo(i)) {
-                            
-                            // errs() << "Found global instruction: " << instruction << "!\n";
+                    // Delete instruction
+                    instsToDelete.push_back(ins);
 
-                            // Mark globally seen as true, and save the identical instruction
-                            identical = i;
-                            globalSeen = true;
-                            break;
-                            
-                        }
+                    continue;
 
-                    }
+                }
 
-                    if (globalSeen) {
-                        
-                        // Set if we can delete the variable (able to replace all uses)
-                        bool canClear = true;
+                // Make the instruction available to this block and the blocks it dominates
+                availableValues.insert(ins, ins);
+            }
+        }
+    };
+}
 
-                        for (auto& U : ins->uses()) {
-                            
-                            // If identical dominates U, 
-                            // i.e if identical can be substituted at all possible uses of U
-                            if (DT->dominates(identical, U)) {
-        
-                                errs() << "Found Global Common Subexpression: " << instruction << ", Replacing\n";
+bool customopt::CSEPass::runImpl(Function& function, DominatorTree& DT,
+    OptimizationRemarkEmitter& ORE) {
 
-                            }
+    CommonSubexpressionElimination cse(ORE);
+    return cse.run(function, &DT);
 
-                            // We hit a non-dominant case, cannot delete the instruction altogether
-                            else {
-                                canClear = false;
-                            }
-                        }
+}
 
-                        if (canClear) {
-                            
-                            // Replace all uses of the instruction with the identical one
-                            ins->replaceAllUsesWith(identical);
-                            instsToDelete.push_back(ins);
-                        }
+PreservedAnalyses customopt::CSEPass::run(Function& function, FunctionAnalysisManager& FAM) {
 
-                        continue;
+    if (!runImpl(function, FAM.getResult<DominatorTreeAnalysis>(function),
+        FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
 
-                    }
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
 
-                    else {
+}
 
-                        // Add instruction to both locally and globally seen
-                        localSeenInstructions.push_back(ins);
-                        globalSeenInstructions.push_back(ins);
+namespace {
+    struct CSELegacyPass : public FunctionPass {
+        static char ID;
+        CSELegacyPass() : FunctionPass(ID) {}
 
-                    }
-                }
-            }
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
 
-            errs() << "Common Subexpression Elimination pass complete!\n\n";
+            AU.setPreservesCFG();
+            AU.addRequired<DominatorTreeWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            AU.addPreserved<DominatorTreeWrapperPass>();
+            return;
 
-            // Delete all the unnecessary instructions
-            for(auto i: instsToDelete) {
-                i->eraseFromParent();
-            }
+        }
 
-            return true;
-        
+        virtual bool runOnFunction(Function& function) override {
+            DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::CSEPass::runImpl(function, DT, ORE);
         }
     };
 }
 
-char CSEPass::ID = 0;
+char CSELegacyPass::ID = 0;
 
-static RegisterPass<CSEPass> X("cse", "Common Subexpression Elimination", false, true);
+static RegisterPass<CSELegacyPass> X("cse", "Common Subexpression Elimination", false, true);
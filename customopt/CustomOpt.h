@@ -0,0 +1,233 @@
+#ifndef CUSTOMOPT_CUSTOMOPT_H
+#define CUSTOMOPT_CUSTOMOPT_H
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace llvm {
+    class AAResults;
+    class LoopInfo;
+    class MemorySSA;
+    class OptimizationRemarkEmitter;
+    class PassBuilder;
+    class ScalarEvolution;
+}
+
+// New pass manager versions of the custom passes, registered under their names by
+// registerPasses() in CustomOptPlugin.cpp (opt -load-pass-plugin ... -passes=dcelim,srcf).
+// The legacy passes (opt -load ... -dcelim -srcf), registered next to each pass under
+// the same name, share the runImpl() of each pass.
+//
+// Each pass counts its transformations with STATISTICs (-stats), reports them as
+// optimization remarks named after the pass (-pass-remarks=srcf, -pass-remarks-output),
+// and prints them with LLVM_DEBUG (-debug-only=srcf); getDebugTypes() lists the names.
+namespace customopt {
+
+    // Version of the passes, part of the key of cached results (FunctionCache.h).
+    // Bump it with every change which can change the output of a pass.
+    const unsigned version = 4;
+
+    // Dead Code Elimination
+    struct DCEPass : public llvm::PassInfoMixin<DCEPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        // Returns true if the function changed; cfgChanged is set when blocks were deleted
+        static bool runImpl(llvm::Function& function, llvm::OptimizationRemarkEmitter& ORE,
+            bool& cfgChanged);
+
+        // Unused instruction without side effects, which can be deleted
+        static bool isTriviallyDead(const llvm::Instruction* ins);
+
+        // Skip the inserts of a chain whose lane is overwritten by insert, leaving them
+        // unused; returns the number of inserts skipped
+        static unsigned bypassOverwrittenLanes(llvm::InsertElementInst* insert);
+
+        // Print the values of the options which change the output of the pass
+        static void printOptions(llvm::raw_ostream& OS);
+    };
+
+    // Strength Reduction & Constant Folding
+    struct SRCFPass : public llvm::PassInfoMixin<SRCFPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, const llvm::TargetTransformInfo& TTI,
+            llvm::OptimizationRemarkEmitter& ORE);
+
+        // The value replacing an instruction (nullptr if no rule matched), and the
+        // kind and pattern of the rule, e.g. "Strength reduction", "x*2^k -> x<<k"
+        struct Rewrite {
+            llvm::Value* result = nullptr;
+            llvm::StringRef kind;
+            llvm::StringRef pattern;
+        };
+
+        // Rewrite a single instruction with the first matching rule. New instructions
+        // are inserted before op. op itself is left in place for the caller to replace
+        // and delete.
+        static Rewrite simplifyInstruction(llvm::Instruction* op, const llvm::TargetTransformInfo& TTI);
+
+        // Fold an integer or floating point binary operator whose operands are left
+        // and right, with the constant folding rules; nullptr if the result is undefined
+        // (division by zero, oversized shift), is a NaN created by the operation, or the
+        // operands are not constants
+        static llvm::Constant* foldBinaryOperator(llvm::BinaryOperator* op, llvm::Constant* left,
+            llvm::Constant* right);
+
+        // Print the values of the options which change the output of the pass
+        static void printOptions(llvm::raw_ostream& OS);
+    };
+
+    // Common Subexpression Elimination
+    struct CSEPass : public llvm::PassInfoMixin<CSEPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, llvm::DominatorTree& DT,
+            llvm::OptimizationRemarkEmitter& ORE);
+    };
+
+    // Sparse Conditional Constant Propagation: constants propagated through phis and
+    // the branches they decide, folded with the rules of SRCF; blocks which can
+    // never execute are deleted
+    struct SCCPropPass : public llvm::PassInfoMixin<SCCPropPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        // Returns true if the function changed; cfgChanged is set when branches
+        // were folded or blocks deleted
+        static bool runImpl(llvm::Function& function, llvm::OptimizationRemarkEmitter& ORE,
+            bool& cfgChanged);
+    };
+
+    // Loop Strength Reduction: multiplies of induction variables, whose value grows by
+    // the same step every iteration, are replaced with a phi incremented in the latch
+    struct LoopSRPass : public llvm::PassInfoMixin<LoopSRPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, llvm::LoopInfo& LI, llvm::ScalarEvolution& SE,
+            llvm::OptimizationRemarkEmitter& ORE);
+    };
+
+    // Loop-Invariant Code Motion: pure instructions whose operands are defined outside
+    // a loop, and loads of memory which alias analysis proves the loop does not write,
+    // are moved to the preheader of the loop
+    struct HoistPass : public llvm::PassInfoMixin<HoistPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, llvm::LoopInfo& LI, llvm::DominatorTree& DT,
+            llvm::AAResults& AA, llvm::OptimizationRemarkEmitter& ORE);
+
+        // Print the values of the options which change the output of the pass
+        static void printOptions(llvm::raw_ostream& OS);
+    };
+
+    // Partial Redundancy Elimination: an expression available on some of the paths to
+    // a block (computed in a predecessor, or a block dominating it) is computed on the
+    // other paths too, and its copy in the block is replaced with a phi. This catches
+    // the matches CSE leaves, which do not dominate the copy.
+    struct PREPass : public llvm::PassInfoMixin<PREPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, llvm::DominatorTree& DT,
+            llvm::OptimizationRemarkEmitter& ORE);
+    };
+
+    // Reassociation: trees of add, mul, and, or and xor are flattened, their constants
+    // combined into one, and rebuilt with their operands in rank order, so that
+    // (a+b)+c and a+(b+c) become the same for CSE, and x+1+2 becomes x+3
+    struct ReassocPass : public llvm::PassInfoMixin<ReassocPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, llvm::OptimizationRemarkEmitter& ORE);
+    };
+
+    // Redundant Load Elimination: a load whose memory was last written by a store of
+    // the same type to the same address is replaced with the stored value, and a load
+    // of memory not written since an earlier load of the same pointer with the earlier
+    // load. The writes in between are found with MemorySSA and alias analysis.
+    struct LoadElimPass : public llvm::PassInfoMixin<LoadElimPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, llvm::DominatorTree& DT, llvm::MemorySSA& MSSA,
+            llvm::AAResults& AA, llvm::OptimizationRemarkEmitter& ORE);
+    };
+
+    // Dead Store Elimination: stores overwritten by a later store before anything may
+    // read them, stores to allocas never read again, and stores of the value just
+    // loaded from the same address are deleted, following the writes after each store
+    // in MemorySSA
+    struct StoreElimPass : public llvm::PassInfoMixin<StoreElimPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, llvm::MemorySSA& MSSA, llvm::AAResults& AA,
+            llvm::OptimizationRemarkEmitter& ORE);
+
+        // Print the values of the options which change the output of the pass
+        static void printOptions(llvm::raw_ostream& OS);
+    };
+
+    // SLP Vectorization: runs of stores to consecutive elements are replaced with a
+    // vector store, and the trees of isomorphic operations (add, mul, shl...) and
+    // loads of consecutive elements they store with vector operations, when the cost
+    // model of the target says the vector code is cheaper
+    struct SLPPass : public llvm::PassInfoMixin<SLPPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, llvm::ScalarEvolution& SE, llvm::AAResults& AA,
+            const llvm::TargetTransformInfo& TTI, llvm::OptimizationRemarkEmitter& ORE);
+
+        // Print the values of the options which change the output of the pass
+        static void printOptions(llvm::raw_ostream& OS);
+    };
+
+    // Interprocedural Constant Propagation: the constants passed by every call site of
+    // a local function are propagated into it, and the functions called with constant
+    // arguments elsewhere are cloned for them, within a budget. The functions changed
+    // are simplified with sccprop and simplify.
+    struct IPCPPass : public llvm::PassInfoMixin<IPCPPass> {
+        llvm::PreservedAnalyses run(llvm::Module& module, llvm::ModuleAnalysisManager& MAM);
+
+        static bool runImpl(llvm::Module& module,
+            llvm::function_ref<const llvm::TargetTransformInfo&(llvm::Function&)> getTTI);
+    };
+
+    // Value Profiling: valueprof-gen records the values taken by the divisors of
+    // divisions by a variable, and the operands of multiplies of two variables, with
+    // the runtime of ValueProfileRuntime.c. valueprof-use reads the profile back, and
+    // versions the instructions whose operand is almost always the same constant C:
+    // if (operand == C) runs the sequence SRCF has for C, the original otherwise.
+    struct ValueProfileGenPass : public llvm::PassInfoMixin<ValueProfileGenPass> {
+        llvm::PreservedAnalyses run(llvm::Module& module, llvm::ModuleAnalysisManager& MAM);
+
+        static bool runImpl(llvm::Module& module);
+    };
+
+    struct ValueProfileUsePass : public llvm::PassInfoMixin<ValueProfileUsePass> {
+        llvm::PreservedAnalyses run(llvm::Module& module, llvm::ModuleAnalysisManager& MAM);
+
+        static bool runImpl(llvm::Module& module,
+            llvm::function_ref<const llvm::TargetTransformInfo&(llvm::Function&)> getTTI);
+    };
+
+    // DCE, SRCF and CSE fused into one worklist-driven pass, run to a fixpoint
+    struct SimplifyPass : public llvm::PassInfoMixin<SimplifyPass> {
+        llvm::PreservedAnalyses run(llvm::Function& function, llvm::FunctionAnalysisManager& FAM);
+
+        static bool runImpl(llvm::Function& function, llvm::DominatorTree& DT,
+            const llvm::TargetTransformInfo& TTI, llvm::OptimizationRemarkEmitter& ORE);
+    };
+
+    // The debug types of the passes, comma-separated as -debug-only takes them
+    std::string getDebugTypes();
+
+    // Print the transformations of the passes to dbgs(), as -debug-only with the
+    // types of getDebugTypes() does. Only builds without NDEBUG have the debug output.
+    void enableDebugOutput();
+
+    // Make the passes above available to PB.parsePassPipeline(), for the plugin and the tools
+    void registerPasses(llvm::PassBuilder& PB);
+}
+
+#endif
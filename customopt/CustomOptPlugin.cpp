@@ -0,0 +1,134 @@
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
+
+using namespace llvm;
+
+// The DEBUG_TYPE of each pass, which also names its remarks; valueprof-gen and
+// valueprof-use share one
+static const char* debugTypes[] = { "dcelim", "srcf", "cse", "simplify", "sccprop", "loopsr", "hoist", "pre", "reassoc", "loadelim", "storeelim", "slp", "ipcp", "valueprof" };
+
+std::string customopt::getDebugTypes() {
+
+    std::string types;
+    for (const char* type: debugTypes) {
+        if (!types.empty()) {
+            types += ",";
+        }
+        types += type;
+    }
+
+    return types;
+
+}
+
+void customopt::enableDebugOutput() {
+
+    DebugFlag = true;
+    setCurrentDebugTypes(debugTypes, sizeof(debugTypes) / sizeof(debugTypes[0]));
+
+}
+
+
+void customopt::registerPasses(PassBuilder& PB) {
+
+    PB.registerPipelineParsingCallback(
+        [](StringRef name, FunctionPassManager& FPM, ArrayRef<PassBuilder::PipelineElement>) {
+
+            if (name == "dcelim") {
+                FPM.addPass(customopt::DCEPass());
+                return true;
+            }
+
+            if (name == "srcf") {
+                FPM.addPass(customopt::SRCFPass());
+                return true;
+            }
+
+            if (name == "cse") {
+                FPM.addPass(customopt::CSEPass());
+                return true;
+            }
+
+            if (name == "simplify") {
+                FPM.addPass(customopt::SimplifyPass());
+                return true;
+            }
+
+            if (name == "sccprop") {
+                FPM.addPass(customopt::SCCPropPass());
+                return true;
+            }
+
+            if (name == "loopsr") {
+                FPM.addPass(customopt::LoopSRPass());
+                return true;
+            }
+
+            if (name == "hoist") {
+                FPM.addPass(customopt::HoistPass());
+                return true;
+            }
+
+            if (name == "pre") {
+                FPM.addPass(customopt::PREPass());
+                return true;
+            }
+
+            if (name == "reassoc") {
+                FPM.addPass(customopt::ReassocPass());
+                return true;
+            }
+
+            if (name == "loadelim") {
+                FPM.addPass(customopt::LoadElimPass());
+                return true;
+            }
+
+            if (name == "storeelim") {
+                FPM.addPass(customopt::StoreElimPass());
+                return true;
+            }
+
+            if (name == "slp") {
+                FPM.addPass(customopt::SLPPass());
+                return true;
+            }
+
+            return false;
+        });
+
+    PB.registerPipelineParsingCallback(
+        [](StringRef name, ModulePassManager& MPM, ArrayRef<PassBuilder::PipelineElement>) {
+
+            if (name == "ipcp") {
+                MPM.addPass(customopt::IPCPPass());
+                return true;
+            }
+
+            if (name == "valueprof-gen") {
+                MPM.addPass(customopt::ValueProfileGenPass());
+                return true;
+            }
+
+            if (name == "valueprof-use") {
+                MPM.addPass(customopt::ValueProfileUsePass());
+                return true;
+            }
+
+            return false;
+        });
+
+}
+
+// Entry point for the new pass manager:
+// opt -load-pass-plugin build/customopt/libCustomOptPass.so -passes=dcelim,srcf,cse
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+
+    return { LLVM_PLUGIN_API_VERSION, "CustomOpt", LLVM_VERSION_STRING, customopt::registerPasses };
+
+}
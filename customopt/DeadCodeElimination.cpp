@@ -8,21 +8,52 @@
 #include "llvm/InitializePasses.h"
 #include "llvm/CodeGen/Passes.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Timer.h"
+
+#include "CustomOpt.h"
 
 using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "dcelim"
+
+STATISTIC(NumDeadInstructions, "Number of dead instructions deleted");
+STATISTIC(NumUnreachableBlocks, "Number of unreachable blocks deleted");
+STATISTIC(NumOverwrittenLanes, "Number of insertelements bypassed because their lane is overwritten");
+
+static cl::opt<bool> AggressiveDCE("dcelim-aggressive", cl::init(false),
+    cl::desc("Use mark-and-sweep liveness in -dcelim, removing dead chains, "
+             "dead phi cycles and unreachable blocks in a single pass"));
 
 namespace {
-    struct DCEPass : public FunctionPass {
-        static char ID;
-        DCEPass() : FunctionPass(ID) {}
+    struct DeadCodeElimination {
+
+        OptimizationRemarkEmitter& ORE;
+
+        // Set when unreachable blocks were deleted
+        bool cfgChanged = false;
+
+        DeadCodeElimination(OptimizationRemarkEmitter& ORE) : ORE(ORE) {}
+
+        bool run(Function& function) {
 
-        virtual bool runOnFunction(Function& function) {
+            if (AggressiveDCE) {
+                return runAggressive(function);
+            }
 
             // Vector of instructions to delete at the end of the pass (void instructions)
             std::vector<Instruction *> instsToDelete;
 
-            errs() << "Starting Dead Code Elimination pass "
-                "for function: '" << function.getName() << "':\n";
+            LLVM_DEBUG(dbgs() << "Starting Dead Code Elimination pass "
+                "for function: '" << function.getName() << "':\n");
+
+            bool changed = bypassOverwrittenLanes(function);
 
             // Iterate through each basic block of the function
             for (auto& block: function) {
@@ -32,43 +63,318 @@ namespace {
                     
                     Instruction* ins = &instruction;
 
-                    // errs() << "Current instruction: " << instruction << "\n";
-
-                    // If instruction is in use, 
-                    // or has side effects, 
-                    // or is a terminator instruction, continue
-                    if (!ins->use_empty() || 
-                        ins->mayHaveSideEffects() ||
-                        ins->isTerminator() ) {
-                        continue;
-                    }
-
-                    // If instruction is a landing pad instruction (jump target), continue
-                    LandingPadInst *lp = dyn_cast<LandingPadInst>(ins);
-                    if (lp) {
+                    if (!customopt::DCEPass::isTriviallyDead(ins)) {
                         continue;
                     }
 
                     // Delete instruction
                     instsToDelete.push_back(ins);
 
-                    errs() << "Deleting instruction: " << instruction << "\n";
+                    remarkDeadInstruction(ins);
                 }
             }
 
-            errs() << "Dead Code Elimination pass complete!\n\n";
+            LLVM_DEBUG(dbgs() << "Dead Code Elimination pass complete!\n\n");
                 
             // Delete all the unnecessary instructions
             for(auto i: instsToDelete) {
                 i->eraseFromParent();
             }
 
-            return true;
+            return changed || !instsToDelete.empty();
         
         }
+
+        // A vector lane written by an insertelement and overwritten by the next
+        // insertelement of the chain is dead. Skipping the first insertelement
+        // leaves it unused, so the sweep deletes it.
+        bool bypassOverwrittenLanes(Function& function) {
+
+            bool changed = false;
+
+            for (auto& block: function) {
+                for (auto& instruction: block) {
+
+                    InsertElementInst* insert = dyn_cast<InsertElementInst>(&instruction);
+                    if (!insert) {
+                        continue;
+                    }
+
+                    if (unsigned bypassed = customopt::DCEPass::bypassOverwrittenLanes(insert)) {
+
+                        NumOverwrittenLanes += bypassed;
+                        ORE.emit([&]() {
+                            return OptimizationRemark(DEBUG_TYPE, "OverwrittenLane", insert)
+                                << "bypassed " << ore::NV("Inserts", bypassed)
+                                << " insertelement(s) overwritten by this one";
+                        });
+                        changed = true;
+                    }
+                }
+            }
+
+            return changed;
+
+        }
+
+        // Mark-and-sweep dead code elimination: everything not reachable from a
+        // side-effecting instruction or terminator through operands is dead
+        bool runAggressive(Function& function) {
+
+            // Set of instructions known to be live, and the ones whose operands
+            // still have to be marked
+            SmallPtrSet<Instruction *, 32> liveInstructions;
+            SmallVector<Instruction *, 32> worklist;
+
+            // Blocks reachable from the entry block
+            SmallPtrSet<BasicBlock *, 16> reachableBlocks;
+
+            LLVM_DEBUG(dbgs() << "Starting Aggressive Dead Code Elimination pass "
+                "for function: '" << function.getName() << "':\n");
+
+            bool changed = bypassOverwrittenLanes(function);
+
+            // Timed separately from the sweep under -time-passes
+            Optional<NamedRegionTimer> markTimer;
+            markTimer.emplace("dcelim-mark", "Mark live instructions",
+                "customopt", "Custom optimization passes", TimePassesIsEnabled);
+
+            for (BasicBlock* block: depth_first(&function.getEntryBlock())) {
+                reachableBlocks.insert(block);
+            }
+
+            // Seed liveness from instructions which are needed regardless of their uses
+            for (BasicBlock* block: reachableBlocks) {
+                for (auto& instruction: *block) {
+
+                    Instruction* ins = &instruction;
+
+                    if (ins->mayHaveSideEffects() ||
+                        ins->isTerminator() ||
+                        ins->isEHPad()) {
+
+                        liveInstructions.insert(ins);
+                        worklist.push_back(ins);
+
+                    }
+                }
+            }
+
+            // Propagate liveness to the operands of live instructions
+            while (!worklist.empty()) {
+
+                Instruction* ins = worklist.pop_back_val();
+
+                for (Value* operand: ins->operand_values()) {
+
+                    Instruction* opIns = dyn_cast<Instruction>(operand);
+
+                    if (opIns && liveInstructions.insert(opIns).second) {
+                        worklist.push_back(opIns);
+                    }
+                }
+            }
+
+            markTimer.reset();
+            NamedRegionTimer sweepTimer("dcelim-sweep", "Delete dead instructions and blocks",
+                "customopt", "Custom optimization passes", TimePassesIsEnabled);
+
+            // Vector of instructions to delete at the end of the pass
+            std::vector<Instruction *> instsToDelete;
+
+            // Vector of unreachable blocks to delete at the end of the pass
+            std::vector<BasicBlock *> blocksToDelete;
+
+            for (auto& block: function) {
+
+                if (!reachableBlocks.count(&block)) {
+                    blocksToDelete.push_back(&block);
+                    continue;
+                }
+
+                for (auto& instruction: block) {
+
+                    if (liveInstructions.count(&instruction)) {
+                        continue;
+                    }
+
+                    // Delete instruction
+                    instsToDelete.push_back(&instruction);
+
+                    remarkDeadInstruction(&instruction);
+                }
+            }
+
+            // Unreachable blocks may use the dead instructions (nothing they do is marked
+            // live), so they drop their references first. Their successors are kept to
+            // detach them from the phis of the reachable ones once the dead instructions,
+            // dead phis included, are gone.
+            std::vector<std::pair<BasicBlock *, BasicBlock *>> edgesToRemove;
+
+            for (auto block: blocksToDelete) {
+
+                NumUnreachableBlocks++;
+                LLVM_DEBUG(dbgs() << "Deleting unreachable block: ";
+                    block->printAsOperand(dbgs(), false);
+                    dbgs() << "\n");
+                ORE.emit([&]() {
+                    return OptimizationRemark(DEBUG_TYPE, "UnreachableBlock",
+                        block->front().getDebugLoc(), block)
+                        << "deleted unreachable block";
+                });
+
+                for (BasicBlock* successor: successors(block)) {
+                    if (reachableBlocks.count(successor)) {
+                        edgesToRemove.push_back({block, successor});
+                    }
+                }
+
+                block->dropAllReferences();
+            }
+
+            // Dead instructions may use each other (phi cycles), so drop every
+            // reference before erasing any of them
+            for (auto i: instsToDelete) {
+                i->dropAllReferences();
+            }
+
+            for (auto i: instsToDelete) {
+                i->eraseFromParent();
+            }
+
+            for (auto edge: edgesToRemove) {
+                edge.second->removePredecessor(edge.first);
+            }
+
+            for (auto block: blocksToDelete) {
+                block->eraseFromParent();
+            }
+
+            cfgChanged = !blocksToDelete.empty();
+
+            LLVM_DEBUG(dbgs() << "Aggressive Dead Code Elimination pass complete!\n\n");
+
+            return changed || !instsToDelete.empty() || !blocksToDelete.empty();
+
+        }
+
+        // Count and report an instruction about to be deleted
+        void remarkDeadInstruction(Instruction* ins) {
+
+            NumDeadInstructions++;
+            LLVM_DEBUG(dbgs() << "Deleting instruction: " << *ins << "\n");
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "DeadInstruction", ins)
+                    << "deleted dead " << ore::NV("Opcode", ins->getOpcodeName());
+            });
+
+        }
+    };
+}
+
+bool customopt::DCEPass::isTriviallyDead(const Instruction* ins) {
+
+    // If instruction is in use, 
+    // or has side effects, 
+    // or is a terminator instruction, it is live
+    if (!ins->use_empty() || 
+        ins->mayHaveSideEffects() ||
+        ins->isTerminator() ) {
+        return false;
+    }
+
+    // If instruction is a landing pad instruction (jump target), it is live
+    if (isa<LandingPadInst>(ins)) {
+        return false;
+    }
+
+    return true;
+
+}
+
+unsigned customopt::DCEPass::bypassOverwrittenLanes(InsertElementInst* insert) {
+
+    if (!isa<ConstantInt>(insert->getOperand(2))) {
+        return 0;
+    }
+
+    unsigned bypassed = 0;
+
+    // Walk up the chain while the previous insert writes the same lane
+    // and nothing else reads its result
+    while (InsertElementInst* previous = dyn_cast<InsertElementInst>(insert->getOperand(0))) {
+
+        if (!previous->hasOneUse() || previous->getOperand(2) != insert->getOperand(2)) {
+            break;
+        }
+
+        LLVM_DEBUG(dbgs() << "Bypassing overwritten vector lane: " << *previous << "\n");
+
+        insert->setOperand(0, previous->getOperand(0));
+        bypassed++;
+    }
+
+    return bypassed;
+
+}
+
+void customopt::DCEPass::printOptions(raw_ostream& OS) {
+
+    OS << "dcelim-aggressive=" << AggressiveDCE << "\n";
+
+}
+
+bool customopt::DCEPass::runImpl(Function& function, OptimizationRemarkEmitter& ORE,
+    bool& cfgChanged) {
+
+    DeadCodeElimination dce(ORE);
+    bool changed = dce.run(function);
+
+    cfgChanged = dce.cfgChanged;
+    return changed;
+
+}
+
+PreservedAnalyses customopt::DCEPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    bool cfgChanged = false;
+
+    if (!runImpl(function, FAM.getResult<OptimizationRemarkEmitterAnalysis>(function), cfgChanged)) {
+        return PreservedAnalyses::all();
+    }
+
+    // Only the aggressive mode deletes (unreachable) blocks
+    PreservedAnalyses PA;
+    if (!cfgChanged) {
+        PA.preserveSet<CFGAnalyses>();
+    }
+    return PA;
+
+}
+
+namespace {
+    struct DCELegacyPass : public FunctionPass {
+        static char ID;
+        DCELegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            if (!AggressiveDCE) {
+                AU.setPreservesCFG();
+            }
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            bool cfgChanged;
+            return customopt::DCEPass::runImpl(function, ORE, cfgChanged);
+        }
     };
 }
 
-char DCEPass::ID = 0;
+char DCELegacyPass::ID = 0;
 
-static RegisterPass<DCEPass> X("dcelim", "Dead Code Elimination", false, true);
+static RegisterPass<DCELegacyPass> X("dcelim", "Dead Code Elimination", false, true);
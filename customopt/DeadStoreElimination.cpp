@@ -0,0 +1,292 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/MemorySSAUpdater.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "storeelim"
+
+STATISTIC(NumStoresOverwritten, "Number of stores overwritten before being read");
+STATISTIC(NumStoresUnread, "Number of stores to local memory never read again");
+STATISTIC(NumStoresNoOp, "Number of stores of the value just loaded from the same memory");
+
+static cl::opt<unsigned> MaxScan("storeelim-max-scan", cl::init(100),
+    cl::desc("Maximum number of memory accesses -storeelim checks after a store before keeping it"));
+
+namespace {
+
+    struct DeadStoreElimination {
+
+        MemorySSA& MSSA;
+        AAResults& AA;
+        OptimizationRemarkEmitter& ORE;
+
+        DeadStoreElimination(MemorySSA& MSSA, AAResults& AA, OptimizationRemarkEmitter& ORE)
+            : MSSA(MSSA), AA(AA), ORE(ORE) {}
+
+        bool run(Function& function) {
+
+            bool changed = false;
+
+            LLVM_DEBUG(dbgs() << "Starting Dead Store Elimination pass "
+                "for function: '" << function.getName() << "':\n");
+
+            // Stores are deleted as soon as they are found dead, so that the accesses
+            // which used them point past them for the next stores
+            MemorySSAUpdater MSSAU(&MSSA);
+
+            for (BasicBlock& block: function) {
+                for (Instruction& instruction: make_early_inc_range(block)) {
+
+                    StoreInst* store = dyn_cast<StoreInst>(&instruction);
+                    if (!store || !store->isSimple()) {
+                        continue;
+                    }
+
+                    const char* reason = getDeadReason(store);
+                    if (!reason) {
+                        continue;
+                    }
+
+                    LLVM_DEBUG(dbgs() << "Deleting " << *store << ": " << reason << "\n");
+                    ORE.emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, "DeadStore", store)
+                            << "deleted store: " << ore::NV("Reason", reason);
+                    });
+
+                    MSSAU.removeMemoryAccess(store);
+                    store->eraseFromParent();
+                    changed = true;
+                }
+            }
+
+            LLVM_DEBUG(dbgs() << "Dead Store Elimination pass complete!\n\n");
+
+            return changed;
+
+        }
+
+        // Why the store can be deleted, or nullptr if it must stay
+        const char* getDeadReason(StoreInst* store) {
+
+            if (isNoOpStore(store)) {
+                NumStoresNoOp++;
+                return "stores the value just loaded from the same memory";
+            }
+
+            bool overwritten;
+            if (!isDeadAfter(store, overwritten)) {
+                return nullptr;
+            }
+
+            if (overwritten) {
+                NumStoresOverwritten++;
+                return "overwritten before being read";
+            }
+
+            NumStoresUnread++;
+            return "local memory not read again";
+
+        }
+
+        // store (load p), p, with no write of p in between
+        bool isNoOpStore(StoreInst* store) {
+
+            LoadInst* load = dyn_cast<LoadInst>(store->getValueOperand());
+            if (!load || !load->isSimple() || load->getPointerOperand() != store->getPointerOperand()) {
+                return false;
+            }
+
+            // The write the load read from is still the last one before the store
+            MemoryAccess* loadClobber = MSSA.getWalker()->getClobberingMemoryAccess(load);
+            MemoryAccess* storeClobber = MSSA.getWalker()->getClobberingMemoryAccess(MSSA.getMemoryAccess(store));
+
+            return loadClobber == storeClobber;
+
+        }
+
+        // Follow the writes after the store, as long as they form a single chain (no
+        // branch or loop merging memory states through a MemoryPhi), until one covers
+        // the memory of the store. Every access using a write of the chain is checked:
+        // if one may read the memory of the store, the store is live. overwritten is
+        // set when a later store covers it; when the chain ends before one does, only
+        // stores to allocas, which are gone once the function returns, are dead.
+        bool isDeadAfter(StoreInst* store, bool& overwritten) {
+
+            const DataLayout& DL = store->getModule()->getDataLayout();
+            MemoryLocation location = MemoryLocation::get(store);
+
+            // Memory of the caller or of globals may be read after a call which does not
+            // return, or unwinds; the overwriting store then has to be in the same block,
+            // with nothing in between which can leave it
+            bool local = isa<AllocaInst>(getUnderlyingObject(store->getPointerOperand()));
+
+            MemoryAccess* current = MSSA.getMemoryAccess(store);
+            unsigned scanned = 0;
+
+            while (true) {
+
+                MemoryDef* next = nullptr;
+
+                for (User* user: current->users()) {
+
+                    if (++scanned > MaxScan || isa<MemoryPhi>(user)) {
+                        return false;
+                    }
+
+                    MemoryUseOrDef* access = cast<MemoryUseOrDef>(user);
+                    Instruction* ins = access->getMemoryInst();
+
+                    if (isRefSet(AA.getModRefInfo(ins, location))) {
+                        LLVM_DEBUG(dbgs() << "Keeping " << *store << ", read by " << *ins << "\n");
+                        return false;
+                    }
+
+                    if (isa<MemoryUse>(access)) {
+                        continue;
+                    }
+
+                    // Two writes after this one means the chain forks
+                    if (next) {
+                        return false;
+                    }
+                    next = cast<MemoryDef>(access);
+                }
+
+                if (!next) {
+                    overwritten = false;
+                    return local;
+                }
+
+                Instruction* write = next->getMemoryInst();
+
+                if (!local && !isGuaranteedToTransferExecutionToSuccessor(write)) {
+                    return false;
+                }
+
+                if (StoreInst* later = dyn_cast<StoreInst>(write)) {
+
+                    if (covers(later, store, location, DL)) {
+
+                        if (!local && !isSameBlockPath(store, later)) {
+                            return false;
+                        }
+
+                        overwritten = true;
+                        return true;
+                    }
+                }
+
+                current = next;
+            }
+
+        }
+
+        // later writes at least all the bytes of store
+        bool covers(StoreInst* later, StoreInst* store, const MemoryLocation& location, const DataLayout& DL) {
+
+            if (!later->isSimple()) {
+                return false;
+            }
+
+            if (AA.alias(MemoryLocation::get(later), location) != AliasResult::MustAlias) {
+                return false;
+            }
+
+            TypeSize laterSize = DL.getTypeStoreSize(later->getValueOperand()->getType());
+            TypeSize storeSize = DL.getTypeStoreSize(store->getValueOperand()->getType());
+
+            return !laterSize.isScalable() && !storeSize.isScalable() &&
+                laterSize.getFixedSize() >= storeSize.getFixedSize();
+
+        }
+
+        // later follows store in its block, and every instruction in between runs through
+        bool isSameBlockPath(StoreInst* store, StoreInst* later) {
+
+            if (later->getParent() != store->getParent() || !store->comesBefore(later)) {
+                return false;
+            }
+
+            for (Instruction* ins = store->getNextNode(); ins != later; ins = ins->getNextNode()) {
+                if (!isGuaranteedToTransferExecutionToSuccessor(ins)) {
+                    return false;
+                }
+            }
+
+            return true;
+
+        }
+    };
+}
+
+void customopt::StoreElimPass::printOptions(raw_ostream& OS) {
+
+    OS << "storeelim-max-scan=" << MaxScan << "\n";
+
+}
+
+bool customopt::StoreElimPass::runImpl(Function& function, MemorySSA& MSSA, AAResults& AA,
+    OptimizationRemarkEmitter& ORE) {
+
+    DeadStoreElimination dse(MSSA, AA, ORE);
+    return dse.run(function);
+
+}
+
+PreservedAnalyses customopt::StoreElimPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    if (!runImpl(function, FAM.getResult<MemorySSAAnalysis>(function).getMSSA(),
+        FAM.getResult<AAManager>(function), FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    PA.preserve<MemorySSAAnalysis>();
+    return PA;
+
+}
+
+namespace {
+    struct StoreElimLegacyPass : public FunctionPass {
+        static char ID;
+        StoreElimLegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.setPreservesCFG();
+            AU.addRequired<MemorySSAWrapperPass>();
+            AU.addRequired<AAResultsWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            AU.addPreserved<MemorySSAWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            MemorySSA& MSSA = getAnalysis<MemorySSAWrapperPass>().getMSSA();
+            AAResults& AA = getAnalysis<AAResultsWrapperPass>().getAAResults();
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::StoreElimPass::runImpl(function, MSSA, AA, ORE);
+        }
+    };
+}
+
+char StoreElimLegacyPass::ID = 0;
+
+static RegisterPass<StoreElimLegacyPass> X("storeelim", "Dead Store Elimination", false, false);
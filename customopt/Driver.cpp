@@ -0,0 +1,33 @@
+#include "llvm/MC/TargetRegistry.h"
+
+#include "Driver.h"
+#include "CustomOpt.h"
+
+using namespace llvm;
+
+std::unique_ptr<TargetMachine> customopt::createTargetMachine(const Module& module) {
+
+    std::string error;
+    const Target* target = TargetRegistry::lookupTarget(module.getTargetTriple(), error);
+
+    if (!target) {
+        return nullptr;
+    }
+
+    return std::unique_ptr<TargetMachine>(target->createTargetMachine(
+        module.getTargetTriple(), "", "", TargetOptions(), None));
+
+}
+
+customopt::Pipeline::Pipeline(const Module& module)
+    : TM(createTargetMachine(module)), PB(TM.get()) {
+
+    registerPasses(PB);
+
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+}
@@ -0,0 +1,37 @@
+#ifndef CUSTOMOPT_DRIVER_H
+#define CUSTOMOPT_DRIVER_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <memory>
+
+// Shared by the tools which run the custom passes in-process
+// (customopt-parallel, customopt-batch)
+namespace customopt {
+
+    // Target machine for the triple of module, or nullptr when the target is not
+    // available, in which case the passes use the default cost model
+    std::unique_ptr<llvm::TargetMachine> createTargetMachine(const llvm::Module& module);
+
+    // A pass builder knowing the custom passes, and the analysis managers to run
+    // its pipelines on one module. A TargetMachine caches its subtargets without
+    // locking, so a pipeline can only be used by one thread at a time.
+    struct Pipeline {
+        std::unique_ptr<llvm::TargetMachine> TM;
+        llvm::PassBuilder PB;
+
+        llvm::LoopAnalysisManager LAM;
+        llvm::FunctionAnalysisManager FAM;
+        llvm::CGSCCAnalysisManager CGAM;
+        llvm::ModuleAnalysisManager MAM;
+
+        explicit Pipeline(const llvm::Module& module);
+    };
+}
+
+#endif
@@ -0,0 +1,490 @@
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/TypeFinder.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+
+#include "FunctionCache.h"
+#include "CustomOpt.h"
+
+using namespace llvm;
+using namespace customopt;
+
+namespace {
+
+    // Collect the globals referenced by function, looking through constant
+    // expressions and aggregates. Returns false if the function cannot be cached.
+    bool collectGlobals(Function& function, SetVector<GlobalValue *>& globals) {
+
+        if (function.hasMetadata() || function.hasPersonalityFn() ||
+            function.hasPrefixData() || function.hasPrologueData()) {
+            return false;
+        }
+
+        SmallPtrSet<Constant *, 32> visited;
+        SmallVector<Constant *, 32> worklist;
+
+        for (Instruction& instruction: instructions(function)) {
+
+            // Metadata would have to be numbered the same way in every module
+            if (instruction.hasMetadata()) {
+                return false;
+            }
+
+            for (Value* operand: instruction.operands()) {
+                if (Constant* constant = dyn_cast<Constant>(operand)) {
+                    worklist.push_back(constant);
+                }
+            }
+        }
+
+        while (!worklist.empty()) {
+
+            Constant* constant = worklist.pop_back_val();
+            if (!visited.insert(constant).second) {
+                continue;
+            }
+
+            // A cache entry declares the globals by name
+            if (GlobalValue* global = dyn_cast<GlobalValue>(constant)) {
+                if (!global->hasName() || !(isa<Function>(global) || isa<GlobalVariable>(global))) {
+                    return false;
+                }
+                globals.insert(global);
+                continue;
+            }
+
+            if (isa<BlockAddress>(constant) || isa<DSOLocalEquivalent>(constant) ||
+                isa<NoCFIValue>(constant)) {
+                return false;
+            }
+
+            for (Value* operand: constant->operands()) {
+                worklist.push_back(cast<Constant>(operand));
+            }
+        }
+
+        return true;
+
+    }
+
+    // Collect the named structs used by type, which are printed by name only
+    void collectStructs(Type* type, SetVector<StructType *>& structs) {
+
+        if (StructType* structType = dyn_cast<StructType>(type)) {
+            if (!structType->isLiteral() && !structs.insert(structType)) {
+                return;
+            }
+        }
+
+        for (Type* subtype: type->subtypes()) {
+            collectStructs(subtype, structs);
+        }
+
+    }
+
+    void printAttributes(raw_ostream& OS, AttributeList attributes) {
+
+        for (unsigned index: attributes.indexes()) {
+            if (attributes.hasAttributesAtIndex(index)) {
+                OS << " " << index << ":{" << attributes.getAsString(index) << "}";
+            }
+        }
+
+    }
+
+    // Maps the types of a cache entry, read into the context of the module, to
+    // the types of the module. The bitcode reader gives a struct whose name is
+    // already used in the context the name with a ".<number>" suffix.
+    struct CachedTypeRemapper : public ValueMapTypeRemapper {
+
+        LLVMContext& context;
+        DenseMap<Type *, Type *> mapped;
+        bool failed = false;
+
+        CachedTypeRemapper(LLVMContext& context) : context(context) {}
+
+        Type* remapType(Type* type) override {
+
+            auto it = mapped.find(type);
+            if (it != mapped.end()) {
+                return it->second;
+            }
+
+            StructType* structType = dyn_cast<StructType>(type);
+            if (structType && !structType->isLiteral()) {
+                return remapStruct(structType);
+            }
+
+            SmallVector<Type *, 4> subtypes;
+            bool changed = false;
+            for (Type* subtype: type->subtypes()) {
+                subtypes.push_back(remapType(subtype));
+                changed |= subtypes.back() != subtype;
+            }
+
+            Type* result = type;
+
+            if (changed) {
+                if (PointerType* pointer = dyn_cast<PointerType>(type)) {
+                    result = PointerType::get(subtypes[0], pointer->getAddressSpace());
+                }
+                else if (ArrayType* array = dyn_cast<ArrayType>(type)) {
+                    result = ArrayType::get(subtypes[0], array->getNumElements());
+                }
+                else if (VectorType* vector = dyn_cast<VectorType>(type)) {
+                    result = VectorType::get(subtypes[0], vector->getElementCount());
+                }
+                else if (FunctionType* function = dyn_cast<FunctionType>(type)) {
+                    result = FunctionType::get(subtypes[0], makeArrayRef(subtypes).drop_front(),
+                        function->isVarArg());
+                }
+                else if (StructType* literal = dyn_cast<StructType>(type)) {
+                    result = StructType::get(context, subtypes, literal->isPacked());
+                }
+                else {
+                    failed = true;
+                }
+            }
+
+            mapped[type] = result;
+            return result;
+
+        }
+
+        Type* remapStruct(StructType* structType) {
+
+            StringRef name = structType->getName();
+            StringRef suffix = name.substr(name.rfind('.') + 1);
+
+            StructType* original = nullptr;
+            if (name.contains('.') && !suffix.empty() && all_of(suffix, isDigit)) {
+                original = StructType::getTypeByName(context, name.drop_back(suffix.size() + 1));
+            }
+
+            if (!original || original == structType) {
+                failed = true;
+                mapped[structType] = structType;
+                return structType;
+            }
+
+            // Mapped before the elements are compared, for recursive types
+            mapped[structType] = original;
+
+            if (original->isOpaque() != structType->isOpaque() ||
+                original->isPacked() != structType->isPacked() ||
+                original->getNumElements() != structType->getNumElements()) {
+                failed = true;
+                return original;
+            }
+
+            for (unsigned i = 0; i < structType->getNumElements(); i++) {
+                if (remapType(structType->getElementType(i)) != original->getElementType(i)) {
+                    failed = true;
+                }
+            }
+
+            return original;
+
+        }
+    };
+}
+
+FunctionCache::FunctionCache(StringRef directory, StringRef pipeline)
+    : directory(directory.str()), hits(0), misses(0), uncacheable(0) {
+
+    raw_string_ostream OS(configuration);
+    OS << "customopt " << version << "\n" << pipeline << "\n";
+    DCEPass::printOptions(OS);
+    SRCFPass::printOptions(OS);
+    HoistPass::printOptions(OS);
+    StoreElimPass::printOptions(OS);
+    SLPPass::printOptions(OS);
+
+}
+
+std::string FunctionCache::getKey(Function& function, ModuleSlotTracker& MST) const {
+
+    SetVector<GlobalValue *> globals;
+    if (!collectGlobals(function, globals)) {
+        return "";
+    }
+
+    const Module& module = *function.getParent();
+
+    std::string text;
+    raw_string_ostream OS(text);
+
+    OS << configuration << module.getTargetTriple() << "\n"
+        << module.getDataLayoutStr() << "\n";
+
+    SetVector<StructType *> structs;
+    collectStructs(function.getFunctionType(), structs);
+
+    OS << "function " << *function.getFunctionType() << " cc" << function.getCallingConv();
+    printAttributes(OS, function.getAttributes());
+    OS << "\n";
+
+    // Printing the whole function at once is much cheaper than instruction by instruction
+    static_cast<Value&>(function).print(OS, MST);
+
+    for (Instruction& instruction: instructions(function)) {
+
+        // Attribute groups are printed as module-wide numbers
+        if (CallBase* call = dyn_cast<CallBase>(&instruction)) {
+            OS << "call";
+            printAttributes(OS, call->getAttributes());
+            OS << "\n";
+            collectStructs(call->getFunctionType(), structs);
+        }
+
+        collectStructs(instruction.getType(), structs);
+        for (Value* operand: instruction.operands()) {
+            collectStructs(operand->getType(), structs);
+        }
+        if (AllocaInst* alloca = dyn_cast<AllocaInst>(&instruction)) {
+            collectStructs(alloca->getAllocatedType(), structs);
+        }
+        if (GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(&instruction)) {
+            collectStructs(gep->getSourceElementType(), structs);
+        }
+    }
+
+    // The declarations of the referenced globals, which the passes can look at
+    for (GlobalValue* global: globals) {
+
+        OS << "@" << global->getName() << " " << *global->getValueType()
+            << " linkage" << global->getLinkage() << " dso_local" << global->isDSOLocal();
+
+        if (Function* callee = dyn_cast<Function>(global)) {
+            OS << " cc" << callee->getCallingConv();
+            printAttributes(OS, callee->getAttributes());
+        }
+        else {
+            GlobalVariable* variable = cast<GlobalVariable>(global);
+            OS << " constant" << variable->isConstant() << " align"
+                << (variable->getAlign() ? variable->getAlign()->value() : 0)
+                << " tls" << variable->getThreadLocalMode();
+        }
+        OS << "\n";
+
+        collectStructs(global->getValueType(), structs);
+    }
+
+    // Named structs are printed by name, so their bodies are part of the key as well
+    for (size_t i = 0; i < structs.size(); i++) {
+
+        StructType* structType = structs[i];
+        OS << "%" << structType->getName() << " = ";
+
+        if (structType->isOpaque()) {
+            OS << "opaque\n";
+            continue;
+        }
+
+        OS << (structType->isPacked() ? "<{" : "{");
+        for (Type* element: structType->elements()) {
+            OS << " " << *element;
+            collectStructs(element, structs);
+        }
+        OS << (structType->isPacked() ? " }>\n" : " }\n");
+    }
+
+    return toHex(SHA1::hash(arrayRefFromStringRef(OS.str())), true);
+
+}
+
+bool FunctionCache::load(Function& function, StringRef key) const {
+
+    SmallString<128> path(directory);
+    sys::path::append(path, key);
+
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(path,
+        /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+        return false;
+    }
+
+    // An entry which cannot be read is a miss, and is overwritten
+    Expected<std::unique_ptr<Module>> entry = parseBitcodeFile((*buffer)->getMemBufferRef(),
+        function.getContext());
+    if (!entry) {
+        consumeError(entry.takeError());
+        return false;
+    }
+
+    // The optimized body is the only definition in the entry
+    Function* cached = nullptr;
+    for (Function& candidate: **entry) {
+        if (!candidate.isDeclaration()) {
+            cached = &candidate;
+        }
+    }
+    if (!cached) {
+        return false;
+    }
+
+    CachedTypeRemapper types(function.getContext());
+
+    TypeFinder structs;
+    structs.run(**entry, true);
+    for (StructType* structType: structs) {
+        types.remapType(structType);
+    }
+
+    if (types.failed || types.remapType(cached->getFunctionType()) != function.getFunctionType()) {
+        return false;
+    }
+
+    // Map the declarations of the entry to the globals of the module
+    ValueToValueMapTy VMap;
+
+    for (GlobalValue& global: (*entry)->global_values()) {
+
+        if (&global == cached) {
+            continue;
+        }
+
+        GlobalValue* target = function.getParent()->getNamedValue(global.getName());
+        if (!target || isa<Function>(target) != isa<Function>(global) ||
+            types.remapType(global.getType()) != target->getType() ||
+            types.remapType(global.getValueType()) != target->getValueType()) {
+            return false;
+        }
+
+        VMap[&global] = target;
+    }
+
+    for (size_t i = 0; i < function.arg_size(); i++) {
+        VMap[cached->getArg(i)] = function.getArg(i);
+    }
+
+    // Replace the body of function with the cached one
+    for (BasicBlock& block: function) {
+        block.dropAllReferences();
+    }
+    while (!function.empty()) {
+        function.begin()->eraseFromParent();
+    }
+
+    function.getBasicBlockList().splice(function.end(), cached->getBasicBlockList());
+
+    for (Instruction& instruction: instructions(function)) {
+        RemapInstruction(&instruction, VMap, RF_IgnoreMissingLocals, &types);
+    }
+
+    return true;
+
+}
+
+void FunctionCache::store(Function& function, StringRef key) const {
+
+    SetVector<GlobalValue *> globals;
+    if (!collectGlobals(function, globals)) {
+        return;
+    }
+
+    // The entry holds a copy of the function, with declarations of the globals it uses
+    Module entry("customopt.cache", function.getContext());
+    entry.setDataLayout(function.getParent()->getDataLayout());
+    entry.setTargetTriple(function.getParent()->getTargetTriple());
+
+    ValueToValueMapTy VMap;
+
+    for (GlobalValue* global: globals) {
+
+        if (Function* callee = dyn_cast<Function>(global)) {
+            VMap[global] = Function::Create(callee->getFunctionType(), GlobalValue::ExternalLinkage,
+                callee->getAddressSpace(), callee->getName(), &entry);
+        }
+        else {
+            GlobalVariable* variable = cast<GlobalVariable>(global);
+            VMap[global] = new GlobalVariable(entry, variable->getValueType(), variable->isConstant(),
+                GlobalValue::ExternalLinkage, nullptr, variable->getName(), nullptr,
+                variable->getThreadLocalMode(), variable->getAddressSpace());
+        }
+    }
+
+    Function* copy = Function::Create(function.getFunctionType(), GlobalValue::ExternalLinkage,
+        function.getAddressSpace(), "", &entry);
+
+    for (size_t i = 0; i < function.arg_size(); i++) {
+        VMap[function.getArg(i)] = copy->getArg(i);
+    }
+
+    SmallVector<ReturnInst *, 8> returns;
+    CloneFunctionInto(copy, &function, VMap, CloneFunctionChangeType::DifferentModule, returns);
+
+    // Written to a temporary file and renamed, so that readers never see a partial entry
+    SmallString<128> path(directory);
+    sys::path::append(path, key);
+
+    Expected<sys::fs::TempFile> temp = sys::fs::TempFile::create(path + ".tmp%%%%%%");
+    if (!temp) {
+        consumeError(temp.takeError());
+        return;
+    }
+
+    // Without the symbol table of WriteBitcodeToFile, which is only needed by linkers
+    SmallVector<char, 0> buffer;
+    BitcodeWriter writer(buffer);
+    writer.writeModule(entry);
+    writer.writeStrtab();
+
+    {
+        raw_fd_ostream out(temp->FD, /*shouldClose=*/false);
+        out << StringRef(buffer.data(), buffer.size());
+    }
+
+    if (Error error = temp->keep(path)) {
+        consumeError(std::move(error));
+    }
+
+}
+
+void FunctionCache::optimize(Function& function, FunctionPassManager& FPM,
+    FunctionAnalysisManager& FAM, ModuleSlotTracker& MST) {
+
+    std::string key = getKey(function, MST);
+
+    if (key.empty()) {
+        uncacheable++;
+        FPM.run(function, FAM);
+        return;
+    }
+
+    if (load(function, key)) {
+        hits++;
+        FAM.invalidate(function, PreservedAnalyses::none());
+        return;
+    }
+
+    misses++;
+    FPM.run(function, FAM);
+    store(function, key);
+
+}
+
+void FunctionCache::printStatistics(raw_ostream& OS) const {
+
+    unsigned lookups = hits + misses;
+
+    OS << "Cache: " << hits << " hits, " << misses << " misses";
+    if (lookups) {
+        OS << format(" (%.1f%% hit rate)", 100.0 * hits / lookups);
+    }
+    OS << ", " << uncacheable << " functions not cacheable\n";
+
+}
@@ -0,0 +1,53 @@
+#ifndef CUSTOMOPT_FUNCTIONCACHE_H
+#define CUSTOMOPT_FUNCTIONCACHE_H
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <string>
+
+namespace customopt {
+
+    // On-disk cache of optimized function bodies, one file per function in a
+    // directory, which can be shared by several processes.
+    //
+    // The key of a function is a hash of its IR, of the declarations it references,
+    // of the target, and of the pipeline, version and options of the passes. The
+    // cached body is stored as bitcode, read from a memory mapped file, and spliced
+    // into the function in place of running the pipeline.
+    //
+    // Functions with metadata, personality functions or references to unnamed or
+    // indirect symbols are not cached, and are always optimized.
+    class FunctionCache {
+    public:
+        FunctionCache(llvm::StringRef directory, llvm::StringRef pipeline);
+
+        // Optimize function with FPM, or reuse the result of an earlier run. MST
+        // prints the functions of the module, and is shared by all of them.
+        void optimize(llvm::Function& function, llvm::FunctionPassManager& FPM,
+            llvm::FunctionAnalysisManager& FAM, llvm::ModuleSlotTracker& MST);
+
+        void printStatistics(llvm::raw_ostream& OS) const;
+
+    private:
+        std::string directory;
+
+        // Part of the key common to all functions
+        std::string configuration;
+
+        std::atomic<unsigned> hits;
+        std::atomic<unsigned> misses;
+        std::atomic<unsigned> uncacheable;
+
+        // Returns the hex key of function, or an empty string if it cannot be cached
+        std::string getKey(llvm::Function& function, llvm::ModuleSlotTracker& MST) const;
+
+        bool load(llvm::Function& function, llvm::StringRef key) const;
+        void store(llvm::Function& function, llvm::StringRef key) const;
+    };
+}
+
+#endif
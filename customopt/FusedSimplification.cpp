@@ -0,0 +1,350 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/TinyPtrVector.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
+#include "ValueNumbering.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "simplify"
+
+STATISTIC(NumDeadInstructions, "Number of dead instructions deleted");
+STATISTIC(NumOverwrittenLanes, "Number of insertelements bypassed because their lane is overwritten");
+STATISTIC(NumRewritten, "Number of instructions rewritten by a Strength Reduction & Constant Folding rule");
+STATISTIC(NumCommonSubexpressions, "Number of common subexpressions eliminated");
+STATISTIC(NumVisited, "Number of instructions visited, including revisits");
+
+namespace {
+
+    // Worklist of instructions to revisit. An instruction is queued at most once,
+    // and can be removed in constant time when it is deleted.
+    struct Worklist {
+        std::vector<Instruction *> queue;
+        DenseMap<Instruction *, unsigned> indices;
+
+        void push(Instruction* ins) {
+            if (indices.insert({ins, queue.size()}).second) {
+                queue.push_back(ins);
+            }
+        }
+
+        void pushOperands(Instruction* ins) {
+            for (Value* operand: ins->operands()) {
+                if (Instruction* op = dyn_cast<Instruction>(operand)) {
+                    push(op);
+                }
+            }
+        }
+
+        void pushUsers(Instruction* ins) {
+            for (User* user: ins->users()) {
+                push(cast<Instruction>(user));
+            }
+        }
+
+        void remove(Instruction* ins) {
+            auto it = indices.find(ins);
+            if (it != indices.end()) {
+                queue[it->second] = nullptr;
+                indices.erase(it);
+            }
+        }
+
+        // Removed entries leave a nullptr behind, which is skipped here
+        Instruction* pop() {
+            while (!queue.empty()) {
+                Instruction* ins = queue.back();
+                queue.pop_back();
+                if (ins) {
+                    indices.erase(ins);
+                    return ins;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    struct FusedSimplification {
+
+        DominatorTree& DT;
+        const TargetTransformInfo& TTI;
+        OptimizationRemarkEmitter& ORE;
+
+        Worklist worklist;
+
+        // Value numbering table over the whole function: for each value, the
+        // instructions computing it, none of which dominates another (those in sibling
+        // branches). A match is only used when it dominates the instruction looked up.
+        // The key of an instruction is the hash of its operands, so it is removed from
+        // the table before one of its operands changes, and numbered again when it is
+        // revisited. The key of an entry is one of its instructions.
+        DenseMap<SimpleValue, TinyPtrVector<Instruction *>> availableValues;
+
+        bool changed = false;
+
+        FusedSimplification(DominatorTree& DT, const TargetTransformInfo& TTI,
+            OptimizationRemarkEmitter& ORE) : DT(DT), TTI(TTI), ORE(ORE) {}
+
+        bool run(Function& function) {
+
+            LLVM_DEBUG(dbgs() << "Starting Fused Simplification pass "
+                "for function: '" << function.getName() << "':\n");
+
+            // Queue every reachable instruction. The worklist is processed last in,
+            // first out, so the instructions are pushed in reverse: definitions are
+            // then visited before their uses, and dominating blocks before dominated ones.
+            ReversePostOrderTraversal<Function *> RPOT(&function);
+            std::vector<Instruction *> instructions;
+            for (BasicBlock* block: RPOT) {
+                for (auto& instruction: *block) {
+                    instructions.push_back(&instruction);
+                }
+            }
+            for (auto it = instructions.rbegin(); it != instructions.rend(); ++it) {
+                worklist.push(*it);
+            }
+
+            // Every transformation requeues only the instructions it may have
+            // affected, so the loop ends when no transformation applies anywhere
+            while (Instruction* ins = worklist.pop()) {
+                visit(ins);
+            }
+
+            LLVM_DEBUG(dbgs() << "Fused Simplification pass complete!\n\n");
+
+            return changed;
+
+        }
+
+        void visit(Instruction* ins) {
+
+            NumVisited++;
+
+            // Dead Code Elimination
+            if (DCEPass::isTriviallyDead(ins)) {
+                NumDeadInstructions++;
+                LLVM_DEBUG(dbgs() << "Deleting instruction: " << *ins << "\n");
+                ORE.emit([&]() {
+                    return OptimizationRemark(DEBUG_TYPE, "DeadInstruction", ins)
+                        << "deleted dead " << ore::NV("Opcode", ins->getOpcodeName());
+                });
+                erase(ins);
+                return;
+            }
+
+            if (InsertElementInst* insert = dyn_cast<InsertElementInst>(ins)) {
+
+                Value* overwritten = insert->getOperand(0);
+
+                forget(insert);
+                if (unsigned bypassed = DCEPass::bypassOverwrittenLanes(insert)) {
+
+                    NumOverwrittenLanes += bypassed;
+                    ORE.emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, "OverwrittenLane", insert)
+                            << "bypassed " << ore::NV("Inserts", bypassed)
+                            << " insertelement(s) overwritten by this one";
+                    });
+
+                    // The bypassed inserts are now unused
+                    worklist.push(cast<Instruction>(overwritten));
+                    changed = true;
+                }
+            }
+
+            // Strength Reduction & Constant Folding: the new instructions are inserted
+            // between the previous instruction and ins, and are simplified in turn
+            Instruction* previous = ins->getPrevNode();
+
+            SRCFPass::Rewrite rewrite = SRCFPass::simplifyInstruction(ins, TTI);
+            if (rewrite.result) {
+
+                NumRewritten++;
+                ORE.emit([&]() {
+                    return OptimizationRemark(DEBUG_TYPE, "Rewrite", ins)
+                        << ore::NV("Kind", rewrite.kind) << ": " << ore::NV("Pattern", rewrite.pattern);
+                });
+
+                Instruction* inserted = previous ? previous->getNextNode() : &ins->getParent()->front();
+                for (; inserted != ins; inserted = inserted->getNextNode()) {
+                    worklist.push(inserted);
+                }
+
+                replace(ins, rewrite.result);
+                return;
+            }
+
+            // Common Subexpression Elimination
+            if (!SimpleValue::canHandle(ins)) {
+                return;
+            }
+
+            auto it = availableValues.find(ins);
+            if (it == availableValues.end()) {
+                availableValues[ins].push_back(ins);
+                return;
+            }
+
+            // An identical instruction which dominates ins replaces it
+            SmallVector<Instruction *, 4> dominated;
+            for (Instruction* identical: it->second) {
+
+                if (identical == ins) {
+                    continue;
+                }
+
+                if (DT.dominates(identical, ins)) {
+
+                    remarkCommonSubexpression(ins);
+                    replace(ins, identical);
+                    return;
+                }
+
+                if (DT.dominates(ins, identical)) {
+                    dominated.push_back(identical);
+                }
+            }
+
+            // ins replaces those it dominates, e.g. when it is visited again after its
+            // operands were simplified, and is available along with the others
+            for (Instruction* identical: dominated) {
+                remarkCommonSubexpression(identical);
+                replace(identical, ins);
+            }
+
+            TinyPtrVector<Instruction *>& candidates = availableValues[ins];
+            if (!is_contained(candidates, ins)) {
+                candidates.push_back(ins);
+            }
+
+        }
+
+        // Count and report a common subexpression about to be replaced
+        void remarkCommonSubexpression(Instruction* ins) {
+
+            NumCommonSubexpressions++;
+            LLVM_DEBUG(dbgs() << "Found Common Subexpression: " << *ins << ", Deleting\n");
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "CommonSubexpression", ins)
+                    << "replaced " << ore::NV("Opcode", ins->getOpcodeName())
+                    << " with an identical dominating one";
+            });
+
+        }
+
+        // Remove ins from the table if it is one of the instructions numbered there
+        void forget(Instruction* ins) {
+
+            if (!SimpleValue::canHandle(ins)) {
+                return;
+            }
+
+            auto it = availableValues.find(ins);
+            if (it == availableValues.end() || !is_contained(it->second, ins)) {
+                return;
+            }
+
+            // The entry may be keyed by ins, so it is keyed again by one of the others
+            TinyPtrVector<Instruction *> others = std::move(it->second);
+            availableValues.erase(it);
+
+            others.erase(find(others, ins));
+            if (!others.empty()) {
+                Instruction* key = others.front();
+                availableValues[key] = std::move(others);
+            }
+
+        }
+
+        // Replace all uses of ins with value, revisit the users, and delete ins
+        void replace(Instruction* ins, Value* value) {
+
+            // The operands of the users change, so their keys become stale
+            for (User* user: ins->users()) {
+                forget(cast<Instruction>(user));
+            }
+            worklist.pushUsers(ins);
+
+            ins->replaceAllUsesWith(value);
+
+            erase(ins);
+
+        }
+
+        // Delete an unused instruction, and revisit its operands, which may now be dead
+        void erase(Instruction* ins) {
+
+            forget(ins);
+            worklist.remove(ins);
+            worklist.pushOperands(ins);
+
+            ins->eraseFromParent();
+            changed = true;
+
+        }
+    };
+}
+
+bool customopt::SimplifyPass::runImpl(Function& function, DominatorTree& DT,
+    const TargetTransformInfo& TTI, OptimizationRemarkEmitter& ORE) {
+
+    FusedSimplification simplify(DT, TTI, ORE);
+    return simplify.run(function);
+
+}
+
+PreservedAnalyses customopt::SimplifyPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    if (!runImpl(function, FAM.getResult<DominatorTreeAnalysis>(function),
+        FAM.getResult<TargetIRAnalysis>(function),
+        FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+
+}
+
+namespace {
+    struct SimplifyLegacyPass : public FunctionPass {
+        static char ID;
+        SimplifyLegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.setPreservesCFG();
+            AU.addRequired<DominatorTreeWrapperPass>();
+            AU.addRequired<TargetTransformInfoWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            AU.addPreserved<DominatorTreeWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+            const TargetTransformInfo& TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(function);
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::SimplifyPass::runImpl(function, DT, TTI, ORE);
+        }
+    };
+}
+
+char SimplifyLegacyPass::ID = 0;
+
+static RegisterPass<SimplifyLegacyPass> X("simplify",
+    "Fused DCE, Strength Reduction & Constant Folding and CSE", false, true);
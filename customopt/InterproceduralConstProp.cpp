@@ -0,0 +1,545 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include <map>
+
+#include "CustomOpt.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "ipcp"
+
+STATISTIC(NumArgumentsPropagated, "Number of arguments replaced with the constant passed by every call site");
+STATISTIC(NumSpecializations, "Number of specialized clones created");
+STATISTIC(NumCallSitesSpecialized, "Number of call sites redirected to a specialized clone");
+STATISTIC(NumConstantReturns, "Number of call results replaced with the constant the callee returns");
+STATISTIC(NumFunctionsDeleted, "Number of local functions deleted once they had no caller left");
+
+static cl::opt<unsigned> Budget("ipcp-budget", cl::init(20),
+    cl::desc("Maximum growth of the module by -ipcp specializations, in percent of its instructions"));
+
+static cl::opt<unsigned> MaxFunctionSize("ipcp-max-function-size", cl::init(1000),
+    cl::desc("Functions with more instructions are not specialized by -ipcp"));
+
+static cl::opt<unsigned> MaxClones("ipcp-max-clones", cl::init(4),
+    cl::desc("Maximum number of specializations of one function"));
+
+namespace {
+
+    // The arguments of a call site which are constants, by index
+    typedef std::vector<std::pair<unsigned, Constant *>> ConstantArguments;
+
+    // Call sites of one function passing the same constants
+    struct Candidate {
+        Function* function;
+        ConstantArguments arguments;
+        std::vector<CallBase *> calls;
+
+        // Uses of the constant arguments in the function, times the number of calls
+        unsigned benefit = 0;
+        unsigned cost = 0;
+    };
+
+    unsigned countInstructions(const Function& function) {
+
+        unsigned count = 0;
+        for (const BasicBlock& block: function) {
+            count += block.size();
+        }
+        return count;
+
+    }
+
+    struct InterproceduralConstantPropagation {
+
+        function_ref<const TargetTransformInfo&(Function&)> getTTI;
+
+        InterproceduralConstantPropagation(function_ref<const TargetTransformInfo&(Function&)> getTTI)
+            : getTTI(getTTI) {}
+
+        bool run(Module& module) {
+
+            LLVM_DEBUG(dbgs() << "Starting Interprocedural Constant Propagation pass "
+                "for module: '" << module.getModuleIdentifier() << "':\n");
+
+            unsigned moduleSize = 0;
+            for (Function& function: module) {
+                moduleSize += countInstructions(function);
+            }
+
+            bool changed = false;
+
+            // The functions are collected first, as clones are added to the module
+            std::vector<Function *> functions;
+            for (Function& function: module) {
+                if (canSpecialize(function)) {
+                    functions.push_back(&function);
+                }
+            }
+
+            // Functions without callers before the pass are left alone: only those whose
+            // last calls it redirects to a clone or folds away are deleted
+            SmallPtrSet<Function *, 16> uncalledBefore;
+            for (Function* function: functions) {
+                if (function->use_empty()) {
+                    uncalledBefore.insert(function);
+                }
+            }
+
+            // When all the callers are known, the constants they all agree on are
+            // propagated into the function itself. Simplifying a function can delete
+            // calls, so the calls of each function are collected when it is its turn.
+            SmallPtrSet<Function *, 16> propagated;
+
+            for (Function* function: functions) {
+
+                std::vector<CallBase *> calls;
+                bool onlyCalled = getCallSites(*function, calls);
+
+                if (!calls.empty() && onlyCalled && function->hasLocalLinkage() &&
+                    propagateIntoFunction(*function, calls)) {
+                    propagated.insert(function);
+                    changed = true;
+                }
+            }
+
+            // The call sites of the other functions, grouped by the constants they pass.
+            // Only clones are simplified from here on, which contain none of these calls.
+            std::vector<Candidate> candidates;
+
+            for (Function* function: functions) {
+
+                std::vector<CallBase *> calls;
+                getCallSites(*function, calls);
+
+                if (!calls.empty() && !propagated.count(function)) {
+                    collectCandidates(*function, calls, candidates);
+                }
+            }
+
+            changed |= specialize(candidates, moduleSize * uint64_t(Budget) / 100, functions);
+
+            changed |= deleteUncalledFunctions(functions, uncalledBefore);
+
+            LLVM_DEBUG(dbgs() << "Interprocedural Constant Propagation pass complete!\n\n");
+
+            return changed;
+
+        }
+
+        // Functions whose body is the one which runs, and which can be cloned
+        bool canSpecialize(const Function& function) {
+
+            return !function.isDeclaration() && function.hasExactDefinition() &&
+                !function.isVarArg() && !function.hasOptNone() &&
+                !function.hasFnAttribute(Attribute::Naked) && !function.arg_empty();
+
+        }
+
+        // Arguments which can be replaced with a constant in the body: not copies
+        // made by the call, nor tied to the calling convention
+        bool canPropagate(const Argument& argument) {
+
+            return !argument.hasPassPointeeByValueCopyAttr() && !argument.hasByRefAttr() &&
+                !argument.hasInAllocaAttr() && !argument.hasPreallocatedAttr() &&
+                !argument.hasSwiftErrorAttr() && !argument.hasSwiftSelfAttr() &&
+                !argument.use_empty();
+
+        }
+
+        // The constant passed to an argument, or nullptr
+        Constant* getConstantArgument(CallBase* call, unsigned index) {
+
+            Constant* constant = dyn_cast<Constant>(call->getArgOperand(index));
+            if (!constant || isa<UndefValue>(constant) || constant->containsUndefOrPoisonElement()) {
+                return nullptr;
+            }
+            return constant;
+
+        }
+
+        // Direct calls to function. Returns false if function is also used
+        // otherwise (its address is taken), so that not every caller is known.
+        bool getCallSites(Function& function, std::vector<CallBase *>& calls) {
+
+            bool onlyCalled = true;
+
+            for (Use& use: function.uses()) {
+
+                CallBase* call = dyn_cast<CallBase>(use.getUser());
+
+                if (!call || !call->isCallee(&use) || isa<CallBrInst>(call) ||
+                    call->getFunctionType() != function.getFunctionType()) {
+                    onlyCalled = false;
+                    continue;
+                }
+
+                calls.push_back(call);
+            }
+
+            return onlyCalled;
+
+        }
+
+        bool propagateIntoFunction(Function& function, const std::vector<CallBase *>& calls) {
+
+            bool changed = false;
+
+            for (Argument& argument: function.args()) {
+
+                if (!canPropagate(argument)) {
+                    continue;
+                }
+
+                // A recursive call passing the argument on agrees with any constant
+                Constant* constant = nullptr;
+                bool agree = true;
+
+                for (CallBase* call: calls) {
+
+                    if (call->getArgOperand(argument.getArgNo()) == &argument) {
+                        continue;
+                    }
+
+                    Constant* passed = getConstantArgument(call, argument.getArgNo());
+                    if (!passed || (constant && passed != constant)) {
+                        agree = false;
+                        break;
+                    }
+                    constant = passed;
+                }
+
+                if (!agree || !constant) {
+                    continue;
+                }
+
+                NumArgumentsPropagated++;
+                LLVM_DEBUG(dbgs() << "Propagating " << *constant << " into argument "
+                    << argument.getArgNo() << " of " << function.getName() << "\n");
+
+                OptimizationRemarkEmitter ORE(&function);
+                ORE.emit([&]() {
+                    return OptimizationRemark(DEBUG_TYPE, "ConstantArgument", &function)
+                        << "argument " << ore::NV("Argument", argument.getArgNo())
+                        << " is the same constant at every call site";
+                });
+
+                argument.replaceAllUsesWith(constant);
+                changed = true;
+            }
+
+            if (changed) {
+                simplifyFunction(function);
+
+                // Recursive calls may have been deleted
+                std::vector<CallBase *> remaining;
+                getCallSites(function, remaining);
+                propagateReturnedConstant(function, remaining);
+            }
+
+            return changed;
+
+        }
+
+        // Group the call sites of function by the constants they pass
+        void collectCandidates(Function& function, const std::vector<CallBase *>& calls,
+            std::vector<Candidate>& candidates) {
+
+            unsigned size = countInstructions(function);
+            if (size > MaxFunctionSize) {
+                return;
+            }
+
+            // The groups in the order of their first call, for a deterministic output
+            std::map<ConstantArguments, unsigned> groupIndex;
+            std::vector<Candidate> sorted;
+
+            for (CallBase* call: calls) {
+
+                // The caller must not be a clone of the same function, or the
+                // clones would be cloned in turn
+                if (call->getFunction() == &function) {
+                    continue;
+                }
+
+                ConstantArguments arguments;
+                unsigned benefit = 0;
+
+                for (Argument& argument: function.args()) {
+                    if (!canPropagate(argument)) {
+                        continue;
+                    }
+                    if (Constant* constant = getConstantArgument(call, argument.getArgNo())) {
+                        arguments.push_back({argument.getArgNo(), constant});
+                        benefit += argument.getNumUses();
+                    }
+                }
+
+                if (arguments.empty()) {
+                    continue;
+                }
+
+                auto inserted = groupIndex.insert({arguments, sorted.size()});
+                if (inserted.second) {
+                    sorted.emplace_back();
+                }
+
+                Candidate& candidate = sorted[inserted.first->second];
+                candidate.function = &function;
+                candidate.arguments = arguments;
+                candidate.calls.push_back(call);
+                candidate.benefit += benefit;
+                candidate.cost = size;
+            }
+
+            // The most used constants of each function, up to the maximum number of clones
+            std::stable_sort(sorted.begin(), sorted.end(), [](const Candidate& a, const Candidate& b) {
+                return a.benefit > b.benefit;
+            });
+            if (sorted.size() > MaxClones) {
+                sorted.resize(MaxClones);
+            }
+
+            for (Candidate& candidate: sorted) {
+                candidates.push_back(std::move(candidate));
+            }
+
+        }
+
+        // Clone the functions for the candidates with the most benefit per
+        // instruction, while the budget lasts. The size of a clone is counted
+        // after it is simplified, so clones which collapse cost little; a clone
+        // over budget is deleted before any call is redirected to it.
+        // The clones are added to functions, as their calls can all fold away.
+        bool specialize(std::vector<Candidate>& candidates, uint64_t budget, std::vector<Function *>& functions) {
+
+            std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+                return uint64_t(a.benefit) * b.cost > uint64_t(b.benefit) * a.cost;
+            });
+
+            bool changed = false;
+            uint64_t spent = 0;
+
+            for (Candidate& candidate: candidates) {
+
+                Function* clone = createSpecialization(candidate);
+                unsigned size = countInstructions(*clone);
+
+                if (spent + size > budget) {
+                    LLVM_DEBUG(dbgs() << "Over budget, not specializing " << candidate.function->getName()
+                        << " (" << size << " instructions)\n");
+                    clone->eraseFromParent();
+                    continue;
+                }
+
+                redirectCalls(candidate, *clone);
+                functions.push_back(clone);
+                spent += size;
+                changed = true;
+            }
+
+            LLVM_DEBUG(dbgs() << "Specializations: " << spent << " of " << budget << " instructions\n");
+
+            return changed;
+
+        }
+
+        // A simplified clone of the function of candidate, for its constants
+        Function* createSpecialization(Candidate& candidate) {
+
+            Function& function = *candidate.function;
+
+            ValueToValueMapTy VMap;
+            Function* clone = CloneFunction(&function, VMap);
+
+            clone->setName(function.getName() + ".spec");
+            clone->setLinkage(GlobalValue::InternalLinkage);
+            clone->setVisibility(GlobalValue::DefaultVisibility);
+            clone->setComdat(nullptr);
+            clone->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+            // The arguments stay in the signature, unused
+            for (auto& argument: candidate.arguments) {
+                clone->getArg(argument.first)->replaceAllUsesWith(argument.second);
+            }
+
+            simplifyFunction(*clone);
+
+            return clone;
+
+        }
+
+        void redirectCalls(Candidate& candidate, Function& clone) {
+
+            Function& function = *candidate.function;
+
+            for (CallBase* call: candidate.calls) {
+                call->setCalledFunction(&clone);
+            }
+
+            NumSpecializations++;
+            NumCallSitesSpecialized += candidate.calls.size();
+            LLVM_DEBUG(dbgs() << "Specializing " << function.getName() << " for "
+                << candidate.arguments.size() << " constant argument(s), "
+                << candidate.calls.size() << " call site(s)\n");
+
+            OptimizationRemarkEmitter ORE(&function);
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "Specialization", &function)
+                    << "specialized for " << ore::NV("Arguments", unsigned(candidate.arguments.size()))
+                    << " constant argument(s) at " << ore::NV("CallSites", unsigned(candidate.calls.size()))
+                    << " call site(s)";
+            });
+
+            propagateReturnedConstant(clone, candidate.calls);
+
+        }
+
+        // The intraprocedural passes, on a function with constant arguments
+        void simplifyFunction(Function& function) {
+
+            OptimizationRemarkEmitter ORE(&function);
+
+            bool cfgChanged;
+            SCCPropPass::runImpl(function, ORE, cfgChanged);
+
+            DominatorTree DT(function);
+            SimplifyPass::runImpl(function, DT, getTTI(function), ORE);
+
+        }
+
+        // When every return of function returns the same constant, the calls
+        // produce it. A call to a function which only returns is deleted.
+        void propagateReturnedConstant(Function& function, const std::vector<CallBase *>& calls) {
+
+            Constant* returned = nullptr;
+
+            for (BasicBlock& block: function) {
+
+                ReturnInst* ret = dyn_cast<ReturnInst>(block.getTerminator());
+                if (!ret) {
+                    continue;
+                }
+
+                Constant* constant = dyn_cast_or_null<Constant>(ret->getReturnValue());
+                if (!constant || isa<UndefValue>(constant) || (returned && returned != constant)) {
+                    return;
+                }
+                returned = constant;
+            }
+
+            if (!returned) {
+                return;
+            }
+
+            bool onlyReturns = function.size() == 1 && function.front().size() == 1;
+
+            for (CallBase* call: calls) {
+
+                if (call->use_empty() && !onlyReturns) {
+                    continue;
+                }
+
+                NumConstantReturns++;
+                call->replaceAllUsesWith(returned);
+
+                if (onlyReturns && isa<CallInst>(call) && !cast<CallInst>(call)->isMustTailCall()) {
+                    call->eraseFromParent();
+                }
+            }
+
+        }
+
+        // Local functions whose calls were all redirected to clones or folded, and
+        // clones whose calls were all folded
+        bool deleteUncalledFunctions(const std::vector<Function *>& functions,
+            const SmallPtrSetImpl<Function *>& uncalledBefore) {
+
+            bool changed = false;
+
+            for (Function* function: functions) {
+
+                if (!function->hasLocalLinkage() || !function->use_empty() || uncalledBefore.count(function)) {
+                    continue;
+                }
+
+                NumFunctionsDeleted++;
+                LLVM_DEBUG(dbgs() << "Deleting uncalled function: " << function->getName() << "\n");
+
+                function->eraseFromParent();
+                changed = true;
+            }
+
+            return changed;
+
+        }
+    };
+}
+
+bool customopt::IPCPPass::runImpl(Module& module,
+    function_ref<const TargetTransformInfo&(Function&)> getTTI) {
+
+    InterproceduralConstantPropagation ipcp(getTTI);
+    return ipcp.run(module);
+
+}
+
+PreservedAnalyses customopt::IPCPPass::run(Module& module, ModuleAnalysisManager& MAM) {
+
+    FunctionAnalysisManager& FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(module).getManager();
+
+    auto getTTI = [&](Function& function) -> const TargetTransformInfo& {
+        return FAM.getResult<TargetIRAnalysis>(function);
+    };
+
+    if (!runImpl(module, getTTI)) {
+        return PreservedAnalyses::all();
+    }
+
+    return PreservedAnalyses::none();
+
+}
+
+namespace {
+    struct IPCPLegacyPass : public ModulePass {
+        static char ID;
+        IPCPLegacyPass() : ModulePass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.addRequired<TargetTransformInfoWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnModule(Module& module) override {
+
+            auto getTTI = [this](Function& function) -> const TargetTransformInfo& {
+                return getAnalysis<TargetTransformInfoWrapperPass>().getTTI(function);
+            };
+            return customopt::IPCPPass::runImpl(module, getTTI);
+
+        }
+    };
+}
+
+char IPCPLegacyPass::ID = 0;
+
+static RegisterPass<IPCPLegacyPass> X("ipcp",
+    "Interprocedural Constant Propagation & Function Specialization", false, false);
@@ -0,0 +1,199 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/MemorySSAUpdater.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
+#include "ValueNumbering.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "loadelim"
+
+STATISTIC(NumLoadsForwarded, "Number of loads replaced with the value of an earlier store");
+STATISTIC(NumLoadsReused, "Number of loads replaced with an earlier load of the same memory");
+
+namespace {
+
+    // Loads by pointer and type, scoped along the dominator tree: the load found for a
+    // key is the nearest one dominating the current block
+    typedef ScopedHashTable<std::pair<Value *, Type *>, LoadInst *> LoadTableTy;
+
+    struct LoadElimination {
+
+        MemorySSA& MSSA;
+        AAResults& AA;
+        OptimizationRemarkEmitter& ORE;
+
+        LoadElimination(MemorySSA& MSSA, AAResults& AA, OptimizationRemarkEmitter& ORE)
+            : MSSA(MSSA), AA(AA), ORE(ORE) {}
+
+        bool run(Function& function, DominatorTree& DT) {
+
+            // Vector of instructions to delete at the end of the pass (the loads replaced)
+            std::vector<Instruction *> instsToDelete;
+
+            LoadTableTy availableLoads;
+
+            LLVM_DEBUG(dbgs() << "Starting Redundant Load Elimination pass "
+                "for function: '" << function.getName() << "':\n");
+
+            // Dominators first, so that the loads a load may reuse were seen before it
+            walkDominatorTree(DT, availableLoads, [&](BasicBlock& block) {
+                processBlock(block, availableLoads, instsToDelete);
+            });
+
+            LLVM_DEBUG(dbgs() << "Redundant Load Elimination pass complete!\n\n");
+
+            // Delete all the unnecessary instructions, with their memory accesses
+            MemorySSAUpdater MSSAU(&MSSA);
+            for (auto i: instsToDelete) {
+                MSSAU.removeMemoryAccess(i);
+                i->eraseFromParent();
+            }
+
+            return !instsToDelete.empty();
+
+        }
+
+        void processBlock(BasicBlock& block, LoadTableTy& availableLoads,
+                std::vector<Instruction *>& instsToDelete) {
+
+            for (auto& instruction: block) {
+
+                // Volatile and atomic loads must stay
+                LoadInst* load = dyn_cast<LoadInst>(&instruction);
+                if (!load || !load->isSimple()) {
+                    continue;
+                }
+
+                // The nearest write which may change the memory read, skipping over those
+                // which alias analysis proves do not
+                MemoryAccess* clobber = MSSA.getWalker()->getClobberingMemoryAccess(load);
+
+                if (Value* stored = getForwardedValue(load, clobber)) {
+
+                    NumLoadsForwarded++;
+                    replaceLoad(load, stored, "StoreForwarded", "the value of an earlier store", instsToDelete);
+                    continue;
+                }
+
+                // An earlier load of the same pointer read the same memory if the write
+                // which clobbers this load happened before it
+                std::pair<Value *, Type *> key(load->getPointerOperand(), load->getType());
+
+                LoadInst* earlier = availableLoads.lookup(key);
+                if (earlier && MSSA.dominates(clobber, MSSA.getMemoryAccess(earlier))) {
+
+                    NumLoadsReused++;
+                    replaceLoad(load, earlier, "LoadReused", "an earlier load of the same memory", instsToDelete);
+                    continue;
+                }
+
+                availableLoads.insert(key, load);
+            }
+        }
+
+        // The value a load reads when the write which clobbers it is a store of the
+        // same type to the same memory; nullptr otherwise
+        Value* getForwardedValue(LoadInst* load, MemoryAccess* clobber) {
+
+            MemoryDef* def = dyn_cast<MemoryDef>(clobber);
+            if (!def || MSSA.isLiveOnEntryDef(def)) {
+                return nullptr;
+            }
+
+            StoreInst* store = dyn_cast_or_null<StoreInst>(def->getMemoryInst());
+            if (!store || !store->isSimple() || store->getValueOperand()->getType() != load->getType()) {
+                return nullptr;
+            }
+
+            if (AA.alias(MemoryLocation::get(store), MemoryLocation::get(load)) != AliasResult::MustAlias) {
+                return nullptr;
+            }
+
+            return store->getValueOperand();
+
+        }
+
+        void replaceLoad(LoadInst* load, Value* value, const char* remark, const char* description,
+            std::vector<Instruction *>& instsToDelete) {
+
+            LLVM_DEBUG(dbgs() << "Replacing " << *load << " with " << *value << "\n");
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, remark, load)
+                    << "replaced load with " << description;
+            });
+
+            load->replaceAllUsesWith(value);
+            instsToDelete.push_back(load);
+
+        }
+    };
+}
+
+bool customopt::LoadElimPass::runImpl(Function& function, DominatorTree& DT, MemorySSA& MSSA,
+    AAResults& AA, OptimizationRemarkEmitter& ORE) {
+
+    LoadElimination loadElim(MSSA, AA, ORE);
+    return loadElim.run(function, DT);
+
+}
+
+PreservedAnalyses customopt::LoadElimPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    if (!runImpl(function, FAM.getResult<DominatorTreeAnalysis>(function),
+        FAM.getResult<MemorySSAAnalysis>(function).getMSSA(), FAM.getResult<AAManager>(function),
+        FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    PA.preserve<MemorySSAAnalysis>();
+    return PA;
+
+}
+
+namespace {
+    struct LoadElimLegacyPass : public FunctionPass {
+        static char ID;
+        LoadElimLegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.setPreservesCFG();
+            AU.addRequired<DominatorTreeWrapperPass>();
+            AU.addRequired<MemorySSAWrapperPass>();
+            AU.addRequired<AAResultsWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            AU.addPreserved<DominatorTreeWrapperPass>();
+            AU.addPreserved<MemorySSAWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+            MemorySSA& MSSA = getAnalysis<MemorySSAWrapperPass>().getMSSA();
+            AAResults& AA = getAnalysis<AAResultsWrapperPass>().getAAResults();
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::LoadElimPass::runImpl(function, DT, MSSA, AA, ORE);
+        }
+    };
+}
+
+char LoadElimLegacyPass::ID = 0;
+
+static RegisterPass<LoadElimLegacyPass> X("loadelim", "Redundant Load Elimination", false, false);
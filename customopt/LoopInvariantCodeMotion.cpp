@@ -0,0 +1,241 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/MustExecute.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "hoist"
+
+STATISTIC(NumHoisted, "Number of loop-invariant instructions hoisted into a preheader");
+STATISTIC(NumLoadsHoisted, "Number of loop-invariant loads hoisted into a preheader");
+
+static cl::opt<unsigned> MaxAliasQueries("hoist-max-alias-queries", cl::init(1000),
+    cl::desc("Maximum number of stores and calls of a loop a load is checked against by -hoist"));
+
+namespace {
+    struct LoopInvariantCodeMotion {
+
+        DominatorTree& DT;
+        AAResults& AA;
+        OptimizationRemarkEmitter& ORE;
+
+        LoopInvariantCodeMotion(DominatorTree& DT, AAResults& AA, OptimizationRemarkEmitter& ORE)
+            : DT(DT), AA(AA), ORE(ORE) {}
+
+        bool run(Function& function, LoopInfo& LI) {
+
+            bool changed = false;
+
+            LLVM_DEBUG(dbgs() << "Starting Loop-Invariant Code Motion pass "
+                "for function: '" << function.getName() << "':\n");
+
+            // Inner loops first: an instruction hoisted into the preheader of an inner
+            // loop is in the body of the outer one, which may hoist it further
+            SmallVector<Loop *, 8> loops = LI.getLoopsInPreorder();
+            for (auto it = loops.rbegin(); it != loops.rend(); ++it) {
+                changed |= processLoop(**it, LI);
+            }
+
+            LLVM_DEBUG(dbgs() << "Loop-Invariant Code Motion pass complete!\n\n");
+
+            return changed;
+
+        }
+
+        bool processLoop(Loop& loop, LoopInfo& LI) {
+
+            BasicBlock* preheader = loop.getLoopPreheader();
+            if (!preheader) {
+                LLVM_DEBUG(dbgs() << "Skipping loop without a preheader: " << loop.getHeader()->getName() << "\n");
+                return false;
+            }
+
+            // Whether an instruction runs in every iteration which reaches the exits
+            SimpleLoopSafetyInfo safety;
+            safety.computeLoopSafetyInfo(&loop);
+
+            // The instructions of the loop which may write memory, for the loads; past
+            // the limit every load is assumed to be clobbered
+            std::vector<Instruction *> writes;
+
+            for (BasicBlock* block: loop.blocks()) {
+                for (Instruction& instruction: *block) {
+                    if (instruction.mayWriteToMemory()) {
+                        writes.push_back(&instruction);
+                    }
+                }
+            }
+
+            bool unknownWrites = writes.size() > MaxAliasQueries;
+
+            bool changed = false;
+
+            // Dominators first, so that the operands of an instruction are hoisted before it
+            LoopBlocksRPO order(&loop);
+            order.perform(&LI);
+
+            for (BasicBlock* block: order) {
+                for (Instruction& instruction: make_early_inc_range(*block)) {
+
+                    Instruction* ins = &instruction;
+
+                    if (!loop.hasLoopInvariantOperands(ins) || !canHoist(ins)) {
+                        continue;
+                    }
+
+                    bool guaranteed = safety.isGuaranteedToExecute(*ins, &DT, &loop);
+
+                    // An instruction which may trap only moves if it ran anyway
+                    if (!guaranteed && !isSafeToSpeculativelyExecute(ins)) {
+                        continue;
+                    }
+
+                    LoadInst* load = dyn_cast<LoadInst>(ins);
+                    if (load && (unknownWrites || isWrittenInLoop(load, writes))) {
+                        continue;
+                    }
+
+                    hoist(ins, preheader, guaranteed);
+                    if (load) {
+                        NumLoadsHoisted++;
+                    }
+                    changed = true;
+                }
+            }
+
+            return changed;
+
+        }
+
+        // Pure instructions, and simple loads; their value only depends on their operands
+        // (and for a load, on memory the loop does not write)
+        bool canHoist(Instruction* ins) {
+
+            if (isa<PHINode>(ins) || ins->isTerminator() || ins->isEHPad() || isa<AllocaInst>(ins) ||
+                ins->getType()->isTokenTy()) {
+                return false;
+            }
+
+            if (LoadInst* load = dyn_cast<LoadInst>(ins)) {
+                return load->isUnordered() && !load->isVolatile();
+            }
+
+            return !ins->mayHaveSideEffects() && !ins->mayReadFromMemory();
+
+        }
+
+        bool isWrittenInLoop(LoadInst* load, const std::vector<Instruction *>& writes) {
+
+            MemoryLocation location = MemoryLocation::get(load);
+
+            for (Instruction* write: writes) {
+                if (isModSet(AA.getModRefInfo(write, location))) {
+                    LLVM_DEBUG(dbgs() << "Not hoisting " << *load << ", clobbered by " << *write << "\n");
+                    return true;
+                }
+            }
+
+            return false;
+
+        }
+
+        void hoist(Instruction* ins, BasicBlock* preheader, bool guaranteed) {
+
+            NumHoisted++;
+            LLVM_DEBUG(dbgs() << "Hoisting " << *ins << " to " << preheader->getName() << "\n");
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "Hoisted", ins)
+                    << "hoisted loop-invariant " << ore::NV("Opcode", ins->getOpcodeName())
+                    << " into the preheader";
+            });
+
+            ins->moveBefore(preheader->getTerminator());
+
+            // Facts about the value (!range, !nonnull...) only held where it was used,
+            // which the preheader need not lead to
+            if (!guaranteed) {
+                ins->dropUnknownNonDebugMetadata();
+            }
+
+            // It no longer runs at its line in the loop
+            ins->updateLocationAfterHoist();
+
+        }
+    };
+}
+
+void customopt::HoistPass::printOptions(raw_ostream& OS) {
+
+    OS << "hoist-max-alias-queries=" << MaxAliasQueries << "\n";
+
+}
+
+bool customopt::HoistPass::runImpl(Function& function, LoopInfo& LI, DominatorTree& DT,
+    AAResults& AA, OptimizationRemarkEmitter& ORE) {
+
+    LoopInvariantCodeMotion licm(DT, AA, ORE);
+    return licm.run(function, LI);
+
+}
+
+PreservedAnalyses customopt::HoistPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    if (!runImpl(function, FAM.getResult<LoopAnalysis>(function),
+        FAM.getResult<DominatorTreeAnalysis>(function), FAM.getResult<AAManager>(function),
+        FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+
+}
+
+namespace {
+    struct HoistLegacyPass : public FunctionPass {
+        static char ID;
+        HoistLegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.setPreservesCFG();
+            AU.addRequired<LoopInfoWrapperPass>();
+            AU.addRequired<DominatorTreeWrapperPass>();
+            AU.addRequired<AAResultsWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            AU.addPreserved<LoopInfoWrapperPass>();
+            AU.addPreserved<DominatorTreeWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            LoopInfo& LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+            DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+            AAResults& AA = getAnalysis<AAResultsWrapperPass>().getAAResults();
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::HoistPass::runImpl(function, LI, DT, AA, ORE);
+        }
+    };
+}
+
+char HoistLegacyPass::ID = 0;
+
+static RegisterPass<HoistLegacyPass> X("hoist", "Loop-Invariant Code Motion", false, false);
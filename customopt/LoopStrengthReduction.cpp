@@ -0,0 +1,239 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "loopsr"
+
+STATISTIC(NumMultipliesReduced, "Number of loop multiplies replaced with an incremented phi");
+STATISTIC(NumInductionPhis, "Number of induction phis inserted");
+STATISTIC(NumDeadPhisDeleted, "Number of inserted induction phis left unused and deleted");
+
+namespace {
+    struct LoopStrengthReduction {
+
+        ScalarEvolution& SE;
+        OptimizationRemarkEmitter& ORE;
+
+        // Inserts the start and step of the new phis in the preheaders
+        SCEVExpander expander;
+
+        // The phis inserted, which may be left unused when the multiply they replaced
+        // only fed another multiply reduced in turn
+        SmallVector<WeakTrackingVH, 8> insertedPhis;
+
+        LoopStrengthReduction(ScalarEvolution& SE, OptimizationRemarkEmitter& ORE, const DataLayout& DL)
+            : SE(SE), ORE(ORE), expander(SE, DL, "loopsr") {}
+
+        bool run(Function& function, LoopInfo& LI) {
+
+            // Vector of instructions to delete at the end of the pass (the multiplies replaced)
+            std::vector<Instruction *> instsToDelete;
+
+            LLVM_DEBUG(dbgs() << "Starting Loop Strength Reduction pass "
+                "for function: '" << function.getName() << "':\n");
+
+            // Inner loops first: the start of an inner recurrence may be expanded into a
+            // multiply in the outer loop, which the outer loop then reduces in turn
+            SmallVector<Loop *, 8> loops = LI.getLoopsInPreorder();
+            for (auto it = loops.rbegin(); it != loops.rend(); ++it) {
+                processLoop(**it, instsToDelete);
+            }
+
+            LLVM_DEBUG(dbgs() << "Loop Strength Reduction pass complete!\n\n");
+
+            // Delete all the unnecessary instructions
+            for (auto i: instsToDelete) {
+                SE.forgetValue(i);
+                i->eraseFromParent();
+            }
+
+            // A phi only used by its own increment would add every iteration for nothing
+            for (WeakTrackingVH& handle: insertedPhis) {
+                PHINode* phi = cast_or_null<PHINode>(handle);
+                if (!phi || !phi->hasOneUse()) {
+                    continue;
+                }
+
+                SE.forgetValue(phi);
+                if (RecursivelyDeleteDeadPHINode(phi)) {
+                    NumDeadPhisDeleted++;
+                    LLVM_DEBUG(dbgs() << "Deleted unused induction phi\n");
+                }
+            }
+
+            return !instsToDelete.empty();
+
+        }
+
+        // Multiplies are the instructions worth replacing with an addition. A shift by
+        // a constant costs the same as the addition, which would only add a phi.
+        bool isMultiply(Instruction* ins) {
+
+            return ins->getType()->isIntegerTy() && ins->getOpcode() == Instruction::Mul;
+
+        }
+
+        void processLoop(Loop& loop, std::vector<Instruction *>& instsToDelete) {
+
+            // The new phi starts in the preheader and is incremented in the latch
+            BasicBlock* preheader = loop.getLoopPreheader();
+            BasicBlock* latch = loop.getLoopLatch();
+            if (!preheader || !latch) {
+                LLVM_DEBUG(dbgs() << "Skipping loop without a preheader or single latch: "
+                    << loop.getHeader()->getName() << "\n");
+                return;
+            }
+
+            // One phi for each recurrence, shared by the multiplies computing it
+            DenseMap<const SCEV *, PHINode *> phis;
+
+            // The recurrences the loop already has
+            for (PHINode& phi: loop.getHeader()->phis()) {
+                if (SE.isSCEVable(phi.getType())) {
+                    phis.insert({SE.getSCEV(&phi), &phi});
+                }
+            }
+
+            for (BasicBlock* block: loop.blocks()) {
+                for (Instruction& instruction: *block) {
+
+                    Instruction* ins = &instruction;
+
+                    if (!isMultiply(ins)) {
+                        continue;
+                    }
+
+                    // The value in iteration k must be start + k * step, for this loop
+                    const SCEVAddRecExpr* recurrence = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(ins));
+                    if (!recurrence || recurrence->getLoop() != &loop || !recurrence->isAffine()) {
+                        continue;
+                    }
+
+                    PHINode* phi = phis.lookup(recurrence);
+                    if (!phi) {
+                        phi = createInductionPhi(loop, recurrence, preheader, latch);
+                        if (!phi) {
+                            continue;
+                        }
+                        phis.insert({recurrence, phi});
+                    }
+
+                    NumMultipliesReduced++;
+                    LLVM_DEBUG(dbgs() << "Reducing " << instruction << " to " << *recurrence << "\n");
+                    ORE.emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, "MultiplyReduced", ins)
+                            << "replaced " << ore::NV("Opcode", ins->getOpcodeName())
+                            << " of an induction variable with an incremented phi";
+                    });
+
+                    ins->replaceAllUsesWith(phi);
+                    instsToDelete.push_back(ins);
+                }
+            }
+
+        }
+
+        // phi = [start, preheader], [phi + step, latch]
+        PHINode* createInductionPhi(Loop& loop, const SCEVAddRecExpr* recurrence,
+            BasicBlock* preheader, BasicBlock* latch) {
+
+            const SCEV* start = recurrence->getStart();
+            const SCEV* step = recurrence->getStepRecurrence(SE);
+            Instruction* insertPoint = preheader->getTerminator();
+
+            if (!isSafeToExpandAt(start, insertPoint, SE) || !isSafeToExpandAt(step, insertPoint, SE)) {
+                return nullptr;
+            }
+
+            Type* type = recurrence->getType();
+            Value* startValue = expander.expandCodeFor(start, type, insertPoint);
+            Value* stepValue = expander.expandCodeFor(step, type, insertPoint);
+
+            BasicBlock* header = loop.getHeader();
+            PHINode* phi = PHINode::Create(type, 2, "loopsr.iv", &header->front());
+
+            Instruction* next = BinaryOperator::CreateAdd(phi, stepValue, "loopsr.iv.next",
+                latch->getTerminator());
+
+            for (BasicBlock* predecessor: predecessors(header)) {
+                phi->addIncoming(predecessor == preheader ? startValue : next, predecessor);
+            }
+
+            NumInductionPhis++;
+            insertedPhis.push_back(phi);
+            LLVM_DEBUG(dbgs() << "Inserted induction phi " << *phi << "\n");
+
+            return phi;
+
+        }
+    };
+}
+
+bool customopt::LoopSRPass::runImpl(Function& function, LoopInfo& LI, ScalarEvolution& SE,
+    OptimizationRemarkEmitter& ORE) {
+
+    LoopStrengthReduction lsr(SE, ORE, function.getParent()->getDataLayout());
+    return lsr.run(function, LI);
+
+}
+
+PreservedAnalyses customopt::LoopSRPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    if (!runImpl(function, FAM.getResult<LoopAnalysis>(function),
+        FAM.getResult<ScalarEvolutionAnalysis>(function),
+        FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+
+}
+
+namespace {
+    struct LoopSRLegacyPass : public FunctionPass {
+        static char ID;
+        LoopSRLegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.setPreservesCFG();
+            AU.addRequired<LoopInfoWrapperPass>();
+            AU.addRequired<ScalarEvolutionWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            AU.addPreserved<LoopInfoWrapperPass>();
+            AU.addPreserved<DominatorTreeWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            LoopInfo& LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+            ScalarEvolution& SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::LoopSRPass::runImpl(function, LI, SE, ORE);
+        }
+    };
+}
+
+char LoopSRLegacyPass::ID = 0;
+
+static RegisterPass<LoopSRLegacyPass> X("loopsr", "Loop Strength Reduction", false, false);
@@ -0,0 +1,433 @@
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+
+#include "CustomOpt.h"
+#include "Driver.h"
+
+using namespace llvm;
+
+// Optimizes the functions of a module in parallel:
+//
+// customopt-parallel -passes=dcelim,srcf,cse -j 8 input.ll -o output.bc
+//
+// An LLVMContext can only be used by one thread, so the module is split into
+// partitions which are optimized in their own context, and linked back together.
+// The partitioning does not depend on the number of threads, and the linked module
+// is put back in the order of the input, so the output is the same for any -j.
+// Only function passes can be run, since a module pass would only see a partition.
+
+static cl::opt<std::string> InputFilename(cl::Positional, cl::desc("<input .ll/.bc file>"),
+    cl::init("-"));
+
+static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename"),
+    cl::value_desc("filename"), cl::init("-"));
+
+static cl::opt<bool> OutputAssembly("S", cl::desc("Write output as LLVM assembly"));
+
+static cl::opt<std::string> PassPipeline("passes", cl::init("dcelim,srcf,cse"),
+    cl::desc("Pipeline of function passes to run on each function, as in opt -passes"));
+
+static cl::opt<unsigned> Threads("j", cl::init(0),
+    cl::desc("Number of threads (default: all cores)"));
+
+static cl::opt<unsigned> Partitions("partitions", cl::init(64),
+    cl::desc("Number of partitions the module is split into (independent of -j)"));
+
+static cl::opt<bool> Scaling("scaling",
+    cl::desc("Optimize with 1, 2, 4, ... up to -j threads, and report the throughput of each"));
+
+// The description lists the debug types of the passes, and is set in main()
+static cl::opt<bool> Verbose("v");
+
+static ExitOnError ExitOnErr;
+
+namespace {
+
+    // The local linkage, and the lack of a name, which SplitModule removes from
+    // a global so that it can be referenced from other partitions
+    struct LocalSymbol {
+        std::string name;
+        GlobalValue::LinkageTypes linkage;
+        GlobalValue::VisibilityTypes visibility;
+        bool dsoLocal;
+        bool unnamed;
+    };
+
+    // A module split into partitions, each one serialized as bitcode so that it
+    // can be read into the context of any thread
+    struct SplitModuleInfo {
+        std::vector<SmallVector<char, 0>> partitions;
+
+        std::vector<LocalSymbol> localSymbols;
+
+        // Order of the globals in the input
+        std::vector<std::string> globalOrder;
+        std::vector<std::string> functionOrder;
+
+        std::string moduleIdentifier;
+        std::string sourceFileName;
+
+        unsigned definedFunctions = 0;
+    };
+
+    struct RunResult {
+        double optimizeSeconds;
+        double linkSeconds;
+        SmallVector<char, 0> bitcode;
+    };
+
+    double secondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    SplitModuleInfo splitModule(Module& module) {
+
+        SplitModuleInfo info;
+        info.moduleIdentifier = module.getModuleIdentifier();
+        info.sourceFileName = module.getSourceFileName();
+
+        std::vector<std::pair<GlobalValue *, LocalSymbol>> locals;
+        for (GlobalValue& value: module.global_values()) {
+            if (value.hasLocalLinkage() || !value.hasName()) {
+                locals.push_back({&value, { "", value.getLinkage(), value.getVisibility(),
+                    value.isDSOLocal(), !value.hasName() }});
+            }
+        }
+
+        for (Function& function: module) {
+            if (!function.isDeclaration()) {
+                info.definedFunctions++;
+            }
+        }
+
+        unsigned count = std::max(1u, std::min<unsigned>(Partitions, info.definedFunctions));
+
+        SplitModule(module, count, [&](std::unique_ptr<Module> partition) {
+            info.partitions.emplace_back();
+            raw_svector_ostream out(info.partitions.back());
+            WriteBitcodeToFile(*partition, out);
+        });
+
+        // Every global has a unique name now
+        for (auto& local: locals) {
+            local.second.name = local.first->getName().str();
+            info.localSymbols.push_back(local.second);
+        }
+
+        for (GlobalVariable& global: module.globals()) {
+            info.globalOrder.push_back(global.getName().str());
+        }
+        for (Function& function: module) {
+            info.functionOrder.push_back(function.getName().str());
+        }
+
+        return info;
+
+    }
+
+    void optimizeModule(Module& module) {
+
+        // Each partition has its own pipeline, since they are optimized by different threads
+        customopt::Pipeline pipeline(module);
+
+        FunctionPassManager FPM;
+        ExitOnErr(pipeline.PB.parsePassPipeline(FPM, PassPipeline));
+
+        ModulePassManager MPM;
+        MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+        MPM.run(module, pipeline.MAM);
+
+    }
+
+    // Read a partition into a context of its own, optimize it and serialize it again
+    SmallVector<char, 0> optimizePartition(const SmallVector<char, 0>& bitcode) {
+
+        LLVMContext context;
+        std::unique_ptr<Module> partition = ExitOnErr(parseBitcodeFile(
+            MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), "partition"), context));
+
+        optimizeModule(*partition);
+
+        SmallVector<char, 0> result;
+        raw_svector_ostream out(result);
+        WriteBitcodeToFile(*partition, out);
+        return result;
+
+    }
+
+    // Move the named elements of list to its end in the given order, followed by
+    // the elements which are not in the input (e.g. declarations added by the passes)
+    template <typename ListTy, typename LookupTy>
+    void reorder(ListTy& list, const std::vector<std::string>& order, LookupTy lookup) {
+
+        std::vector<typename ListTy::value_type *> elements;
+        SmallPtrSet<typename ListTy::value_type *, 32> placed;
+
+        for (const std::string& name: order) {
+            if (auto* element = lookup(name)) {
+                elements.push_back(element);
+                placed.insert(element);
+            }
+        }
+        for (auto& element: list) {
+            if (!placed.count(&element)) {
+                elements.push_back(&element);
+            }
+        }
+
+        for (auto* element: elements) {
+            list.remove(element);
+            list.push_back(element);
+        }
+
+    }
+
+    // Undo the changes SplitModule made to the input, so that the output matches
+    // the result of running the passes on the whole module
+    void restoreModule(Module& module, const SplitModuleInfo& info) {
+
+        module.setModuleIdentifier(info.moduleIdentifier);
+        module.setSourceFileName(info.sourceFileName);
+
+        // Put the globals and functions back in the order of the input
+        reorder(module.getGlobalList(), info.globalOrder, [&](StringRef name) {
+            return module.getGlobalVariable(name, true);
+        });
+        reorder(module.getFunctionList(), info.functionOrder, [&](StringRef name) {
+            return module.getFunction(name);
+        });
+
+        for (const LocalSymbol& local: info.localSymbols) {
+
+            GlobalValue* value = module.getNamedValue(local.name);
+            if (!value) {
+                continue;
+            }
+
+            value->setLinkage(local.linkage);
+            value->setVisibility(local.visibility);
+            value->setDSOLocal(local.dsoLocal);
+            if (local.unnamed) {
+                value->setName("");
+            }
+        }
+
+        // Every partition carries the named metadata of the input (e.g. llvm.ident),
+        // so the linker appends each operand once per partition
+        for (NamedMDNode& named: module.named_metadata()) {
+
+            if (named.getName() == "llvm.module.flags") {
+                continue;
+            }
+
+            std::vector<MDNode *> operands;
+            for (MDNode* operand: named.operands()) {
+                if (std::find(operands.begin(), operands.end(), operand) == operands.end()) {
+                    operands.push_back(operand);
+                }
+            }
+
+            named.clearOperands();
+            for (MDNode* operand: operands) {
+                named.addOperand(operand);
+            }
+        }
+
+    }
+
+    RunResult run(const SplitModuleInfo& info, unsigned threads) {
+
+        RunResult result;
+
+        // Optimize the partitions. Each idle thread takes the next partition from the
+        // queue, so a thread which finishes early is not left waiting on the others.
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<SmallVector<char, 0>> optimized(info.partitions.size());
+        {
+            ThreadPool pool(hardware_concurrency(threads));
+            for (size_t i = 0; i < info.partitions.size(); i++) {
+                pool.async([&info, &optimized, i]() {
+                    optimized[i] = optimizePartition(info.partitions[i]);
+                });
+            }
+            pool.wait();
+        }
+
+        result.optimizeSeconds = secondsSince(start);
+
+        // Link the partitions in order, whichever thread optimized them
+        start = std::chrono::steady_clock::now();
+
+        LLVMContext context;
+        std::unique_ptr<Module> linked;
+
+        for (const SmallVector<char, 0>& bitcode: optimized) {
+
+            std::unique_ptr<Module> partition = ExitOnErr(parseBitcodeFile(
+                MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), "partition"), context));
+
+            if (!linked) {
+                linked = std::move(partition);
+            }
+            else if (Linker::linkModules(*linked, std::move(partition))) {
+                errs() << "error: cannot link the optimized partitions\n";
+                exit(1);
+            }
+        }
+
+        restoreModule(*linked, info);
+
+        if (verifyModule(*linked, &errs())) {
+            errs() << "error: the optimized module is broken\n";
+            exit(1);
+        }
+
+        raw_svector_ostream out(result.bitcode);
+        WriteBitcodeToFile(*linked, out);
+
+        result.linkSeconds = secondsSince(start);
+
+        return result;
+
+    }
+
+    void writeOutput(const SmallVector<char, 0>& bitcode, StringRef moduleIdentifier) {
+
+        std::error_code error;
+        ToolOutputFile output(OutputFilename, error,
+            OutputAssembly ? sys::fs::OF_TextWithCRLF : sys::fs::OF_None);
+        if (error) {
+            errs() << "error: " << error.message() << "\n";
+            exit(1);
+        }
+
+        if (OutputAssembly) {
+            LLVMContext context;
+            std::unique_ptr<Module> module = ExitOnErr(parseBitcodeFile(
+                MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), moduleIdentifier), context));
+            module->print(output.os(), nullptr);
+        }
+        else {
+            output.os() << StringRef(bitcode.data(), bitcode.size());
+        }
+
+        output.keep();
+
+    }
+}
+
+int main(int argc, char** argv) {
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+
+    std::string verboseDescription = "Print the transformations made by the passes (-debug-only=" +
+        customopt::getDebugTypes() + ")";
+    Verbose.setDescription(verboseDescription);
+
+    cl::ParseCommandLineOptions(argc, argv, "parallel custom optimization driver\n");
+
+    ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+
+    // The debug output of the passes interleaves between threads, so it is only
+    // printed on request
+    if (Verbose) {
+        customopt::enableDebugOutput();
+    }
+
+    LLVMContext context;
+    SMDiagnostic error;
+    std::unique_ptr<Module> module = parseIRFile(InputFilename, error, context);
+    if (!module) {
+        error.print(argv[0], errs());
+        return 1;
+    }
+
+    // Check the pipeline once, before it is parsed by every thread. A partition holds
+    // part of the module, so module passes (ipcp, valueprof-use) would only see part
+    // of the call graph or of the profile, and give another result than opt: only
+    // function passes are accepted.
+    {
+        PassBuilder PB;
+        customopt::registerPasses(PB);
+        FunctionPassManager FPM;
+        if (Error error = PB.parsePassPipeline(FPM, PassPipeline)) {
+            errs() << argv[0] << ": " << toString(std::move(error))
+                << " (-passes can only contain function passes, as each partition is optimized on its own)\n";
+            return 1;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    SplitModuleInfo info = splitModule(*module);
+    double splitSeconds = secondsSince(start);
+
+    unsigned maxThreads = Threads ? Threads : hardware_concurrency().compute_thread_count();
+
+    std::vector<unsigned> threadCounts;
+    if (Scaling) {
+        for (unsigned threads = 1; threads < maxThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+    }
+    threadCounts.push_back(maxThreads);
+
+    errs() << "Split " << info.definedFunctions << " functions into " << info.partitions.size()
+        << " partitions in " << format("%.3f", splitSeconds) << "s\n";
+    errs() << " threads   optimize (s)   link (s)    functions/s  speedup\n";
+
+    RunResult first;
+    double baseline = 0;
+
+    for (unsigned threads: threadCounts) {
+
+        RunResult result = run(info, threads);
+
+        double throughput = info.definedFunctions / result.optimizeSeconds;
+        if (!baseline) {
+            baseline = throughput;
+        }
+
+        errs() << format("%8u %14.3f %10.3f %14.0f %7.2fx\n", threads, result.optimizeSeconds,
+            result.linkSeconds, throughput, throughput / baseline);
+
+        // The output may not depend on the number of threads
+        if (first.bitcode.empty()) {
+            first = std::move(result);
+        }
+        else if (result.bitcode != first.bitcode) {
+            errs() << "error: the output with " << threads << " threads differs from the output with "
+                << threadCounts.front() << "\n";
+            return 1;
+        }
+    }
+
+    writeOutput(first.bitcode, info.moduleIdentifier);
+
+    return 0;
+
+}
@@ -0,0 +1,358 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
+#include "ValueNumbering.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "pre"
+
+STATISTIC(NumFullyRedundant, "Number of instructions computed by a dominating identical one");
+STATISTIC(NumPartiallyRedundant, "Number of partially redundant instructions replaced with a phi");
+STATISTIC(NumInserted, "Number of instructions inserted in predecessors missing the value");
+
+namespace {
+
+    // The blocks where the value of an expression is available, with the value
+    // computing it there (an instruction, or the phi which replaced one)
+    typedef SmallVector<std::pair<BasicBlock *, Value *>, 2> AvailableListTy;
+    typedef DenseMap<SimpleValue, AvailableListTy> AvailableTableTy;
+
+    struct PartialRedundancyElimination {
+
+        DominatorTree& DT;
+        OptimizationRemarkEmitter& ORE;
+
+        // Every computed expression, by value number
+        AvailableTableTy availableValues;
+
+        // Position of each block in reverse post-order
+        DenseMap<BasicBlock *, unsigned> order;
+
+        PartialRedundancyElimination(DominatorTree& DT, OptimizationRemarkEmitter& ORE) : DT(DT), ORE(ORE) {}
+
+        bool run(Function& function) {
+
+            // Vector of instructions to delete at the end of the pass. They stay in the
+            // function until then, as the keys of the values which replaced them.
+            std::vector<Instruction *> instsToDelete;
+
+            LLVM_DEBUG(dbgs() << "Starting Partial Redundancy Elimination pass "
+                "for function: '" << function.getName() << "':\n");
+
+            // Predecessors before their successors, except along back edges
+            ReversePostOrderTraversal<Function *> RPOT(&function);
+            for (BasicBlock* block: RPOT) {
+                order.insert({block, order.size()});
+            }
+
+            for (BasicBlock* block: RPOT) {
+                processBlock(*block, instsToDelete);
+            }
+
+            LLVM_DEBUG(dbgs() << "Partial Redundancy Elimination pass complete!\n\n");
+
+            // Delete all the unnecessary instructions
+            availableValues.clear();
+            for (auto i: instsToDelete) {
+                i->eraseFromParent();
+            }
+
+            return !instsToDelete.empty();
+
+        }
+
+        // The value of expression at the end of block, from a block which dominates it
+        Value* findAvailable(Instruction* expression, BasicBlock* block) {
+
+            auto found = availableValues.find(expression);
+            if (found == availableValues.end()) {
+                return nullptr;
+            }
+
+            for (auto& available: found->second) {
+                if (DT.dominates(available.first, block)) {
+                    return available.second;
+                }
+            }
+
+            return nullptr;
+
+        }
+
+        void processBlock(BasicBlock& block, std::vector<Instruction *>& instsToDelete) {
+
+            for (auto& instruction: block) {
+
+                Instruction* ins = &instruction;
+
+                if (!SimpleValue::canHandle(ins)) {
+                    continue;
+                }
+
+                // Fully redundant: computed by a dominating identical instruction, or
+                // earlier in this block
+                if (Value* identical = findAvailable(ins, &block)) {
+
+                    NumFullyRedundant++;
+                    LLVM_DEBUG(dbgs() << "Found fully redundant: " << instruction << ", Deleting\n");
+                    ORE.emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, "FullyRedundant", ins)
+                            << "replaced " << ore::NV("Opcode", ins->getOpcodeName())
+                            << " with an identical dominating one";
+                    });
+
+                    ins->replaceAllUsesWith(identical);
+                    instsToDelete.push_back(ins);
+                    continue;
+                }
+
+                Value* value = ins;
+                if (Value* phi = eliminatePartialRedundancy(ins, block)) {
+                    value = phi;
+                    instsToDelete.push_back(ins);
+                }
+
+                availableValues[ins].push_back({&block, value});
+            }
+
+        }
+
+        // The expression ins computes at the end of predecessor: ins itself, with the
+        // phis of its block replaced by their incoming value from predecessor. Returns
+        // ins when no operand is such a phi, and nullptr when an operand is computed in
+        // the block of ins, which has no value before it.
+        Instruction* translate(Instruction* ins, BasicBlock* predecessor) {
+
+            BasicBlock* block = ins->getParent();
+            Instruction* translated = ins;
+
+            for (unsigned i = 0; i < ins->getNumOperands(); i++) {
+
+                Instruction* operand = dyn_cast<Instruction>(ins->getOperand(i));
+                if (!operand || operand->getParent() != block) {
+                    continue;
+                }
+
+                PHINode* phi = dyn_cast<PHINode>(operand);
+                if (!phi) {
+                    if (translated != ins) {
+                        translated->deleteValue();
+                    }
+                    return nullptr;
+                }
+
+                if (translated == ins) {
+                    translated = ins->clone();
+                }
+                translated->setOperand(i, phi->getIncomingValueForBlock(predecessor));
+            }
+
+            return translated;
+
+        }
+
+        // When the value of ins is available at the end of some predecessors of its
+        // block, it is computed in the others, and ins is replaced with a phi of the
+        // values from each predecessor. Returns the value replacing ins, or nullptr.
+        Value* eliminatePartialRedundancy(Instruction* ins, BasicBlock& block) {
+
+            if (!block.hasNPredecessorsOrMore(2) || block.isEHPad()) {
+                return nullptr;
+            }
+
+            // The value from each predecessor, and the expressions to insert in
+            // predecessors missing it
+            SmallDenseMap<BasicBlock *, Value *, 4> incoming;
+            SmallVector<std::pair<BasicBlock *, Instruction *>, 4> insertions;
+            unsigned available = 0;
+
+            auto abandon = [&]() -> Value* {
+                for (auto& insertion: insertions) {
+                    insertion.second->deleteValue();
+                }
+                return nullptr;
+            };
+
+            for (BasicBlock* predecessor: predecessors(&block)) {
+
+                if (incoming.count(predecessor)) {
+                    continue;
+                }
+
+                // Every block dominates an unreachable one, which must not count as available
+                if (!DT.isReachableFromEntry(predecessor)) {
+                    incoming[predecessor] = UndefValue::get(ins->getType());
+                    continue;
+                }
+
+                // Along a back edge, only ins itself is available: the blocks of the
+                // loop have not been visited yet
+                if (order.lookup(predecessor) >= order.lookup(&block)) {
+
+                    Instruction* translated = translate(ins, predecessor);
+                    if (translated != ins || !DT.dominates(&block, predecessor)) {
+                        if (translated && translated != ins) {
+                            translated->deleteValue();
+                        }
+                        return abandon();
+                    }
+
+                    incoming[predecessor] = ins;
+                    available++;
+                    continue;
+                }
+
+                Instruction* translated = translate(ins, predecessor);
+                if (!translated) {
+                    return abandon();
+                }
+
+                Value* value = findAvailable(translated, predecessor);
+
+                if (value) {
+                    if (translated != ins) {
+                        translated->deleteValue();
+                    }
+                    incoming[predecessor] = value;
+                    available++;
+                    continue;
+                }
+
+                // The expression is inserted at the end of the predecessor, which must only
+                // lead to this block, and must not trap where ins would not have run
+                if (predecessor->getSingleSuccessor() != &block || !isSafeToSpeculativelyExecute(ins)) {
+                    if (translated != ins) {
+                        translated->deleteValue();
+                    }
+                    return abandon();
+                }
+
+                if (translated == ins) {
+                    translated = ins->clone();
+                }
+                insertions.push_back({predecessor, translated});
+                incoming[predecessor] = translated;
+            }
+
+            // Nothing to share
+            if (available == 0) {
+                return abandon();
+            }
+
+            for (auto& insertion: insertions) {
+
+                Instruction* inserted = insertion.second;
+                inserted->insertBefore(insertion.first->getTerminator());
+                inserted->setName(ins->getName() + ".pre");
+                inserted->setDebugLoc(DebugLoc());
+                availableValues[inserted].push_back({insertion.first, inserted});
+
+                NumInserted++;
+                LLVM_DEBUG(dbgs() << "Inserted " << *inserted << " in " << insertion.first->getName() << "\n");
+            }
+
+            NumPartiallyRedundant++;
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "PartiallyRedundant", ins)
+                    << "replaced partially redundant " << ore::NV("Opcode", ins->getOpcodeName())
+                    << " with a phi, inserting it in " << ore::NV("Insertions", unsigned(insertions.size()))
+                    << " predecessor(s)";
+            });
+
+            // The same value from every edge (besides ins itself along back edges)
+            // dominates the block, and needs no phi
+            Value* unique = nullptr;
+            bool same = true;
+            for (auto& value: incoming) {
+                if (value.second == ins || isa<UndefValue>(value.second)) {
+                    continue;
+                }
+                if (unique && unique != value.second) {
+                    same = false;
+                }
+                unique = value.second;
+            }
+
+            if (same && unique) {
+                LLVM_DEBUG(dbgs() << "Found partially redundant: " << *ins << ", replaced with " << *unique << "\n");
+                ins->replaceAllUsesWith(unique);
+                return unique;
+            }
+
+            PHINode* phi = PHINode::Create(ins->getType(), pred_size(&block), ins->getName() + ".pre-phi",
+                &block.front());
+            for (BasicBlock* predecessor: predecessors(&block)) {
+                phi->addIncoming(incoming[predecessor], predecessor);
+            }
+
+            LLVM_DEBUG(dbgs() << "Found partially redundant: " << *ins << ", replaced with " << *phi << "\n");
+
+            // Along back edges, the phi takes its own value
+            ins->replaceAllUsesWith(phi);
+            return phi;
+
+        }
+    };
+}
+
+bool customopt::PREPass::runImpl(Function& function, DominatorTree& DT,
+    OptimizationRemarkEmitter& ORE) {
+
+    PartialRedundancyElimination pre(DT, ORE);
+    return pre.run(function);
+
+}
+
+PreservedAnalyses customopt::PREPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    if (!runImpl(function, FAM.getResult<DominatorTreeAnalysis>(function),
+        FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+
+}
+
+namespace {
+    struct PRELegacyPass : public FunctionPass {
+        static char ID;
+        PRELegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.setPreservesCFG();
+            AU.addRequired<DominatorTreeWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            AU.addPreserved<DominatorTreeWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::PREPass::runImpl(function, DT, ORE);
+        }
+    };
+}
+
+char PRELegacyPass::ID = 0;
+
+static RegisterPass<PRELegacyPass> X("pre", "Partial Redundancy Elimination", false, true);
@@ -0,0 +1,404 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+
+#include <algorithm>
+
+#include "CustomOpt.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "reassoc"
+
+STATISTIC(NumTreesRewritten, "Number of expression trees rebuilt in canonical order");
+STATISTIC(NumConstantsCombined, "Number of constant operands combined with another");
+STATISTIC(NumOperandsCancelled, "Number of operands removed as duplicates (x&x, x|x, x^x)");
+
+namespace {
+
+    // An operand of an expression tree, with its rank
+    struct Leaf {
+        uint64_t rank;
+        Value* value;
+    };
+
+    struct Reassociation {
+
+        OptimizationRemarkEmitter& ORE;
+        const DataLayout& DL;
+
+        // Rank of each argument and instruction: constants are 0, arguments come next,
+        // then the instructions in the order of their blocks in reverse post-order. Values
+        // computed earlier (outside a loop, in a dominator) have lower ranks.
+        DenseMap<Value *, uint64_t> ranks;
+
+        Reassociation(OptimizationRemarkEmitter& ORE, const DataLayout& DL) : ORE(ORE), DL(DL) {}
+
+        bool run(Function& function) {
+
+            // Vector of instructions to delete at the end of the pass (nodes of the trees
+            // left over once their constants were combined)
+            std::vector<Instruction *> instsToDelete;
+
+            bool changed = false;
+
+            LLVM_DEBUG(dbgs() << "Starting Reassociation pass "
+                "for function: '" << function.getName() << "':\n");
+
+            uint64_t rank = 1;
+            for (Argument& argument: function.args()) {
+                ranks[&argument] = rank++;
+            }
+
+            ReversePostOrderTraversal<Function *> RPOT(&function);
+            for (BasicBlock* block: RPOT) {
+                for (Instruction& instruction: *block) {
+                    ranks[&instruction] = rank++;
+                }
+            }
+
+            for (BasicBlock* block: RPOT) {
+                for (Instruction& instruction: make_early_inc_range(*block)) {
+
+                    BinaryOperator* root = dyn_cast<BinaryOperator>(&instruction);
+                    if (!root || !isReassociable(root) || !isRoot(root)) {
+                        continue;
+                    }
+
+                    changed |= rewriteTree(root, instsToDelete);
+                }
+            }
+
+            LLVM_DEBUG(dbgs() << "Reassociation pass complete!\n\n");
+
+            // Delete all the unnecessary instructions, which may use each other
+            for (auto i: instsToDelete) {
+                i->dropAllReferences();
+            }
+            for (auto i: instsToDelete) {
+                i->eraseFromParent();
+            }
+
+            return changed;
+
+        }
+
+        uint64_t getRank(Value* value) {
+
+            if (isa<Constant>(value)) {
+                return 0;
+            }
+            return ranks.lookup(value);
+
+        }
+
+        // Associative and commutative integer operations
+        bool isReassociable(BinaryOperator* op) {
+
+            switch (op->getOpcode()) {
+                case Instruction::Add:
+                case Instruction::Mul:
+                case Instruction::And:
+                case Instruction::Or:
+                case Instruction::Xor:
+                    return op->getType()->isIntOrIntVectorTy();
+                default:
+                    return false;
+            }
+
+        }
+
+        // An inner node of the tree of its user: same operation, in the same block,
+        // with no other use, so that it can be rebuilt with the tree
+        bool isInnerNode(Value* value, unsigned opcode, BasicBlock* block) {
+
+            BinaryOperator* op = dyn_cast<BinaryOperator>(value);
+            return op && op->getOpcode() == opcode && op->getParent() == block && op->hasOneUse();
+
+        }
+
+        // The top of a tree: not an inner node of its user's tree
+        bool isRoot(BinaryOperator* op) {
+
+            if (!op->hasOneUse()) {
+                return true;
+            }
+
+            Instruction* user = cast<Instruction>(op->user_back());
+            return user->getOpcode() != op->getOpcode() || user->getParent() != op->getParent();
+
+        }
+
+        // The leaves of the tree of root, and its nodes in post-order (root last)
+        void linearize(BinaryOperator* root, std::vector<Leaf>& leaves, std::vector<BinaryOperator *>& nodes) {
+
+            unsigned opcode = root->getOpcode();
+            BasicBlock* block = root->getParent();
+
+            // Explicit stack of (node, next operand to visit), as trees can be deep
+            std::vector<std::pair<BinaryOperator *, unsigned>> stack;
+            stack.push_back({root, 0});
+
+            while (!stack.empty()) {
+
+                BinaryOperator* node = stack.back().first;
+                unsigned index = stack.back().second;
+
+                if (index == 2) {
+                    nodes.push_back(node);
+                    stack.pop_back();
+                    continue;
+                }
+
+                stack.back().second++;
+
+                Value* operand = node->getOperand(index);
+                if (isInnerNode(operand, opcode, block)) {
+                    stack.push_back({cast<BinaryOperator>(operand), 0});
+                }
+                else {
+                    leaves.push_back({getRank(operand), operand});
+                }
+            }
+
+        }
+
+        // Combine the constants into one, and drop the operands which cancel. Returns
+        // the value of the whole tree when it reduces to a constant.
+        Constant* simplifyLeaves(unsigned opcode, Type* type, std::vector<Leaf>& leaves) {
+
+            Constant* identity = ConstantExpr::getBinOpIdentity(opcode, type);
+            Constant* absorber = ConstantExpr::getBinOpAbsorber(opcode, type);
+
+            // Fold the constants together; those which do not fold stay operands
+            Constant* folded = nullptr;
+            std::vector<Leaf> others;
+
+            for (Leaf& leaf: leaves) {
+
+                Constant* constant = dyn_cast<Constant>(leaf.value);
+                if (!constant) {
+                    others.push_back(leaf);
+                    continue;
+                }
+
+                if (!folded) {
+                    folded = constant;
+                    continue;
+                }
+
+                if (Constant* combined = ConstantFoldBinaryOpOperands(opcode, folded, constant, DL)) {
+                    NumConstantsCombined++;
+                    folded = combined;
+                }
+                else {
+                    others.push_back(leaf);
+                }
+            }
+
+            if (folded && absorber && folded == absorber) {
+                return absorber;
+            }
+
+            // Lowest ranks first: they are computed together at the bottom of the tree.
+            // Equal ranks are the same value, or constants.
+            std::stable_sort(others.begin(), others.end(), [](const Leaf& a, const Leaf& b) {
+                return a.rank < b.rank;
+            });
+
+            // x & x == x, x | x == x, x ^ x == 0
+            if (opcode == Instruction::And || opcode == Instruction::Or || opcode == Instruction::Xor) {
+
+                std::vector<Leaf> unique;
+
+                for (Leaf& leaf: others) {
+
+                    if (unique.empty() || unique.back().value != leaf.value) {
+                        unique.push_back(leaf);
+                        continue;
+                    }
+
+                    NumOperandsCancelled++;
+                    if (opcode == Instruction::Xor) {
+                        NumOperandsCancelled++;
+                        unique.pop_back();
+                    }
+                }
+
+                others = std::move(unique);
+            }
+
+            leaves = std::move(others);
+
+            // The constant is the last operand of the root, as in x + C
+            if (folded && folded != identity) {
+                leaves.push_back({0, folded});
+            }
+
+            if (leaves.empty()) {
+                return identity;
+            }
+
+            return nullptr;
+
+        }
+
+        bool rewriteTree(BinaryOperator* root, std::vector<Instruction *>& instsToDelete) {
+
+            unsigned opcode = root->getOpcode();
+
+            std::vector<Leaf> leaves;
+            std::vector<BinaryOperator *> nodes;
+            linearize(root, leaves, nodes);
+
+            // Wrapping flags only survive where the tree keeps its shape, except no
+            // unsigned wrap in sums: when the total does not wrap, no partial sum does
+            bool allNUW = opcode == Instruction::Add;
+            for (BinaryOperator* node: nodes) {
+                allNUW &= node->hasNoUnsignedWrap();
+            }
+
+            unsigned originalLeaves = leaves.size();
+
+            if (Constant* constant = simplifyLeaves(opcode, root->getType(), leaves)) {
+                replaceTree(root, constant, nodes, instsToDelete);
+                return true;
+            }
+
+            if (leaves.size() == 1) {
+                replaceTree(root, leaves.front().value, nodes, instsToDelete);
+                return true;
+            }
+
+            // Rebuild as ((l0 op l1) op l2) op ..., reusing the nodes bottom-up. A node
+            // whose operands and subtree are unchanged keeps its flags.
+            unsigned needed = leaves.size() - 1;
+            std::vector<BinaryOperator *> reused(nodes.begin(), nodes.begin() + needed - 1);
+            reused.push_back(root);
+
+            bool changed = false;
+            bool subtreeChanged = false;
+            Value* left = leaves[0].value;
+
+            for (unsigned i = 0; i < needed; i++) {
+
+                BinaryOperator* node = reused[i];
+                Value* right = leaves[i + 1].value;
+
+                bool same = node->getOperand(0) == left && node->getOperand(1) == right;
+                if (!same || subtreeChanged) {
+
+                    node->setOperand(0, left);
+                    node->setOperand(1, right);
+
+                    if (node != root) {
+                        node->moveBefore(root);
+                    }
+
+                    node->clearSubclassOptionalData();
+                    if (allNUW) {
+                        node->setHasNoUnsignedWrap(true);
+                    }
+
+                    subtreeChanged = true;
+                    changed = true;
+                }
+
+                left = node;
+            }
+
+            // Nodes left over, once constants were combined or operands cancelled
+            for (unsigned i = needed - 1; i + 1 < nodes.size(); i++) {
+                instsToDelete.push_back(nodes[i]);
+                changed = true;
+            }
+
+            if (changed) {
+                NumTreesRewritten++;
+                LLVM_DEBUG(dbgs() << "Reassociated " << originalLeaves << " operands to " << *root << "\n");
+                ORE.emit([&]() {
+                    return OptimizationRemark(DEBUG_TYPE, "Reassociated", root)
+                        << "rebuilt " << ore::NV("Opcode", root->getOpcodeName()) << " tree of "
+                        << ore::NV("Operands", originalLeaves) << " operands with "
+                        << ore::NV("Remaining", unsigned(leaves.size())) << " operands";
+                });
+            }
+
+            return changed;
+
+        }
+
+        // The whole tree computes value
+        void replaceTree(BinaryOperator* root, Value* value, std::vector<BinaryOperator *>& nodes,
+            std::vector<Instruction *>& instsToDelete) {
+
+            NumTreesRewritten++;
+            LLVM_DEBUG(dbgs() << "Reassociated " << *root << " to " << *value << "\n");
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "Reassociated", root)
+                    << "reduced " << ore::NV("Opcode", root->getOpcodeName()) << " tree to one operand";
+            });
+
+            root->replaceAllUsesWith(value);
+
+            for (BinaryOperator* node: nodes) {
+                instsToDelete.push_back(node);
+            }
+
+        }
+    };
+}
+
+bool customopt::ReassocPass::runImpl(Function& function, OptimizationRemarkEmitter& ORE) {
+
+    Reassociation reassociation(ORE, function.getParent()->getDataLayout());
+    return reassociation.run(function);
+
+}
+
+PreservedAnalyses customopt::ReassocPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    if (!runImpl(function, FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+
+}
+
+namespace {
+    struct ReassocLegacyPass : public FunctionPass {
+        static char ID;
+        ReassocLegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.setPreservesCFG();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::ReassocPass::runImpl(function, ORE);
+        }
+    };
+}
+
+char ReassocLegacyPass::ID = 0;
+
+static RegisterPass<ReassocLegacyPass> X("reassoc", "Reassociation", false, false);
@@ -0,0 +1,619 @@
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "CustomOpt.h"
+#include "Driver.h"
+
+using namespace llvm;
+
+// Measures whether the passes make the generated code faster:
+//
+// customopt-runbench -passes=dcelim,srcf,cse -perf benchmarks/*.c -o results.json
+//
+// Every kernel is compiled to IR with clang -O0 (as in run.sh), and built twice:
+// once after the -baseline pipeline alone (mem2reg), and once after the baseline
+// and -passes. Both binaries are built with clang -O0, so that the difference
+// between them is the work of the passes, not of the code generator. Each binary
+// is run -repeat times and the fastest run is reported; with -perf, the cycles and
+// instructions of the runs are counted by perf_event_open (user space only, which
+// needs no privileges with the default perf_event_paranoid). The output of the two
+// binaries must be the same, or the kernel is reported as a mismatch.
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::OneOrMore,
+    cl::desc("<kernel .c/.ll/.bc files>"));
+
+static cl::opt<std::string> ClangPath("clang", cl::init("clang"),
+    cl::desc("Compiler turning the C kernels into IR, and the IR into executables"));
+
+static cl::opt<std::string> BaselinePipeline("baseline", cl::init("mem2reg"),
+    cl::desc("Pipeline run on both binaries, as in opt -passes"));
+
+static cl::opt<std::string> PassPipeline("passes", cl::init("dcelim,srcf,cse"),
+    cl::desc("Pipeline run after the baseline on the optimized binary, as in opt -passes"));
+
+static cl::opt<unsigned> Repeat("repeat", cl::init(5),
+    cl::desc("Number of runs of each binary, the fastest one is reported"));
+
+static cl::opt<unsigned> Timeout("timeout", cl::init(60),
+    cl::desc("Seconds after which a run is stopped (0: no limit)"));
+
+static cl::opt<bool> PerfCounters("perf",
+    cl::desc("Count the cycles and instructions of each run (Linux perf_event_open)"));
+
+static cl::opt<std::string> WorkDirectory("work-dir", cl::value_desc("directory"),
+    cl::desc("Directory for the IR, binaries and outputs of the kernels (default: a new temporary one)"));
+
+static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename"),
+    cl::value_desc("filename"), cl::init("-"));
+
+enum class OutputFormat { JSON, CSV };
+
+static cl::opt<OutputFormat> Format("format", cl::init(OutputFormat::JSON),
+    cl::desc("Format of the results"),
+    cl::values(clEnumValN(OutputFormat::JSON, "json", "One JSON document"),
+        clEnumValN(OutputFormat::CSV, "csv", "One line per kernel")));
+
+static ExitOnError ExitOnErr;
+
+namespace {
+
+    // The fastest run of a binary. The counters are -1 when they are not counted,
+    // or the kernel does not let user space read them.
+    struct Run {
+        double seconds = 0;
+        int64_t cycles = -1;
+        int64_t instructions = -1;
+    };
+
+    // One of the two builds of a kernel
+    struct Variant {
+        uint64_t staticInstructions = 0;
+        Run best;
+    };
+
+    enum class Status { OK, Failed, Timeout, Mismatch };
+
+    const char* getStatusName(Status status) {
+
+        switch (status) {
+        case Status::OK: return "ok";
+        case Status::Failed: return "failed";
+        case Status::Timeout: return "timeout";
+        case Status::Mismatch: return "mismatch";
+        }
+        return "";
+
+    }
+
+    struct Result {
+        std::string kernel;
+        Status status;
+        Variant baseline;
+        Variant optimized;
+    };
+
+    std::string getPath(StringRef name) {
+
+        SmallString<128> path(WorkDirectory);
+        sys::path::append(path, name);
+        return path.str().str();
+
+    }
+
+    // Runs clang with arguments, its diagnostics going to the terminal
+    bool runClang(ArrayRef<StringRef> arguments) {
+
+        std::vector<StringRef> command = {ClangPath};
+        command.insert(command.end(), arguments.begin(), arguments.end());
+
+        std::string error;
+        int code = sys::ExecuteAndWait(ClangPath, command, None, {}, 0, 0, &error);
+
+        if (code != 0) {
+            errs() << ClangPath << ": " << (error.empty() ? "exited with " + std::to_string(code) : error) << "\n";
+            return false;
+        }
+        return true;
+
+    }
+
+    uint64_t countInstructions(const Module& module) {
+
+        uint64_t count = 0;
+        for (const Function& function: module) {
+            count += function.getInstructionCount();
+        }
+        return count;
+
+    }
+
+    // Runs the baseline pipeline on the IR of input, and then pipeline when it is not
+    // empty, and writes the result to output
+    bool optimize(StringRef input, StringRef pipeline, StringRef output, uint64_t& instructions) {
+
+        LLVMContext context;
+        SMDiagnostic error;
+
+        std::unique_ptr<Module> module = parseIRFile(input, error, context);
+        if (!module) {
+            error.print("customopt-runbench", errs());
+            return false;
+        }
+
+        customopt::Pipeline passes(*module);
+
+        // Two pipelines on the same manager, so that a module pass (ipcp) can follow
+        // the function passes of the baseline
+        ModulePassManager MPM;
+        if (!BaselinePipeline.empty()) {
+            ExitOnErr(passes.PB.parsePassPipeline(MPM, BaselinePipeline));
+        }
+        if (!pipeline.empty()) {
+            ExitOnErr(passes.PB.parsePassPipeline(MPM, pipeline));
+        }
+
+        MPM.run(*module, passes.MAM);
+
+        if (verifyModule(*module, &errs())) {
+            errs() << input << ": the passes produced invalid IR\n";
+            return false;
+        }
+
+        instructions = countInstructions(*module);
+
+        std::error_code errorCode;
+        ToolOutputFile out(output, errorCode, sys::fs::OF_TextWithCRLF);
+        if (errorCode) {
+            errs() << output << ": " << errorCode.message() << "\n";
+            return false;
+        }
+
+        module->print(out.os(), nullptr);
+        out.keep();
+
+        return true;
+
+    }
+
+#ifdef __linux__
+    // Counts event in user space for process and its children, from its next exec
+    int openCounter(pid_t process, uint64_t event) {
+
+        struct perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = event;
+        attributes.disabled = 1;
+        attributes.enable_on_exec = 1;
+        attributes.inherit = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+
+        return syscall(__NR_perf_event_open, &attributes, process, -1, -1, 0);
+
+    }
+#endif
+
+    // The value of a counter, which is closed; -1 when it could not be opened
+    int64_t readCounter(int counter) {
+
+        if (counter < 0) {
+            return -1;
+        }
+
+        uint64_t value;
+        bool received = read(counter, &value, sizeof(value)) == sizeof(value);
+        close(counter);
+        return received ? int64_t(value) : -1;
+
+    }
+
+    // Runs binary once with its output written to outputFile. The child waits on a
+    // pipe until the counters are attached to it, and they start counting at its
+    // exec, so that they only count the kernel.
+    Status runOnce(const std::string& binary, const std::string& outputFile, Run& run) {
+
+        int output = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (output < 0) {
+            errs() << outputFile << ": " << strerror(errno) << "\n";
+            return Status::Failed;
+        }
+
+        int fds[2];
+        if (pipe(fds) != 0) {
+            close(output);
+            return Status::Failed;
+        }
+
+        pid_t child = fork();
+        if (child < 0) {
+            close(output);
+            close(fds[0]);
+            close(fds[1]);
+            return Status::Failed;
+        }
+
+        if (child == 0) {
+            close(fds[1]);
+            char start;
+            if (read(fds[0], &start, 1) != 1) {
+                _exit(127);
+            }
+            close(fds[0]);
+            dup2(output, STDOUT_FILENO);
+            close(output);
+            // The alarm is kept across exec
+            alarm(Timeout);
+            execl(binary.c_str(), binary.c_str(), (char *) nullptr);
+            _exit(127);
+        }
+
+        close(fds[0]);
+        close(output);
+
+        int cycles = -1;
+        int instructions = -1;
+#ifdef __linux__
+        if (PerfCounters) {
+            cycles = openCounter(child, PERF_COUNT_HW_CPU_CYCLES);
+            instructions = openCounter(child, PERF_COUNT_HW_INSTRUCTIONS);
+        }
+#endif
+
+        auto start = std::chrono::steady_clock::now();
+        bool started = write(fds[1], "x", 1) == 1;
+        close(fds[1]);
+
+        int status;
+        waitpid(child, &status, 0);
+        run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        run.cycles = readCounter(cycles);
+        run.instructions = readCounter(instructions);
+
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) {
+            return Status::Timeout;
+        }
+        if (!started || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            errs() << binary << ": " << (WIFSIGNALED(status)
+                ? std::string("killed by signal ") + strsignal(WTERMSIG(status))
+                : "exited with " + std::to_string(WEXITSTATUS(status))) << "\n";
+            return Status::Failed;
+        }
+        return Status::OK;
+
+    }
+
+    // The fastest of -repeat runs of each binary. The runs alternate between the two,
+    // so that both see the same state of the machine (frequency scaling, other processes).
+    Status measure(const std::string binaries[2], const std::string outputFiles[2], Run* best[2]) {
+
+        for (unsigned i = 0; i < std::max(Repeat.getValue(), 1u); i++) {
+            for (unsigned j = 0; j < 2; j++) {
+
+                Run run;
+                Status status = runOnce(binaries[j], outputFiles[j], run);
+                if (status != Status::OK) {
+                    return status;
+                }
+
+                if (i == 0 || run.seconds < best[j]->seconds) {
+                    *best[j] = run;
+                }
+            }
+        }
+
+        return Status::OK;
+
+    }
+
+    bool sameOutput(const std::string& a, const std::string& b) {
+
+        ErrorOr<std::unique_ptr<MemoryBuffer>> first = MemoryBuffer::getFile(a);
+        ErrorOr<std::unique_ptr<MemoryBuffer>> second = MemoryBuffer::getFile(b);
+
+        return first && second && (*first)->getBuffer() == (*second)->getBuffer();
+
+    }
+
+    Result benchmark(StringRef input) {
+
+        std::string kernel = sys::path::stem(input).str();
+        Result result = {kernel, Status::Failed, {}, {}};
+
+        // C kernels are compiled as run.sh does, with the functions left optimizable
+        std::string ir = input.str();
+        if (sys::path::extension(input) == ".c") {
+            ir = getPath(kernel + ".ll");
+            if (!runClang({"-S", "-emit-llvm", "-O0", "-Xclang", "-disable-O0-optnone", input, "-o", ir})) {
+                return result;
+            }
+        }
+
+        std::string baselineIR = getPath(kernel + ".baseline.ll");
+        std::string optimizedIR = getPath(kernel + ".opt.ll");
+
+        if (!optimize(ir, "", baselineIR, result.baseline.staticInstructions) ||
+            !optimize(ir, PassPipeline, optimizedIR, result.optimized.staticInstructions)) {
+            return result;
+        }
+
+        std::string binaries[2] = {getPath(kernel + ".baseline"), getPath(kernel + ".opt")};
+        std::string outputs[2] = {binaries[0] + ".out", binaries[1] + ".out"};
+
+        if (!runClang({"-O0", baselineIR, "-o", binaries[0]}) ||
+            !runClang({"-O0", optimizedIR, "-o", binaries[1]})) {
+            return result;
+        }
+
+        Run* best[2] = {&result.baseline.best, &result.optimized.best};
+        result.status = measure(binaries, outputs, best);
+        if (result.status != Status::OK) {
+            return result;
+        }
+
+        if (!sameOutput(outputs[0], outputs[1])) {
+            errs() << kernel << ": the output of " << binaries[1] << " differs from "
+                << binaries[0] << "\n";
+            result.status = Status::Mismatch;
+        }
+
+        return result;
+
+    }
+
+    double getSpeedup(const Result& result) {
+        return result.baseline.best.seconds / result.optimized.best.seconds;
+    }
+
+    // Ratio of a counter of the baseline to the optimized binary, 0 when unknown
+    double getRatio(int64_t baseline, int64_t optimized) {
+        return baseline > 0 && optimized > 0 ? double(baseline) / double(optimized) : 0;
+    }
+
+    // Geometric mean of the speedups of the kernels which ran, 0 when none did
+    double getMeanSpeedup(const std::vector<Result>& results) {
+
+        double logarithms = 0;
+        unsigned count = 0;
+
+        for (const Result& result: results) {
+            if (result.status == Status::OK) {
+                logarithms += std::log(getSpeedup(result));
+                count++;
+            }
+        }
+
+        return count ? std::exp(logarithms / count) : 0;
+
+    }
+
+    void writeJSON(raw_ostream& OS, const std::vector<Result>& results) {
+
+        json::OStream J(OS, 2);
+
+        J.object([&] {
+            J.attribute("version", customopt::version);
+            J.attribute("baseline", BaselinePipeline);
+            J.attribute("passes", PassPipeline);
+            J.attribute("repeat", int64_t(Repeat));
+            J.attribute("triple", sys::getDefaultTargetTriple());
+            J.attribute("mean_speedup", getMeanSpeedup(results));
+
+            J.attributeArray("results", [&] {
+                for (const Result& result: results) {
+                    J.object([&] {
+                        J.attribute("kernel", result.kernel);
+                        J.attribute("status", getStatusName(result.status));
+                        J.attribute("instructions_before", int64_t(result.baseline.staticInstructions));
+                        J.attribute("instructions_after", int64_t(result.optimized.staticInstructions));
+                        J.attribute("instructions_removed", int64_t(result.baseline.staticInstructions)
+                            - int64_t(result.optimized.staticInstructions));
+                        if (result.status != Status::OK) {
+                            return;
+                        }
+                        J.attribute("baseline_seconds", result.baseline.best.seconds);
+                        J.attribute("optimized_seconds", result.optimized.best.seconds);
+                        J.attribute("speedup", getSpeedup(result));
+                        if (result.baseline.best.cycles >= 0 && result.optimized.best.cycles >= 0) {
+                            J.attribute("baseline_cycles", result.baseline.best.cycles);
+                            J.attribute("optimized_cycles", result.optimized.best.cycles);
+                        }
+                        if (result.baseline.best.instructions >= 0 && result.optimized.best.instructions >= 0) {
+                            J.attribute("baseline_instructions", result.baseline.best.instructions);
+                            J.attribute("optimized_instructions", result.optimized.best.instructions);
+                        }
+                    });
+                }
+            });
+        });
+
+        OS << "\n";
+
+    }
+
+    void writeCSV(raw_ostream& OS, const std::vector<Result>& results) {
+
+        OS << "kernel,status,instructions_before,instructions_after,instructions_removed,"
+            "baseline_seconds,optimized_seconds,speedup,baseline_cycles,optimized_cycles,"
+            "baseline_instructions,optimized_instructions\n";
+
+        // Empty fields for what was not measured
+        auto counter = [&](int64_t value) {
+            OS << ",";
+            if (value >= 0) {
+                OS << value;
+            }
+        };
+
+        for (const Result& result: results) {
+
+            OS << result.kernel << "," << getStatusName(result.status) << ","
+                << result.baseline.staticInstructions << "," << result.optimized.staticInstructions << ","
+                << int64_t(result.baseline.staticInstructions) - int64_t(result.optimized.staticInstructions);
+
+            if (result.status == Status::OK) {
+                const Run& baseline = result.baseline.best;
+                const Run& optimized = result.optimized.best;
+                OS << "," << format("%.6f", baseline.seconds) << "," << format("%.6f", optimized.seconds)
+                    << "," << format("%.4f", getSpeedup(result));
+                counter(baseline.cycles);
+                counter(optimized.cycles);
+                counter(baseline.instructions);
+                counter(optimized.instructions);
+            }
+            else {
+                OS << ",,,,,,,";
+            }
+            OS << "\n";
+        }
+
+    }
+}
+
+int main(int argc, char** argv) {
+
+    InitLLVM X(argc, argv);
+
+    InitializeNativeTarget();
+
+    cl::ParseCommandLineOptions(argc, argv, "runtime benchmark of the custom optimization passes\n");
+
+    ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+
+    // Check the pipelines before the first kernel is compiled
+    {
+        PassBuilder PB;
+        customopt::registerPasses(PB);
+        ModulePassManager MPM;
+        if (!BaselinePipeline.empty()) {
+            ExitOnErr(PB.parsePassPipeline(MPM, BaselinePipeline));
+        }
+        ExitOnErr(PB.parsePassPipeline(MPM, PassPipeline));
+    }
+
+    if (sys::path::filename(ClangPath) == ClangPath) {
+        ErrorOr<std::string> path = sys::findProgramByName(ClangPath);
+        if (!path) {
+            errs() << "error: " << ClangPath << " not found, set its path with -clang\n";
+            return 1;
+        }
+        ClangPath = *path;
+    }
+
+    if (WorkDirectory.empty()) {
+        SmallString<128> path;
+        if (std::error_code error = sys::fs::createUniqueDirectory("customopt-runbench", path)) {
+            errs() << "error: no temporary directory: " << error.message() << "\n";
+            return 1;
+        }
+        WorkDirectory = path.str().str();
+    }
+    else if (std::error_code error = sys::fs::create_directories(WorkDirectory)) {
+        errs() << WorkDirectory << ": " << error.message() << "\n";
+        return 1;
+    }
+
+    // Kernels with the same name would overwrite each other's files
+    StringSet<> kernels;
+    for (const std::string& input: InputFilenames) {
+        if (!kernels.insert(sys::path::stem(input)).second) {
+            errs() << "error: more than one kernel is named " << sys::path::stem(input) << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    bool failed = false;
+    bool countersMissing = false;
+
+    for (const std::string& input: InputFilenames) {
+
+        Result result = benchmark(input);
+        failed |= result.status != Status::OK;
+
+        // Progress, as every kernel runs 2 * -repeat times
+        errs() << format("%-12s %6lu -> %6lu instructions ", result.kernel.c_str(),
+            (unsigned long) result.baseline.staticInstructions,
+            (unsigned long) result.optimized.staticInstructions);
+        if (result.status == Status::OK) {
+            const Run& baseline = result.baseline.best;
+            const Run& optimized = result.optimized.best;
+            errs() << format("%9.4fs -> %9.4fs %6.3fx", baseline.seconds, optimized.seconds, getSpeedup(result));
+            countersMissing |= PerfCounters && (baseline.cycles < 0 || baseline.instructions < 0);
+            if (double cycles = getRatio(baseline.cycles, optimized.cycles)) {
+                errs() << format("  cycles %6.3fx", cycles);
+            }
+            if (double instructions = getRatio(baseline.instructions, optimized.instructions)) {
+                errs() << format("  instructions %6.3fx", instructions);
+            }
+            errs() << "\n";
+        }
+        else {
+            errs() << getStatusName(result.status) << "\n";
+        }
+
+        results.push_back(result);
+    }
+
+    if (double speedup = getMeanSpeedup(results)) {
+        errs() << format("Geometric mean speedup: %.3fx\n", speedup);
+    }
+    if (countersMissing) {
+        errs() << "warning: the performance counters are not available "
+            "(no PMU, or perf_event_paranoid above 2)\n";
+    }
+    errs() << "The IR, binaries and outputs are in " << WorkDirectory << "\n";
+
+    std::error_code error;
+    ToolOutputFile out(OutputFilename, error, sys::fs::OF_TextWithCRLF);
+    if (error) {
+        errs() << OutputFilename << ": " << error.message() << "\n";
+        return 1;
+    }
+
+    if (Format == OutputFormat::JSON) {
+        writeJSON(out.os(), results);
+    }
+    else {
+        writeCSV(out.os(), results);
+    }
+    out.keep();
+
+    return failed ? 1 : 0;
+
+}
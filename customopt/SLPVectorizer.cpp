@@ -0,0 +1,815 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopAccessAnalysis.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include <algorithm>
+
+#include "CustomOpt.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "slp"
+
+STATISTIC(NumTreesVectorized, "Number of trees of isomorphic scalars vectorized");
+STATISTIC(NumStoresVectorized, "Number of scalar stores replaced with vector stores");
+STATISTIC(NumGathers, "Number of vectors built from scalars for a vectorized tree");
+
+static cl::opt<int> CostThreshold("slp-cost-threshold", cl::init(0),
+    cl::desc("Vectorize a tree with -slp only when its vector cost is lower than its "
+             "scalar cost minus this value"));
+
+static cl::opt<unsigned> MaxTreeDepth("slp-max-depth", cl::init(8),
+    cl::desc("Maximum depth of the trees of operations -slp vectorizes under a store"));
+
+namespace {
+
+    enum NodeKind { Operation, Load, Gather };
+
+    // A bundle of scalars, one per lane, and how the vector of them is computed: with
+    // the vector form of their operation, with a vector load, or by inserting the
+    // scalars into a vector (gathering them) when they have nothing in common
+    struct Node {
+        NodeKind kind;
+        std::vector<Value *> scalars;
+
+        // Operation: the nodes of the two operands
+        std::vector<unsigned> operands;
+
+        // Load: the load of the lowest address, and for each lane the element of the
+        // vector load it reads (empty when lane i reads element i)
+        LoadInst* first = nullptr;
+        SmallVector<int, 8> mask;
+
+        // The vector, once emitted
+        Value* vector = nullptr;
+    };
+
+    struct SLPVectorizer {
+
+        ScalarEvolution& SE;
+        AAResults& AA;
+        const TargetTransformInfo& TTI;
+        OptimizationRemarkEmitter& ORE;
+        const DataLayout& DL;
+
+        // The tree being vectorized: tree[0] is the values of the stores at its root
+        std::vector<Node> tree;
+
+        // The Operation or Load node of each scalar of the tree
+        DenseMap<Value *, unsigned> scalarToNode;
+
+        // The block of the stores; only instructions of this block are vectorized
+        BasicBlock* block = nullptr;
+
+        SLPVectorizer(ScalarEvolution& SE, AAResults& AA, const TargetTransformInfo& TTI,
+            OptimizationRemarkEmitter& ORE, const DataLayout& DL)
+            : SE(SE), AA(AA), TTI(TTI), ORE(ORE), DL(DL) {}
+
+        bool run(Function& function) {
+
+            bool changed = false;
+
+            LLVM_DEBUG(dbgs() << "Starting SLP Vectorization pass "
+                "for function: '" << function.getName() << "':\n");
+
+            for (BasicBlock& bb: function) {
+                changed |= processBlock(bb);
+            }
+
+            LLVM_DEBUG(dbgs() << "SLP Vectorization pass complete!\n\n");
+
+            return changed;
+
+        }
+
+        // Integer and floating point scalars which are laid out back to back in a vector
+        bool isVectorizableType(Type* type) {
+
+            if (!type->isIntegerTy() && !type->isFloatingPointTy()) {
+                return false;
+            }
+
+            return DL.getTypeSizeInBits(type) == DL.getTypeAllocSizeInBits(type);
+
+        }
+
+        bool processBlock(BasicBlock& bb) {
+
+            // Stores by type and underlying object, in program order
+            MapVector<std::pair<Type *, Value *>, std::vector<StoreInst *>> groups;
+
+            for (Instruction& instruction: bb) {
+
+                StoreInst* store = dyn_cast<StoreInst>(&instruction);
+                if (!store || !store->isSimple() || !isVectorizableType(store->getValueOperand()->getType())) {
+                    continue;
+                }
+
+                Value* object = getUnderlyingObject(store->getPointerOperand());
+                groups[{store->getValueOperand()->getType(), object}].push_back(store);
+            }
+
+            bool changed = false;
+
+            for (auto& group: groups) {
+
+                Type* type = group.first.first;
+                std::vector<StoreInst *>& stores = group.second;
+                if (stores.size() < 2) {
+                    continue;
+                }
+
+                // Offset of each store from the first one, in elements, when SCEV can tell
+                std::vector<std::pair<int, StoreInst *>> sorted;
+                for (StoreInst* store: stores) {
+                    Optional<int> offset = getPointersDiff(type, stores[0]->getPointerOperand(), type,
+                        store->getPointerOperand(), DL, SE, true);
+                    if (offset) {
+                        sorted.push_back({*offset, store});
+                    }
+                }
+
+                std::stable_sort(sorted.begin(), sorted.end(),
+                    [](const std::pair<int, StoreInst *>& a, const std::pair<int, StoreInst *>& b) {
+                        return a.first < b.first;
+                    });
+
+                // Runs of stores to consecutive elements
+                size_t begin = 0;
+                for (size_t i = 1; i <= sorted.size(); i++) {
+
+                    if (i < sorted.size() && sorted[i].first == sorted[i - 1].first + 1) {
+                        continue;
+                    }
+
+                    std::vector<StoreInst *> run;
+                    for (size_t j = begin; j < i; j++) {
+                        run.push_back(sorted[j].second);
+                    }
+                    changed |= vectorizeRun(run, type);
+
+                    begin = i;
+                }
+            }
+
+            return changed;
+
+        }
+
+        // Vectorize the run of consecutive stores in slices as wide as a vector register,
+        // then narrower ones where the wide slices are not profitable
+        bool vectorizeRun(ArrayRef<StoreInst *> stores, Type* type) {
+
+            unsigned registerBits = TTI.getRegisterBitWidth(TargetTransformInfo::RGK_FixedWidthVector).getFixedSize();
+            unsigned maxVF = registerBits / DL.getTypeSizeInBits(type);
+
+            bool changed = false;
+            size_t i = 0;
+
+            while (i + 1 < stores.size()) {
+
+                unsigned VF = PowerOf2Floor(std::min<uint64_t>(maxVF, stores.size() - i));
+                for (; VF >= 2; VF /= 2) {
+                    if (vectorizeStores(stores.slice(i, VF))) {
+                        break;
+                    }
+                }
+
+                if (VF >= 2) {
+                    changed = true;
+                    i += VF;
+                }
+                else {
+                    i++;
+                }
+            }
+
+            return changed;
+
+        }
+
+        unsigned addNode(NodeKind kind, ArrayRef<Value *> scalars) {
+
+            unsigned index = tree.size();
+
+            tree.emplace_back();
+            tree.back().kind = kind;
+            tree.back().scalars.assign(scalars.begin(), scalars.end());
+
+            if (kind != Gather) {
+                for (Value* scalar: scalars) {
+                    scalarToNode[scalar] = index;
+                }
+            }
+
+            return index;
+
+        }
+
+        // Instructions of the block, all different, with the same opcode and type, which
+        // are simple loads or an operation with a vector form, and not yet in the tree
+        bool isIsomorphic(ArrayRef<Value *> scalars) {
+
+            Instruction* first = dyn_cast<Instruction>(scalars[0]);
+            if (!first) {
+                return false;
+            }
+
+            switch (first->getOpcode()) {
+                case Instruction::Add:
+                case Instruction::Sub:
+                case Instruction::Mul:
+                case Instruction::Shl:
+                case Instruction::LShr:
+                case Instruction::AShr:
+                case Instruction::And:
+                case Instruction::Or:
+                case Instruction::Xor:
+                case Instruction::FAdd:
+                case Instruction::FSub:
+                case Instruction::FMul:
+                    break;
+                case Instruction::Load:
+                    break;
+                default:
+                    return false;
+            }
+
+            SmallPtrSet<Value *, 8> seen;
+
+            for (Value* scalar: scalars) {
+
+                Instruction* ins = dyn_cast<Instruction>(scalar);
+                if (!ins || ins->getParent() != block || ins->getOpcode() != first->getOpcode() ||
+                    ins->getType() != first->getType() || scalarToNode.count(ins) || !seen.insert(ins).second) {
+                    return false;
+                }
+
+                LoadInst* load = dyn_cast<LoadInst>(ins);
+                if (load && !load->isSimple()) {
+                    return false;
+                }
+            }
+
+            return true;
+
+        }
+
+        unsigned buildNode(ArrayRef<Value *> scalars, unsigned depth) {
+
+            // A bundle already in the tree, as the operand of two nodes, is shared
+            auto found = scalarToNode.find(scalars[0]);
+            if (found != scalarToNode.end() && ArrayRef<Value *>(tree[found->second].scalars) == scalars) {
+                return found->second;
+            }
+
+            if (depth > MaxTreeDepth || !isIsomorphic(scalars)) {
+                return addNode(Gather, scalars);
+            }
+
+            if (isa<LoadInst>(scalars[0])) {
+                return buildLoadNode(scalars);
+            }
+
+            unsigned index = addNode(Operation, scalars);
+
+            std::vector<Value *> left, right;
+            getOperands(scalars, left, right);
+
+            unsigned leftNode = buildNode(left, depth + 1);
+            unsigned rightNode = buildNode(right, depth + 1);
+
+            tree[index].operands = { leftNode, rightNode };
+            return index;
+
+        }
+
+        // Loads of the elements of one vector, in any order
+        unsigned buildLoadNode(ArrayRef<Value *> scalars) {
+
+            Type* type = scalars[0]->getType();
+            Value* pointer = cast<LoadInst>(scalars[0])->getPointerOperand();
+
+            std::vector<int> offsets;
+            for (Value* scalar: scalars) {
+                Optional<int> offset = getPointersDiff(type, pointer, type,
+                    cast<LoadInst>(scalar)->getPointerOperand(), DL, SE, true);
+                if (!offset) {
+                    return addNode(Gather, scalars);
+                }
+                offsets.push_back(*offset);
+            }
+
+            int lowest = *std::min_element(offsets.begin(), offsets.end());
+
+            SmallVector<int, 8> mask;
+            SmallVector<bool, 8> used(scalars.size(), false);
+            LoadInst* first = nullptr;
+
+            for (size_t lane = 0; lane < scalars.size(); lane++) {
+
+                int element = offsets[lane] - lowest;
+                if (element >= int(scalars.size()) || used[element]) {
+                    return addNode(Gather, scalars);
+                }
+
+                used[element] = true;
+                mask.push_back(element);
+
+                if (element == 0) {
+                    first = cast<LoadInst>(scalars[lane]);
+                }
+            }
+
+            unsigned index = addNode(Load, scalars);
+            tree[index].first = first;
+
+            if (!ShuffleVectorInst::isIdentityMask(mask)) {
+                tree[index].mask = mask;
+            }
+
+            return index;
+
+        }
+
+        // Operands of the same kind: the same value, two instructions with the same
+        // opcode, two constants, or two arguments
+        bool isSameKind(Value* a, Value* b) {
+
+            if (a == b || (isa<Argument>(a) && isa<Argument>(b))) {
+                return true;
+            }
+
+            if (isa<Constant>(a) || isa<Constant>(b)) {
+                return isa<Constant>(a) && isa<Constant>(b);
+            }
+
+            Instruction* insA = dyn_cast<Instruction>(a);
+            Instruction* insB = dyn_cast<Instruction>(b);
+            return insA && insB && insA->getOpcode() == insB->getOpcode();
+
+        }
+
+        // The operands of each lane; the operands of commutative operations are swapped
+        // where that makes them match those of the first lane
+        void getOperands(ArrayRef<Value *> scalars, std::vector<Value *>& left, std::vector<Value *>& right) {
+
+            for (Value* scalar: scalars) {
+
+                Instruction* ins = cast<Instruction>(scalar);
+                Value* a = ins->getOperand(0);
+                Value* b = ins->getOperand(1);
+
+                if (!left.empty() && ins->isCommutative() &&
+                    !isSameKind(a, left[0]) && isSameKind(b, left[0]) && isSameKind(a, right[0])) {
+                    std::swap(a, b);
+                }
+
+                left.push_back(a);
+                right.push_back(b);
+            }
+
+        }
+
+        // The vector code runs where the last store was: the stores move down to it,
+        // and the loads of the tree too. Nothing in between may read or write the memory
+        // of a store, or write the memory of a load.
+        bool isSafeToMove(ArrayRef<StoreInst *> stores, StoreInst* last) {
+
+            SmallPtrSet<Instruction *, 8> bundle(stores.begin(), stores.end());
+
+            auto conflicts = [&](Instruction* from, const MemoryLocation& location, bool writesOnly) {
+
+                for (Instruction* ins = from->getNextNode(); ins != last; ins = ins->getNextNode()) {
+
+                    if (bundle.count(ins) || !ins->mayReadOrWriteMemory()) {
+                        continue;
+                    }
+
+                    ModRefInfo info = AA.getModRefInfo(ins, location);
+                    if (writesOnly ? isModSet(info) : isModOrRefSet(info)) {
+                        LLVM_DEBUG(dbgs() << "Not vectorizing across " << *ins << "\n");
+                        return true;
+                    }
+                }
+
+                return false;
+            };
+
+            for (StoreInst* store: stores) {
+                if (store != last && conflicts(store, MemoryLocation::get(store), false)) {
+                    return false;
+                }
+            }
+
+            for (Node& node: tree) {
+
+                if (node.kind != Load) {
+                    continue;
+                }
+
+                for (Value* scalar: node.scalars) {
+                    LoadInst* load = cast<LoadInst>(scalar);
+                    if (conflicts(load, MemoryLocation::get(load), true)) {
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+
+        }
+
+        // Scalars which stay after vectorization: those used outside the tree, or by a
+        // gathered vector, and the scalars they use
+        void getKeptScalars(ArrayRef<StoreInst *> stores, SmallPtrSetImpl<Value *>& kept) {
+
+            SmallPtrSet<Instruction *, 8> bundle(stores.begin(), stores.end());
+            std::vector<Value *> worklist;
+
+            for (Node& node: tree) {
+                for (Value* scalar: node.scalars) {
+
+                    if (!scalarToNode.count(scalar)) {
+                        continue;
+                    }
+
+                    if (node.kind == Gather) {
+                        worklist.push_back(scalar);
+                        continue;
+                    }
+
+                    for (User* user: scalar->users()) {
+
+                        Instruction* ins = cast<Instruction>(user);
+                        auto found = scalarToNode.find(ins);
+                        bool internal = bundle.count(ins) ||
+                            (found != scalarToNode.end() && tree[found->second].kind == Operation);
+
+                        if (!internal) {
+                            worklist.push_back(scalar);
+                            break;
+                        }
+                    }
+                }
+            }
+
+            while (!worklist.empty()) {
+
+                Value* scalar = worklist.back();
+                worklist.pop_back();
+
+                if (!kept.insert(scalar).second) {
+                    continue;
+                }
+
+                for (Value* operand: cast<Instruction>(scalar)->operands()) {
+                    if (scalarToNode.count(operand)) {
+                        worklist.push_back(operand);
+                    }
+                }
+            }
+
+        }
+
+        // Cost of the vector code minus the cost of the scalar code it replaces
+        InstructionCost getCost(ArrayRef<StoreInst *> stores, FixedVectorType* vectorType) {
+
+            TargetTransformInfo::TargetCostKind costKind = TargetTransformInfo::TCK_RecipThroughput;
+            Type* scalarType = vectorType->getElementType();
+            unsigned addressSpace = stores[0]->getPointerAddressSpace();
+
+            SmallPtrSet<Value *, 16> kept;
+            getKeptScalars(stores, kept);
+
+            InstructionCost vectorCost = TTI.getMemoryOpCost(Instruction::Store, vectorType,
+                stores[0]->getAlign(), addressSpace, costKind);
+            InstructionCost scalarCost = 0;
+
+            for (StoreInst* store: stores) {
+                scalarCost += TTI.getMemoryOpCost(Instruction::Store, scalarType, store->getAlign(),
+                    addressSpace, costKind);
+            }
+
+            for (Node& node: tree) {
+
+                if (node.kind == Gather) {
+                    vectorCost += getGatherCost(node, vectorType);
+                    continue;
+                }
+
+                Instruction* first = cast<Instruction>(node.scalars[0]);
+                InstructionCost laneCost;
+
+                if (node.kind == Load) {
+
+                    LoadInst* load = cast<LoadInst>(first);
+                    vectorCost += TTI.getMemoryOpCost(Instruction::Load, vectorType, node.first->getAlign(),
+                        load->getPointerAddressSpace(), costKind);
+                    if (!node.mask.empty()) {
+                        vectorCost += TTI.getShuffleCost(TargetTransformInfo::SK_PermuteSingleSrc, vectorType,
+                            node.mask);
+                    }
+                    laneCost = TTI.getMemoryOpCost(Instruction::Load, scalarType, load->getAlign(),
+                        load->getPointerAddressSpace(), costKind);
+                }
+                else {
+
+                    // Shifts and multiplies by constants are cheaper; SRCF turns them
+                    // into shifts and adds
+                    const Node& right = tree[node.operands[1]];
+                    TargetTransformInfo::OperandValueKind rightKind = TargetTransformInfo::OK_AnyValue;
+                    if (right.kind == Gather && all_of(right.scalars, [](Value* v) { return isa<Constant>(v); })) {
+                        rightKind = is_splat(right.scalars) ? TargetTransformInfo::OK_UniformConstantValue :
+                            TargetTransformInfo::OK_NonUniformConstantValue;
+                    }
+
+                    vectorCost += TTI.getArithmeticInstrCost(first->getOpcode(), vectorType, costKind,
+                        TargetTransformInfo::OK_AnyValue, rightKind);
+                    laneCost = TTI.getArithmeticInstrCost(first->getOpcode(), scalarType, costKind,
+                        TargetTransformInfo::OK_AnyValue, rightKind == TargetTransformInfo::OK_AnyValue ?
+                        TargetTransformInfo::OK_AnyValue : TargetTransformInfo::OK_UniformConstantValue);
+                }
+
+                // Kept scalars still run, so they save nothing
+                for (Value* scalar: node.scalars) {
+                    if (!kept.count(scalar)) {
+                        scalarCost += laneCost;
+                    }
+                }
+            }
+
+            return vectorCost - scalarCost;
+
+        }
+
+        // Constants are free, one value repeated is a broadcast, anything else is
+        // inserted lane by lane
+        InstructionCost getGatherCost(const Node& node, FixedVectorType* vectorType) {
+
+            if (all_of(node.scalars, [](Value* v) { return isa<Constant>(v); })) {
+                return 0;
+            }
+
+            if (is_splat(node.scalars)) {
+                return TTI.getVectorInstrCost(Instruction::InsertElement, vectorType, 0) +
+                    TTI.getShuffleCost(TargetTransformInfo::SK_Broadcast, vectorType);
+            }
+
+            InstructionCost cost = 0;
+            for (unsigned lane = 0; lane < node.scalars.size(); lane++) {
+                if (!isa<Constant>(node.scalars[lane])) {
+                    cost += TTI.getVectorInstrCost(Instruction::InsertElement, vectorType, lane);
+                }
+            }
+            return cost;
+
+        }
+
+        // stores are consecutive, lowest address first
+        bool vectorizeStores(ArrayRef<StoreInst *> stores) {
+
+            tree.clear();
+            scalarToNode.clear();
+            block = stores[0]->getParent();
+
+            StoreInst* last = stores[0];
+            std::vector<Value *> values;
+
+            for (StoreInst* store: stores) {
+                values.push_back(store->getValueOperand());
+                if (last->comesBefore(store)) {
+                    last = store;
+                }
+            }
+
+            buildNode(values, 0);
+
+            if (!isSafeToMove(stores, last)) {
+                return false;
+            }
+
+            FixedVectorType* vectorType = FixedVectorType::get(values[0]->getType(), stores.size());
+
+            InstructionCost cost = getCost(stores, vectorType);
+            if (!cost.isValid() || cost >= -CostThreshold) {
+                LLVM_DEBUG(dbgs() << "Not vectorizing " << stores.size() << " stores from " << *stores[0]
+                    << ": cost " << cost << "\n");
+                return false;
+            }
+
+            NumTreesVectorized++;
+            NumStoresVectorized += stores.size();
+            LLVM_DEBUG(dbgs() << "Vectorizing " << stores.size() << " stores from " << *stores[0]
+                << " (" << tree.size() << " nodes): cost " << cost << "\n");
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "Vectorized", last)
+                    << "vectorized " << ore::NV("Stores", unsigned(stores.size())) << " stores of "
+                    << ore::NV("Type", values[0]->getType()) << " with "
+                    << ore::NV("Nodes", unsigned(tree.size())) << " nodes, saving "
+                    << ore::NV("Cost", -*cost.getValue());
+            });
+
+            IRBuilder<> builder(last);
+
+            Value* vector = emitNode(0, builder);
+            Value* pointer = builder.CreateBitCast(stores[0]->getPointerOperand(),
+                vectorType->getPointerTo(stores[0]->getPointerAddressSpace()));
+            builder.CreateAlignedStore(vector, pointer, stores[0]->getAlign());
+
+            for (StoreInst* store: stores) {
+                store->eraseFromParent();
+            }
+
+            deleteDeadScalars();
+
+            return true;
+
+        }
+
+        Value* emitNode(unsigned index, IRBuilder<>& builder) {
+
+            if (tree[index].vector) {
+                return tree[index].vector;
+            }
+
+            Value* vector;
+
+            if (tree[index].kind == Operation) {
+
+                Value* left = emitNode(tree[index].operands[0], builder);
+                Value* right = emitNode(tree[index].operands[1], builder);
+
+                Node& node = tree[index];
+                Instruction* first = cast<Instruction>(node.scalars[0]);
+
+                vector = builder.CreateBinOp(static_cast<Instruction::BinaryOps>(first->getOpcode()), left, right);
+
+                // The flags (nsw, nuw, exact, fast-math) which hold for every lane
+                if (Instruction* ins = dyn_cast<Instruction>(vector)) {
+                    ins->copyIRFlags(first);
+                    for (Value* scalar: node.scalars) {
+                        ins->andIRFlags(scalar);
+                    }
+                }
+            }
+            else if (tree[index].kind == Load) {
+
+                Node& node = tree[index];
+                Type* vectorType = FixedVectorType::get(node.first->getType(), node.scalars.size());
+
+                Value* pointer = builder.CreateBitCast(node.first->getPointerOperand(),
+                    vectorType->getPointerTo(node.first->getPointerAddressSpace()));
+                vector = builder.CreateAlignedLoad(vectorType, pointer, node.first->getAlign());
+
+                if (!node.mask.empty()) {
+                    vector = builder.CreateShuffleVector(vector, node.mask);
+                }
+            }
+            else {
+                vector = emitGather(tree[index], builder);
+            }
+
+            tree[index].vector = vector;
+            return vector;
+
+        }
+
+        Value* emitGather(const Node& node, IRBuilder<>& builder) {
+
+            unsigned lanes = node.scalars.size();
+
+            if (is_splat(node.scalars) && !isa<Constant>(node.scalars[0])) {
+                NumGathers++;
+                return builder.CreateVectorSplat(lanes, node.scalars[0]);
+            }
+
+            // Constants are in the initial vector, the other scalars are inserted
+            std::vector<Constant *> constants;
+            for (Value* scalar: node.scalars) {
+                Constant* constant = dyn_cast<Constant>(scalar);
+                constants.push_back(constant ? constant : PoisonValue::get(scalar->getType()));
+            }
+
+            Value* vector = ConstantVector::get(constants);
+
+            for (unsigned lane = 0; lane < lanes; lane++) {
+                if (!isa<Constant>(node.scalars[lane])) {
+                    vector = builder.CreateInsertElement(vector, node.scalars[lane], lane);
+                }
+            }
+
+            if (!isa<Constant>(vector)) {
+                NumGathers++;
+            }
+
+            return vector;
+
+        }
+
+        // The scalars of the tree no longer used once the stores are gone; those which
+        // are still used stay
+        void deleteDeadScalars() {
+
+            std::vector<Instruction *> candidates;
+            for (auto& entry: scalarToNode) {
+                candidates.push_back(cast<Instruction>(entry.first));
+            }
+
+            bool changed = true;
+            while (changed) {
+
+                changed = false;
+
+                for (Instruction*& ins: candidates) {
+                    if (ins && DCEPass::isTriviallyDead(ins)) {
+                        ins->eraseFromParent();
+                        ins = nullptr;
+                        changed = true;
+                    }
+                }
+            }
+
+        }
+    };
+}
+
+void customopt::SLPPass::printOptions(raw_ostream& OS) {
+
+    OS << "slp-cost-threshold=" << CostThreshold << "\n";
+    OS << "slp-max-depth=" << MaxTreeDepth << "\n";
+
+}
+
+bool customopt::SLPPass::runImpl(Function& function, ScalarEvolution& SE, AAResults& AA,
+    const TargetTransformInfo& TTI, OptimizationRemarkEmitter& ORE) {
+
+    // Without vector registers there is nothing to do
+    if (TTI.getRegisterBitWidth(TargetTransformInfo::RGK_FixedWidthVector).getFixedSize() == 0) {
+        return false;
+    }
+
+    SLPVectorizer slp(SE, AA, TTI, ORE, function.getParent()->getDataLayout());
+    return slp.run(function);
+
+}
+
+PreservedAnalyses customopt::SLPPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    if (!runImpl(function, FAM.getResult<ScalarEvolutionAnalysis>(function), FAM.getResult<AAManager>(function),
+        FAM.getResult<TargetIRAnalysis>(function), FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+
+}
+
+namespace {
+    struct SLPLegacyPass : public FunctionPass {
+        static char ID;
+        SLPLegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.setPreservesCFG();
+            AU.addRequired<ScalarEvolutionWrapperPass>();
+            AU.addRequired<AAResultsWrapperPass>();
+            AU.addRequired<TargetTransformInfoWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            ScalarEvolution& SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+            AAResults& AA = getAnalysis<AAResultsWrapperPass>().getAAResults();
+            const TargetTransformInfo& TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(function);
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::SLPPass::runImpl(function, SE, AA, TTI, ORE);
+        }
+    };
+}
+
+char SLPLegacyPass::ID = 0;
+
+static RegisterPass<SLPLegacyPass> X("slp", "SLP Vectorization", false, false);
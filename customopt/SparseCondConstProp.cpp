@@ -0,0 +1,596 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "sccprop"
+
+STATISTIC(NumConstantInstructions, "Number of instructions replaced with a constant");
+STATISTIC(NumConstantBranches, "Number of conditional branches and switches made unconditional");
+STATISTIC(NumUnreachableBlocks, "Number of unreachable blocks deleted");
+
+namespace {
+
+    // Value of an SSA value in the lattice: unknown until an executable definition
+    // is seen, then a constant, then overdefined. A value only moves down.
+    struct LatticeValue {
+        enum State { Unknown, Const, Overdefined };
+
+        State state = Unknown;
+        Constant* constant = nullptr;
+
+        bool isUnknown() const { return state == Unknown; }
+        bool isConstant() const { return state == Const; }
+        bool isOverdefined() const { return state == Overdefined; }
+    };
+
+    struct SparseConditionalConstantPropagation {
+
+        OptimizationRemarkEmitter& ORE;
+        const DataLayout& DL;
+
+        DenseMap<Value *, LatticeValue> values;
+
+        SmallPtrSet<BasicBlock *, 32> executableBlocks;
+        DenseSet<std::pair<BasicBlock *, BasicBlock *>> executableEdges;
+
+        // Blocks which became executable, and instructions whose operands changed
+        std::vector<BasicBlock *> blockWorklist;
+        std::vector<Instruction *> instructionWorklist;
+
+        // Set when branches were folded or blocks deleted
+        bool cfgChanged = false;
+
+        SparseConditionalConstantPropagation(OptimizationRemarkEmitter& ORE, const DataLayout& DL)
+            : ORE(ORE), DL(DL) {}
+
+        bool run(Function& function) {
+
+            LLVM_DEBUG(dbgs() << "Starting Sparse Conditional Constant Propagation pass "
+                "for function: '" << function.getName() << "':\n");
+
+            markBlockExecutable(&function.getEntryBlock());
+
+            // A condition can stay unknown when it only depends on values which
+            // never got an executable definition. Such branches may go either way.
+            do {
+                solve();
+            } while (resolveUnknownConditions(function));
+
+            bool changed = rewrite(function);
+
+            LLVM_DEBUG(dbgs() << "Sparse Conditional Constant Propagation pass complete!\n\n");
+
+            return changed;
+
+        }
+
+        // Arguments and globals are constants or overdefined from the start
+        LatticeValue getValue(Value* value) {
+
+            if (Constant* constant = dyn_cast<Constant>(value)) {
+
+                LatticeValue result;
+
+                // Undef could be folded to different values at different uses,
+                // so it is not propagated
+                if (isa<UndefValue>(constant) || constant->containsUndefOrPoisonElement()) {
+                    result.state = LatticeValue::Overdefined;
+                }
+                else {
+                    result.state = LatticeValue::Const;
+                    result.constant = constant;
+                }
+                return result;
+            }
+
+            if (!isa<Instruction>(value)) {
+                LatticeValue result;
+                result.state = LatticeValue::Overdefined;
+                return result;
+            }
+
+            return values.lookup(value);
+
+        }
+
+        // Move the value of ins down to result, and revisit its users if it changed
+        void update(Instruction* ins, LatticeValue result) {
+
+            if (result.isConstant() &&
+                (isa<UndefValue>(result.constant) || result.constant->containsUndefOrPoisonElement())) {
+                result.state = LatticeValue::Overdefined;
+                result.constant = nullptr;
+            }
+
+            LatticeValue& current = values[ins];
+
+            if (current.isOverdefined() || result.isUnknown()) {
+                return;
+            }
+            if (current.isConstant() && result.isConstant() && current.constant == result.constant) {
+                return;
+            }
+
+            // Two different constants merge to overdefined
+            if (current.isConstant() || result.isOverdefined()) {
+                current.state = LatticeValue::Overdefined;
+                current.constant = nullptr;
+            }
+            else {
+                current = result;
+            }
+
+            for (User* user: ins->users()) {
+                Instruction* userIns = cast<Instruction>(user);
+                if (executableBlocks.count(userIns->getParent())) {
+                    instructionWorklist.push_back(userIns);
+                }
+            }
+
+        }
+
+        void markOverdefined(Instruction* ins) {
+
+            LatticeValue overdefined;
+            overdefined.state = LatticeValue::Overdefined;
+            update(ins, overdefined);
+
+        }
+
+        void markBlockExecutable(BasicBlock* block) {
+
+            if (executableBlocks.insert(block).second) {
+                blockWorklist.push_back(block);
+            }
+
+        }
+
+        void markEdgeExecutable(BasicBlock* from, BasicBlock* to) {
+
+            if (!executableEdges.insert({from, to}).second) {
+                return;
+            }
+
+            if (executableBlocks.count(to)) {
+
+                // The phis of an already visited block have a new incoming value
+                for (PHINode& phi: to->phis()) {
+                    instructionWorklist.push_back(&phi);
+                }
+            }
+            else {
+                markBlockExecutable(to);
+            }
+
+        }
+
+        void solve() {
+
+            while (!blockWorklist.empty() || !instructionWorklist.empty()) {
+
+                while (!instructionWorklist.empty()) {
+                    Instruction* ins = instructionWorklist.back();
+                    instructionWorklist.pop_back();
+                    visit(ins);
+                }
+
+                while (!blockWorklist.empty()) {
+                    BasicBlock* block = blockWorklist.back();
+                    blockWorklist.pop_back();
+                    for (Instruction& instruction: *block) {
+                        visit(&instruction);
+                    }
+                }
+            }
+
+        }
+
+        void visit(Instruction* ins) {
+
+            if (PHINode* phi = dyn_cast<PHINode>(ins)) {
+                visitPhi(phi);
+            }
+            else if (ins->isTerminator()) {
+                visitTerminator(ins);
+            }
+            else if (SelectInst* select = dyn_cast<SelectInst>(ins)) {
+                visitSelect(select);
+            }
+            else if (isa<BinaryOperator>(ins) || isa<UnaryOperator>(ins) || isa<CastInst>(ins) ||
+                isa<CmpInst>(ins) || isa<GetElementPtrInst>(ins) || isa<ExtractElementInst>(ins) ||
+                isa<InsertElementInst>(ins) || isa<ShuffleVectorInst>(ins) ||
+                isa<ExtractValueInst>(ins) || isa<InsertValueInst>(ins) || isa<FreezeInst>(ins)) {
+                visitOperation(ins);
+            }
+            else if (!ins->getType()->isVoidTy()) {
+
+                // Loads, calls, allocas...
+                markOverdefined(ins);
+            }
+
+        }
+
+        // The merge of the incoming values over the executable edges
+        void visitPhi(PHINode* phi) {
+
+            LatticeValue result;
+
+            for (unsigned i = 0; i < phi->getNumIncomingValues(); i++) {
+
+                if (!executableEdges.count({phi->getIncomingBlock(i), phi->getParent()})) {
+                    continue;
+                }
+
+                LatticeValue incoming = getValue(phi->getIncomingValue(i));
+
+                if (incoming.isUnknown()) {
+                    continue;
+                }
+                if (incoming.isOverdefined() ||
+                    (result.isConstant() && result.constant != incoming.constant)) {
+                    markOverdefined(phi);
+                    return;
+                }
+                result = incoming;
+            }
+
+            update(phi, result);
+
+        }
+
+        // Only the successors which the condition can select are executable
+        void visitTerminator(Instruction* terminator) {
+
+            BasicBlock* block = terminator->getParent();
+
+            if (BranchInst* branch = dyn_cast<BranchInst>(terminator)) {
+
+                if (branch->isConditional()) {
+
+                    LatticeValue condition = getValue(branch->getCondition());
+
+                    if (condition.isUnknown()) {
+                        return;
+                    }
+                    if (condition.isConstant()) {
+                        if (ConstantInt* value = dyn_cast<ConstantInt>(condition.constant)) {
+                            markEdgeExecutable(block, branch->getSuccessor(value->isZero() ? 1 : 0));
+                            return;
+                        }
+                    }
+                }
+            }
+            else if (SwitchInst* switchIns = dyn_cast<SwitchInst>(terminator)) {
+
+                LatticeValue condition = getValue(switchIns->getCondition());
+
+                if (condition.isUnknown()) {
+                    return;
+                }
+                if (condition.isConstant()) {
+                    if (ConstantInt* value = dyn_cast<ConstantInt>(condition.constant)) {
+                        markEdgeExecutable(block, switchIns->findCaseValue(value)->getCaseSuccessor());
+                        return;
+                    }
+                }
+            }
+
+            // Overdefined conditions, and every other terminator
+            for (BasicBlock* successor: successors(block)) {
+                markEdgeExecutable(block, successor);
+            }
+
+            if (!terminator->getType()->isVoidTy()) {
+                markOverdefined(terminator);
+            }
+
+        }
+
+        void visitSelect(SelectInst* select) {
+
+            LatticeValue condition = getValue(select->getCondition());
+
+            if (condition.isUnknown()) {
+                return;
+            }
+
+            if (condition.isConstant()) {
+                if (ConstantInt* value = dyn_cast<ConstantInt>(condition.constant)) {
+                    update(select, getValue(value->isZero() ? select->getFalseValue() : select->getTrueValue()));
+                    return;
+                }
+            }
+
+            // Either operand: a constant only when they are the same
+            LatticeValue trueValue = getValue(select->getTrueValue());
+            LatticeValue falseValue = getValue(select->getFalseValue());
+
+            if (trueValue.isConstant() && falseValue.isConstant() && trueValue.constant == falseValue.constant) {
+                update(select, trueValue);
+            }
+            else if (!trueValue.isUnknown() && !falseValue.isUnknown()) {
+                markOverdefined(select);
+            }
+
+        }
+
+        // Instructions without side effects, folded when all their operands are constants
+        void visitOperation(Instruction* ins) {
+
+            SmallVector<Constant *, 4> operands;
+
+            for (Value* operand: ins->operands()) {
+
+                LatticeValue value = getValue(operand);
+
+                if (value.isOverdefined()) {
+                    markOverdefined(ins);
+                    return;
+                }
+                if (value.isUnknown()) {
+                    return;
+                }
+                operands.push_back(value.constant);
+            }
+
+            LatticeValue result;
+            result.state = LatticeValue::Const;
+
+            // Integer and floating point arithmetic with the rules of SRCF, the rest
+            // with LLVM's folder
+            BinaryOperator* binary = dyn_cast<BinaryOperator>(ins);
+
+            if (binary && (binary->getType()->isIntOrIntVectorTy() || binary->getType()->isFPOrFPVectorTy())) {
+                result.constant = SRCFPass::foldBinaryOperator(binary, operands[0], operands[1]);
+            }
+            else if (CmpInst* cmp = dyn_cast<CmpInst>(ins)) {
+                result.constant = ConstantFoldCompareInstOperands(cmp->getPredicate(),
+                    operands[0], operands[1], DL);
+            }
+            else {
+                result.constant = ConstantFoldInstOperands(ins, operands, DL);
+            }
+
+            if (!result.constant) {
+                markOverdefined(ins);
+                return;
+            }
+
+            update(ins, result);
+
+        }
+
+        // Make the unknown conditions of executable branches overdefined.
+        // Returns true if one was found, and the solver has to run again.
+        bool resolveUnknownConditions(Function& function) {
+
+            bool found = false;
+
+            for (BasicBlock& block: function) {
+
+                if (!executableBlocks.count(&block)) {
+                    continue;
+                }
+
+                Value* condition = nullptr;
+                Instruction* terminator = block.getTerminator();
+                if (BranchInst* branch = dyn_cast<BranchInst>(terminator)) {
+                    condition = branch->isConditional() ? branch->getCondition() : nullptr;
+                }
+                else if (SwitchInst* switchIns = dyn_cast<SwitchInst>(terminator)) {
+                    condition = switchIns->getCondition();
+                }
+
+                if (!condition || !getValue(condition).isUnknown()) {
+                    continue;
+                }
+
+                // The condition is an instruction, as constants and arguments are never unknown
+                markOverdefined(cast<Instruction>(condition));
+                instructionWorklist.push_back(terminator);
+                found = true;
+            }
+
+            return found;
+
+        }
+
+        bool rewrite(Function& function) {
+
+            bool changed = false;
+
+            // Vector of instructions to delete at the end of the pass
+            std::vector<Instruction *> instsToDelete;
+
+            // Vector of unreachable blocks to delete at the end of the pass
+            std::vector<BasicBlock *> blocksToDelete;
+
+            // The phis are kept when blocks are removed from them, even with one
+            // incoming value left, as they may already be queued for deletion
+
+            for (BasicBlock& block: function) {
+
+                if (!executableBlocks.count(&block)) {
+                    blocksToDelete.push_back(&block);
+                    continue;
+                }
+
+                for (Instruction& instruction: block) {
+
+                    LatticeValue value = values.lookup(&instruction);
+                    if (!value.isConstant() || instruction.isTerminator()) {
+                        continue;
+                    }
+
+                    NumConstantInstructions++;
+                    LLVM_DEBUG(dbgs() << "Constant: " << instruction << " -> " << *value.constant << "\n");
+                    ORE.emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, "ConstantValue", &instruction)
+                            << "replaced " << ore::NV("Opcode", instruction.getOpcodeName())
+                            << " with a constant";
+                    });
+
+                    instruction.replaceAllUsesWith(value.constant);
+                    changed = true;
+
+                    if (DCEPass::isTriviallyDead(&instruction)) {
+                        instsToDelete.push_back(&instruction);
+                    }
+                }
+
+                changed |= foldTerminator(&block);
+            }
+
+            for (auto i: instsToDelete) {
+                i->eraseFromParent();
+            }
+
+            // Detach unreachable blocks from the phis of their successors, then delete them
+            for (auto block: blocksToDelete) {
+
+                NumUnreachableBlocks++;
+                LLVM_DEBUG(dbgs() << "Deleting unreachable block: ";
+                    block->printAsOperand(dbgs(), false);
+                    dbgs() << "\n");
+                ORE.emit([&]() {
+                    return OptimizationRemark(DEBUG_TYPE, "UnreachableBlock",
+                        block->front().getDebugLoc(), block)
+                        << "deleted block never executed";
+                });
+
+                for (BasicBlock* successor: successors(block)) {
+                    if (executableBlocks.count(successor)) {
+                        successor->removePredecessor(block, /*KeepOneInputPHIs=*/true);
+                    }
+                }
+
+                block->dropAllReferences();
+            }
+
+            for (auto block: blocksToDelete) {
+                block->eraseFromParent();
+            }
+
+            cfgChanged |= !blocksToDelete.empty();
+
+            return changed || !blocksToDelete.empty();
+
+        }
+
+        // Replace a branch or switch with a single executable successor by an
+        // unconditional branch, removing the block from the phis of the others
+        bool foldTerminator(BasicBlock* block) {
+
+            Instruction* terminator = block->getTerminator();
+
+            if (!(isa<BranchInst>(terminator) && cast<BranchInst>(terminator)->isConditional()) &&
+                !isa<SwitchInst>(terminator)) {
+                return false;
+            }
+
+            BasicBlock* target = nullptr;
+            for (BasicBlock* successor: successors(block)) {
+                if (executableEdges.count({block, successor})) {
+                    if (target && target != successor) {
+                        return false;
+                    }
+                    target = successor;
+                }
+            }
+
+            if (!target) {
+                return false;
+            }
+
+            NumConstantBranches++;
+            LLVM_DEBUG(dbgs() << "Constant branch: " << *terminator << "\n");
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "ConstantBranch", terminator)
+                    << "condition is always the same, the branch is made unconditional";
+            });
+
+            // One edge to the target is kept
+            bool kept = false;
+            for (BasicBlock* successor: successors(block)) {
+                if (successor == target && !kept) {
+                    kept = true;
+                    continue;
+                }
+                successor->removePredecessor(block, /*KeepOneInputPHIs=*/true);
+            }
+
+            BranchInst::Create(target, terminator);
+            terminator->eraseFromParent();
+
+            cfgChanged = true;
+            return true;
+
+        }
+    };
+}
+
+bool customopt::SCCPropPass::runImpl(Function& function, OptimizationRemarkEmitter& ORE,
+    bool& cfgChanged) {
+
+    SparseConditionalConstantPropagation sccp(ORE, function.getParent()->getDataLayout());
+    bool changed = sccp.run(function);
+
+    cfgChanged = sccp.cfgChanged;
+    return changed;
+
+}
+
+PreservedAnalyses customopt::SCCPropPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    bool cfgChanged = false;
+
+    if (!runImpl(function, FAM.getResult<OptimizationRemarkEmitterAnalysis>(function), cfgChanged)) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    if (!cfgChanged) {
+        PA.preserveSet<CFGAnalyses>();
+    }
+    return PA;
+
+}
+
+namespace {
+    struct SCCPropLegacyPass : public FunctionPass {
+        static char ID;
+        SCCPropLegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnFunction(Function& function) override {
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            bool cfgChanged;
+            return customopt::SCCPropPass::runImpl(function, ORE, cfgChanged);
+        }
+    };
+}
+
+char SCCPropLegacyPass::ID = 0;
+
+static RegisterPass<SCCPropLegacyPass> X("sccprop", "Sparse Conditional Constant Propagation", false, false);
@@ -5,401 +5,1594 @@
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/ADT/APInt.h"
+#include "llvm/ADT/APFloat.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/Support/KnownBits.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/CodeGen/Passes.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Support/CommandLine.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+
+#include "CustomOpt.h"
 
 using namespace llvm;
+using namespace llvm::PatternMatch;
+using namespace customopt;
+
+#define DEBUG_TYPE "srcf"
+
+STATISTIC(NumConstantFolded, "Number of instructions folded to a constant");
+STATISTIC(NumStrengthReduced, "Number of instructions replaced with cheaper ones");
+STATISTIC(NumKnownBitsFolded, "Number of instructions folded from the known bits of their operands");
+
+static cl::opt<unsigned> MulLatency("srcf-mul-latency", cl::init(3),
+    cl::desc("Latency of an integer multiply assumed by -srcf when the target's "
+             "cost model reports a lower one"));
+
+static cl::opt<unsigned> MaxMulChainLength("srcf-max-mul-chain", cl::init(3),
+    cl::desc("Maximum number of instructions -srcf may emit for a multiply by a constant"));
 
 namespace {
-    struct SRCFPass : public FunctionPass {
-        static char ID;
-        SRCFPass() : FunctionPass(ID) {}
 
-        virtual bool runOnFunction(Function& function) {
+    // Builder handed to the rules: inserts before the rewritten instruction, and
+    // carries the target cost model for rules which trade instructions off
+    struct RuleBuilder : public IRBuilder<> {
+        const TargetTransformInfo& TTI;
 
-            // Vector of instructions to delete at the end of the pass (void instructions)
-            std::vector<Instruction *> instsToDelete;
+        RuleBuilder(Instruction* ins, const TargetTransformInfo& TTI) : IRBuilder<>(ins), TTI(TTI) {}
+    };
 
-            errs() << "Starting Strength Reduction & Constant Folding pass "
-                "for function: '" << function.getName() << "':\n";
+    enum RuleKind { ConstantFolding, StrengthReduction, KnownBitsFolding };
 
-            // Iterate through each basic block of the function
-            for (auto& block: function) {
+    const char* getKindName(RuleKind kind) {
 
-                // Iterate through each instruction in the basic block
-                for (auto& instruction: block) {
+        switch (kind) {
+            case ConstantFolding:   return "Constant folding";
+            case StrengthReduction: return "Strength reduction";
+            case KnownBitsFolding:  return "Known bits";
+        }
+        return "";
+
+    }
+
+    // Name of the optimization remarks of the rules of a kind
+    const char* getRemarkName(RuleKind kind) {
+
+        switch (kind) {
+            case ConstantFolding:   return "ConstantFolding";
+            case StrengthReduction: return "StrengthReduction";
+            case KnownBitsFolding:  return "KnownBits";
+        }
+        return "";
+
+    }
+
+    // A rewrite rule for one opcode. The engine canonicalizes commutative binary
+    // operators so that a constant operand is always on the right, and calls
+    // apply() with the (possibly swapped) operands; right is nullptr for casts and fneg.
+    // apply() returns the value replacing the instruction, or nullptr when the
+    // rule does not match.
+    struct Rule {
+        unsigned opcode;
+        RuleKind kind;
+        const char* pattern;
+        Value* (*apply)(Instruction* op, Value* left, Value* right, RuleBuilder& builder);
+    };
+
+    // Fold two constants with the semantics of the opcode, at the width of the operands.
+    // Division by zero, signed division overflow and oversized shifts are undefined
+    // or poison, so they are left alone.
+    bool foldConstants(unsigned opcode, const APInt& left, const APInt& right, APInt& result) {
+
+        unsigned width = left.getBitWidth();
+
+        switch (opcode) {
+            case Instruction::Add:  result = left + right; return true;
+            case Instruction::Sub:  result = left - right; return true;
+            case Instruction::Mul:  result = left * right; return true;
+            case Instruction::And:  result = left & right; return true;
+            case Instruction::Or:   result = left | right; return true;
+            case Instruction::Xor:  result = left ^ right; return true;
+
+            case Instruction::UDiv:
+            case Instruction::URem:
+
+                if (right.isNullValue()) {
+                    return false;
+                }
+
+                result = opcode == Instruction::UDiv ? left.udiv(right) : left.urem(right);
+                return true;
+
+            case Instruction::SDiv:
+            case Instruction::SRem:
+
+                if (right.isNullValue() ||
+                    (left.isMinSignedValue() && right.isAllOnesValue())) {
+                    return false;
+                }
+
+                result = opcode == Instruction::SDiv ? left.sdiv(right) : left.srem(right);
+                return true;
+
+            case Instruction::Shl:
+            case Instruction::LShr:
+            case Instruction::AShr:
+
+                if (right.uge(width)) {
+                    return false;
+                }
+
+                if (opcode == Instruction::Shl) {
+                    result = left.shl(right);
+                }
+                else if (opcode == Instruction::LShr) {
+                    result = left.lshr(right);
+                }
+                else {
+                    result = left.ashr(right);
+                }
+                return true;
+
+            default:
+                return false;
+        }
+    }
 
-                    // errs() << "Current instruction: " << instruction << "\n";
+    // Fold left op right for two integer constants, or fixed-width vectors of them,
+    // of the given type; nullptr if they are not constants or the result is undefined
+    Constant* foldConstantOperands(unsigned opcode, Type* type, Value* left, Value* right) {
 
-                    // If operator is a binary operator
-                    if (instruction.isBinaryOp()) {
-                        
-                        // Cast instruction to a BinaryOperator type
-                        auto* op = dyn_cast<BinaryOperator>(&instruction);
-                        Value* left = op->getOperand(0);
-                        Value* right = op->getOperand(1);
+        const APInt *lvalue, *rvalue;
+        APInt result;
 
-                        switch (op->getOpcode()) {
-                            
-                            // If opcode is multiply
-                            case Instruction::Mul:
+        // Scalars and splat vectors
+        if (match(left, m_APInt(lvalue)) && match(right, m_APInt(rvalue))) {
 
-                                // If left is a constant integer
-                                if(ConstantInt* lint = dyn_cast<ConstantInt>(left)) {
-                                    
-                                    // Cast left into an integer
-                                    auto lvalue = lint->getSExtValue();
+            if (!foldConstants(opcode, *lvalue, *rvalue, result)) {
+                return nullptr;
+            }
 
-                                    // If right is also a constant integer, constant fold
-                                    if(ConstantInt* rint = dyn_cast<ConstantInt>(right)) {
+            return ConstantInt::get(type, result);
+        }
 
+        // Fixed-width vectors with different constants per lane are folded lane by lane
+        auto* vectorType = dyn_cast<FixedVectorType>(type);
+        Constant* leftVector = dyn_cast<Constant>(left);
+        Constant* rightVector = dyn_cast<Constant>(right);
 
-                                        // Cast right into an integer
-                                        auto rvalue = rint->getSExtValue();
+        if (!vectorType || !leftVector || !rightVector) {
+            return nullptr;
+        }
 
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+        std::vector<Constant *> lanes;
 
-                                        // Replace all instances of the instruction with constant 
-                                        Value* result = ConstantInt::get(left->getType(), lvalue * rvalue);
+        for (unsigned i = 0; i < vectorType->getNumElements(); i++) {
 
-                                        op->replaceAllUsesWith(result);
+            auto* leftLane = dyn_cast_or_null<ConstantInt>(leftVector->getAggregateElement(i));
+            auto* rightLane = dyn_cast_or_null<ConstantInt>(rightVector->getAggregateElement(i));
 
-                                        errs() << "Constant folding: ";
-                                        errs() << lvalue << "*" << rvalue << " -> " << (lvalue * rvalue) << "\n";
+            if (!leftLane || !rightLane ||
+                !foldConstants(opcode, leftLane->getValue(), rightLane->getValue(), result)) {
+                return nullptr;
+            }
 
-                                    }
+            lanes.push_back(ConstantInt::get(vectorType->getElementType(), result));
+        }
 
-                                    // Else right is not a constant integer
-                                    else {
+        return ConstantVector::get(lanes);
+    }
 
-                                        // If left is a power of 2 -> Strength reduction into shl
-                                        if ((lvalue != 0) && ((lvalue & (lvalue - 1)) == 0)) {
+    Value* foldRule(Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) {
+        return foldConstantOperands(op->getOpcode(), op->getType(), left, right);
+    }
 
-                                            int count = 0;
-                                            int tmp = lvalue;
-                                            while(tmp != 1) {
-                                                tmp >>= 1;
-                                                count ++;
-                                            }
+    // Per-lane shift amounts for a constant vector whose lanes are all powers of two
+    Constant* getLaneLog2(Value* value) {
 
-                                            Value* newval = ConstantInt::get(left->getType(), count);
+        auto* vectorType = dyn_cast<FixedVectorType>(value->getType());
+        Constant* vector = dyn_cast<Constant>(value);
 
-                                            // Inserts a new left shift instruction in the IR, instead of the multiply
-                                            IRBuilder<> builder(op);
-                                            Value* shl = builder.CreateShl(right, newval);
+        if (!vectorType || !vector) {
+            return nullptr;
+        }
 
-                                            errs() << "Strength reduction: ";
-                                            errs() << lvalue << "*x -> x<<" << count << "\n";
+        std::vector<Constant *> lanes;
 
-                                            // Replace all uses with shl instruction
-                                            for (auto& U : op->uses()) {
-                                                User* user = U.getUser();
-                                                user->setOperand(U.getOperandNo(), shl);
-                                            }
+        for (unsigned i = 0; i < vectorType->getNumElements(); i++) {
 
-                                            // Prepare to delete instruction
-                                            instsToDelete.push_back(op);
+            auto* lane = dyn_cast_or_null<ConstantInt>(vector->getAggregateElement(i));
 
-                                        }
+            if (!lane || !lane->getValue().isPowerOf2()) {
+                return nullptr;
+            }
 
-                                        // If left == 1, strength reduce (multiplication is useless)
+            lanes.push_back(ConstantInt::get(vectorType->getElementType(), lane->getValue().logBase2()));
+        }
 
-                                        if(lvalue == 1) {
-                                        
-                                            // Prepare to delete instruction
-                                            instsToDelete.push_back(op);
+        return ConstantVector::get(lanes);
+    }
+
+    // x op C -> x, for the right identity C of the operator
+    Value* rightZeroIdentity(Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) {
+        return match(right, m_Zero()) ? left : nullptr;
+    }
+
+    Value* rightOneIdentity(Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) {
+        return match(right, m_One()) ? left : nullptr;
+    }
+
+    // x op x -> x
+    Value* idempotent(Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) {
+        return left == right ? left : nullptr;
+    }
+
+    // x op x -> 0
+    Value* selfZero(Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) {
+        return left == right ? Constant::getNullValue(op->getType()) : nullptr;
+    }
+
+    // x op 0 -> 0
+    Value* rightZeroAbsorbs(Instruction* op, Value* /*left*/, Value* right, RuleBuilder& /*builder*/) {
+        return match(right, m_Zero()) ? Constant::getNullValue(op->getType()) : nullptr;
+    }
+
+    // 0 op x -> 0 (shifts of zero, and divisions of zero, where x == 0 is undefined)
+    Value* leftZeroAbsorbs(Instruction* op, Value* left, Value* /*right*/, RuleBuilder& /*builder*/) {
+        return match(left, m_Zero()) ? Constant::getNullValue(op->getType()) : nullptr;
+    }
+
+    // Known bits and sign facts about a value at the point of the instruction
+    // being rewritten, from LLVM's value tracking analysis
+    KnownBits getKnownBits(Value* value, Instruction* context) {
+        return computeKnownBits(value, context->getModule()->getDataLayout(), 0, nullptr, context);
+    }
+
+    bool isNonNegative(Value* value, Instruction* context) {
+        return isKnownNonNegative(value, context->getModule()->getDataLayout(), 0, nullptr, context);
+    }
+
+    unsigned getSignBits(Value* value, Instruction* context) {
+        return ComputeNumSignBits(value, context->getModule()->getDataLayout(), 0, nullptr, context);
+    }
+
+    // Matches a positive power of two 2^k with k >= 1, returning k
+    bool matchSignedPowerOf2(Value* right, unsigned& shift) {
+
+        const APInt* C;
+        if (!match(right, m_APInt(C)) || !C->isNonNegative() || !C->isPowerOf2() || C->isOneValue()) {
+            return false;
+        }
 
-                                            // Replace all uses of op with left
-                                            op->replaceAllUsesWith(right);
+        shift = C->logBase2();
+        return true;
+    }
 
-                                            errs() << "Strength reduction: ";
-                                            errs() << lvalue << "*x -> x\n";
+    // x sdiv 2^k rounding towards zero: negative dividends are biased by 2^k-1
+    // before the arithmetic shift, x + ((x >>s (w-1)) >>u (w-k))
+    Value* createBiasedDividend(IRBuilder<>& builder, Value* x, unsigned shift) {
 
-                                        }
-                                    }
-                            
-                                }
+        unsigned width = x->getType()->getScalarSizeInBits();
 
-                                // Else if only right is a constant integer
-                                else if(ConstantInt* rint = dyn_cast<ConstantInt>(right)) {
+        Value* sign = builder.CreateAShr(x, width - 1);
+        Value* bias = builder.CreateLShr(sign, width - shift);
 
-                                    // Cast right into an integer
-                                    auto rvalue = rint->getSExtValue();
+        return builder.CreateAdd(x, bias);
+    }
 
-                                    // If right == 1, strength reduce (multiplication is useless)
-                                    if(rvalue == 1) {
-                                        
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+    // Magic numbers for division by a constant d with a multiply-high (Hacker's Delight,
+    // chapter 10): q = mulhi(n, multiplier) >> shift, plus the fix-ups described below
+    struct DivisionMagic {
+        APInt multiplier;
+        unsigned shift;
 
-                                        // Replace all uses of op with left
-                                        op->replaceAllUsesWith(left);
+        // Unsigned only: the multiplier needs w+1 bits, and the quotient is
+        // ((n - t) >> 1 + t) >> (shift - 1) where t = mulhi(n, multiplier)
+        bool add;
+    };
 
-                                        errs() << "Strength reduction: ";
-                                        errs() << "x*" << rvalue << " -> x\n";
+    // Unsigned magic number for d, assuming the dividend has at least
+    // leadingZeros known zero high bits. d must not be 0 or 1.
+    DivisionMagic getUnsignedMagic(const APInt& d, unsigned leadingZeros = 0) {
 
-                                    }
+        unsigned width = d.getBitWidth();
+        APInt allOnes = APInt::getAllOnesValue(width).lshr(leadingZeros);
+        APInt signedMin = APInt::getSignedMinValue(width);
+        APInt signedMax = APInt::getSignedMaxValue(width);
 
-                                    // If right is a power of 2 -> Strength reduction to shl
-                                    if ((rvalue != 0) && ((rvalue & (rvalue - 1)) == 0)) {
+        DivisionMagic magic;
+        magic.add = false;
 
-                                        int count = 0;
-                                        int tmp = rvalue;
-                                        while(tmp != 1) {
-                                            tmp >>= 1;
-                                            count ++;
-                                        }
+        APInt nc = allOnes - (allOnes - d).urem(d);
+        unsigned p = width - 1;
 
-                                        Value* newval = ConstantInt::get(left->getType(), count);
-                                        
-                                        // Inserts a new left shift instruction in the IR, instead of the multiply
-                                        IRBuilder<> builder(op);
-                                        Value* shl = builder.CreateShl(left, newval);
+        APInt q1 = signedMin.udiv(nc);
+        APInt r1 = signedMin - q1 * nc;
+        APInt q2 = signedMax.udiv(d);
+        APInt r2 = signedMax - q2 * d;
+        APInt delta;
 
-                                        errs() << "Strength reduction: ";
-                                        errs() << "x*" << rvalue << " -> " << "x<<" << count << "\n";
+        do {
+            p++;
 
-                                        // Replace all uses with shl instruction
-                                        for (auto& U : op->uses()) {
-                                            User* user = U.getUser();
-                                            user->setOperand(U.getOperandNo(), shl);
-                                        }
+            if (r1.uge(nc - r1)) {
+                q1 = q1 + q1 + 1;
+                r1 = r1 + r1 - nc;
+            }
+            else {
+                q1 = q1 + q1;
+                r1 = r1 + r1;
+            }
 
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+            if ((r2 + 1).uge(d - r2)) {
+                if (q2.uge(signedMax)) {
+                    magic.add = true;
+                }
+                q2 = q2 + q2 + 1;
+                r2 = r2 + r2 + 1 - d;
+            }
+            else {
+                if (q2.uge(signedMin)) {
+                    magic.add = true;
+                }
+                q2 = q2 + q2;
+                r2 = r2 + r2 + 1;
+            }
 
-                                    }
-                                }
+            delta = d - 1 - r2;
 
-                                break;
+        } while (p < width * 2 && (q1.ult(delta) || (q1 == delta && r1.isNullValue())));
 
+        magic.multiplier = q2 + 1;
+        magic.shift = p - width;
 
-                            // If opcode is divide
-                            // Division is not commutative so only certain instructions are possible
-                            case Instruction::UDiv:
-                            case Instruction::SDiv:
+        return magic;
+    }
 
-                                // If left is a constant integer
-                                if(ConstantInt* lint = dyn_cast<ConstantInt>(left)) {
-                                    
-                                    // Cast left into an integer
-                                    auto lvalue = lint->getSExtValue();
+    // Signed magic number for d. |d| must be at least 2.
+    DivisionMagic getSignedMagic(const APInt& d) {
 
-                                    // If right is also a constant integer, constant fold
-                                    if(ConstantInt* rint = dyn_cast<ConstantInt>(right)) {
+        unsigned width = d.getBitWidth();
+        APInt signedMin = APInt::getSignedMinValue(width);
 
-                                        // Cast right into an integer
-                                        auto rvalue = rint->getSExtValue();
+        DivisionMagic magic;
+        magic.add = false;
 
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+        APInt ad = d.abs();
+        APInt t = signedMin + d.lshr(width - 1);
+        APInt anc = t - 1 - t.urem(ad);
+        unsigned p = width - 1;
 
-                                        // Replace all instances of the instruction with constant 
-                                        Value* result = ConstantInt::get(left->getType(), lvalue / rvalue);
+        APInt q1 = signedMin.udiv(anc);
+        APInt r1 = signedMin - q1 * anc;
+        APInt q2 = signedMin.udiv(ad);
+        APInt r2 = signedMin - q2 * ad;
+        APInt delta;
 
-                                        op->replaceAllUsesWith(result);
+        do {
+            p++;
 
-                                        errs() << "Constant folding: ";
-                                        errs() << lvalue << "/" << rvalue << " -> " << (lvalue / rvalue) << "\n";
+            q1 <<= 1;
+            r1 <<= 1;
+            if (r1.uge(anc)) {
+                ++q1;
+                r1 -= anc;
+            }
 
-                                    }
-                            
-                                }
+            q2 <<= 1;
+            r2 <<= 1;
+            if (r2.uge(ad)) {
+                ++q2;
+                r2 -= ad;
+            }
 
-                                // Else if only right is a constant integer
-                                else if(ConstantInt* rint = dyn_cast<ConstantInt>(right)) {
+            delta = ad - r2;
 
-                                    // Cast right into an integer
-                                    auto rvalue = rint->getSExtValue();
+        } while (q1.ult(delta) || (q1 == delta && r1.isNullValue()));
 
-                                    // If right is a power of 2 -> Strength reduction to shr
-                                    if ((rvalue != 0) && ((rvalue & (rvalue - 1)) == 0)) {
+        magic.multiplier = q2 + 1;
+        if (d.isNegative()) {
+            magic.multiplier.negate();
+        }
+        magic.shift = p - width;
 
-                                        int count = 0;
-                                        int tmp = rvalue;
-                                        while(tmp != 1) {
-                                            tmp >>= 1;
-                                            count ++;
-                                        }
+        return magic;
+    }
 
-                                        Value* newval = ConstantInt::get(left->getType(), count);
-                                        
-                                        // Inserts a new right shift instruction in the IR, instead of the multiply
-                                        IRBuilder<> builder(op);
-                                        Value* shl = builder.CreateAShr(left, newval);
+    // High half of the double-width product of x and the constant multiplier
+    Value* createMulHigh(IRBuilder<>& builder, Value* x, const APInt& multiplier, bool isSigned) {
 
-                                        errs() << "Strength reduction: ";
-                                        errs() << "x/" << rvalue << " -> " << "x>>" << count << "\n";
+        unsigned width = multiplier.getBitWidth();
+        Type* type = x->getType();
+        Type* wideType = type->getWithNewBitWidth(width * 2);
 
-                                        // Replace all uses with shl instruction
-                                        for (auto& U : op->uses()) {
-                                            User* user = U.getUser();
-                                            user->setOperand(U.getOperandNo(), shl);
-                                        }
+        Value* wideX = isSigned ? builder.CreateSExt(x, wideType) : builder.CreateZExt(x, wideType);
+        APInt wideMultiplier = isSigned ? multiplier.sext(width * 2) : multiplier.zext(width * 2);
 
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+        Value* product = builder.CreateMul(wideX, ConstantInt::get(wideType, wideMultiplier));
 
-                                    }
+        return builder.CreateTrunc(builder.CreateLShr(product, width), type);
+    }
 
-                                    // If right == 1, strength reduce (division is useless)
-                                    if(rvalue == 1) {
-                                        
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+    // The multiply-high sequence needs a double-width multiply, which the backend
+    // only lowers to a single instruction up to 64 x 64 -> 128 bits, and for
+    // vectors up to 32 x 32 -> 64 bit lanes
+    bool canUseMagic(Type* type) {
+        unsigned width = type->getScalarSizeInBits();
+        return width >= 2 && width <= (type->isVectorTy() ? 32 : 64);
+    }
 
-                                        // Replace all uses of op with left
-                                        op->replaceAllUsesWith(left);
+    // n udiv d for a constant d which is not 0, 1 or a power of two
+    Value* createUnsignedDivision(IRBuilder<>& builder, Value* n, const APInt& d) {
 
-                                        errs() << "Strength reduction: ";
-                                        errs() << "x/" << rvalue << " -> x\n";
+        // Divisors with the top bit set give a quotient of 0 or 1
+        if (d.isNegative()) {
+            return builder.CreateZExt(builder.CreateICmpUGE(n, ConstantInt::get(n->getType(), d)),
+                n->getType());
+        }
 
-                                    }
-                                }
-                                break;
+        DivisionMagic magic = getUnsignedMagic(d);
 
-                            case Instruction::Add:
+        // An even divisor can pre-shift the dividend, which frees enough high
+        // bits to avoid the add fix-up
+        unsigned preShift = 0;
+        if (magic.add && !d[0]) {
+            preShift = d.countTrailingZeros();
+            magic = getUnsignedMagic(d.lshr(preShift), preShift);
+            n = builder.CreateLShr(n, preShift);
+        }
 
-                                if(ConstantInt* lint = dyn_cast<ConstantInt>(left)) {
+        Value* q = createMulHigh(builder, n, magic.multiplier, false);
 
-                                    // Cast left into an integer
-                                    auto lvalue = lint->getSExtValue();
+        if (!magic.add) {
+            return magic.shift ? builder.CreateLShr(q, magic.shift) : q;
+        }
 
-                                    // If left and right are constant integers, constant fold
-                                    if(ConstantInt* rint = dyn_cast<ConstantInt>(right)) {
+        // The multiplier overflowed the width: q = (((n - t) >> 1) + t) >> (shift - 1)
+        Value* t = builder.CreateLShr(builder.CreateSub(n, q), 1);
+        q = builder.CreateAdd(t, q);
 
-                                        // Cast right into an integer
-                                        auto rvalue = rint->getSExtValue();
+        return magic.shift > 1 ? builder.CreateLShr(q, magic.shift - 1) : q;
+    }
 
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+    // n sdiv d for a constant d with |d| >= 2, rounding towards zero
+    Value* createSignedDivision(IRBuilder<>& builder, Value* n, const APInt& d) {
 
-                                        // Replace all instances of the instruction with constant 
-                                        Value* result = ConstantInt::get(left->getType(), lvalue + rvalue);
+        unsigned width = d.getBitWidth();
+        Type* type = n->getType();
 
-                                        op->replaceAllUsesWith(result);
+        // Only the minimum value itself divides to a non-zero quotient
+        if (d.isMinSignedValue()) {
+            return builder.CreateZExt(builder.CreateICmpEQ(n, ConstantInt::get(type, d)), type);
+        }
 
-                                        errs() << "Constant folding: ";
-                                        errs() << lvalue << "+" << rvalue << " -> " << (lvalue + rvalue) << "\n";
+        DivisionMagic magic = getSignedMagic(d);
 
-                                    }
+        Value* q = createMulHigh(builder, n, magic.multiplier, true);
 
-                                    // Else right is not a constant integer
-                                    else {
-                                        
-                                        // If left == 0, convert to only right
-                                        if (lvalue == 0) {
-                                            
-                                            // Prepare to delete instruction
-                                            instsToDelete.push_back(op);
+        // Correct for a multiplier whose sign differs from the divisor's
+        if (d.isStrictlyPositive() && magic.multiplier.isNegative()) {
+            q = builder.CreateAdd(q, n);
+        }
+        else if (d.isNegative() && magic.multiplier.isStrictlyPositive()) {
+            q = builder.CreateSub(q, n);
+        }
 
-                                            // Replace all uses of op with right
-                                            op->replaceAllUsesWith(right);
+        if (magic.shift) {
+            q = builder.CreateAShr(q, magic.shift);
+        }
 
-                                            errs() << "Strength reduction: ";
-                                            errs() << lvalue << "+x -> x\n";
-                                        }
-                                    }
+        // Round towards zero by adding one to negative quotients
+        return builder.CreateAdd(q, builder.CreateLShr(q, width - 1));
+    }
 
-                                }
+    // Matches a divisor for which the magic number lowering applies
+    bool matchMagicDivisor(Instruction* op, Value* right, const APInt*& d, bool isSigned) {
 
-                                // Else if only right is a constant integer
-                                else if(ConstantInt* rint = dyn_cast<ConstantInt>(right)) {
+        if (!canUseMagic(op->getType()) || !match(right, m_APInt(d))) {
+            return false;
+        }
 
-                                    // Cast right into an integer
-                                    auto rvalue = rint->getSExtValue();
+        if (isSigned) {
+            return !d->isNullValue() && !d->isOneValue() && !d->isAllOnesValue();
+        }
 
-                                    // If right == 0, convert to only left
-                                    if (rvalue == 0) {
-                                        
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+        return !d->isNullValue() && !d->isPowerOf2();
+    }
 
-                                        // Replace all uses of op with left
-                                        op->replaceAllUsesWith(left);
+    // Shift/add/sub chain computing x*C. Nodes only refer to earlier nodes;
+    // node 0 is the multiplicand x and the last node is the result.
+    struct MulChain {
+        enum Kind { Leaf, Shl, Add, Sub, Neg };
 
-                                        errs() << "Strength reduction: ";
-                                        errs() << "x+" << rvalue << " -> x\n";
-                                    }
-                                    
-                                }
-                                break;
+        struct Node {
+            Kind kind;
+            int left;
+            int right;
+            unsigned shift;
+        };
 
-                            case Instruction::Sub:
+        std::vector<Node> nodes;
 
-                                if(ConstantInt* lint = dyn_cast<ConstantInt>(left)) {
+        MulChain() {
+            nodes.push_back({ Leaf, -1, -1, 0 });
+        }
 
-                                    // Cast left into an integer
-                                    auto lvalue = lint->getSExtValue();
+        int push(Kind kind, int left, int right, unsigned shift) {
+            nodes.push_back({ kind, left, right, shift });
+            return nodes.size() - 1;
+        }
 
-                                    // If left and right are constant integers, constant fold
-                                    if(ConstantInt* rint = dyn_cast<ConstantInt>(right)) {
+        int shl(int node, unsigned shift) {
+            return shift ? push(Shl, node, -1, shift) : node;
+        }
 
-                                        // Cast right into an integer
-                                        auto rvalue = rint->getSExtValue();
+        int add(int left, int right) { return push(Add, left, right, 0); }
+        int sub(int left, int right) { return push(Sub, left, right, 0); }
+        int neg(int node) { return push(Neg, node, -1, 0); }
 
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+        // Multiply the value of node by f, when f is 1 or 2^a +- 1. Returns -1 otherwise.
+        int applyTerm(int node, const APInt& f) {
 
-                                        // Replace all instances of the instruction with constant 
-                                        Value* result = ConstantInt::get(left->getType(), lvalue - rvalue);
+            if (f.isOneValue()) {
+                return node;
+            }
 
-                                        op->replaceAllUsesWith(result);
+            if ((f - 1).isPowerOf2()) {
+                return add(shl(node, (f - 1).logBase2()), node);
+            }
 
-                                        errs() << "Constant folding: ";
-                                        errs() << lvalue << "-" << rvalue << " -> " << (lvalue - rvalue) << "\n";
+            if ((f + 1).isPowerOf2()) {
+                return sub(shl(node, (f + 1).logBase2()), node);
+            }
 
-                                    }
-                                }
-                                
-                                // Else if only right is a constant integer
-                                else if(ConstantInt* rint = dyn_cast<ConstantInt>(right)) {
+            return -1;
+        }
 
-                                    // Cast right into an integer
-                                    auto rvalue = rint->getSExtValue();
+        // The constant the chain multiplies by, at the given width
+        APInt evaluate(unsigned width) const {
 
-                                    // If right == 0, convert to only left
-                                    if (rvalue == 0) {
-                                        
-                                        // Prepare to delete instruction
-                                        instsToDelete.push_back(op);
+            std::vector<APInt> values;
 
-                                        // Replace all uses of op with left
-                                        op->replaceAllUsesWith(left);
+            for (const Node& node: nodes) {
+                switch (node.kind) {
+                    case Leaf: values.push_back(APInt(width, 1)); break;
+                    case Shl:  values.push_back(values[node.left].shl(node.shift)); break;
+                    case Add:  values.push_back(values[node.left] + values[node.right]); break;
+                    case Sub:  values.push_back(values[node.left] - values[node.right]); break;
+                    case Neg:  values.push_back(-values[node.left]); break;
+                }
+            }
 
-                                        errs() << "Strength reduction: ";
-                                        errs() << "x-" << rvalue << " -> x\n";
-                                    }
-                                    
-                                }
-                                break;
-                            
-                            // For now, we dont handle other opcodes
-                            default:
-                                break;
+            return values.back();
+        }
 
-                        }
-                
+        Value* emit(IRBuilder<>& builder, Value* x) const {
+
+            std::vector<Value *> values;
+
+            for (const Node& node: nodes) {
+                switch (node.kind) {
+                    case Leaf: values.push_back(x); break;
+                    case Shl:  values.push_back(builder.CreateShl(values[node.left], node.shift)); break;
+                    case Add:  values.push_back(builder.CreateAdd(values[node.left], values[node.right])); break;
+                    case Sub:  values.push_back(builder.CreateSub(values[node.left], values[node.right])); break;
+                    case Neg:  values.push_back(builder.CreateNeg(values[node.left])); break;
+                }
+            }
+
+            return values.back();
+        }
+    };
+
+    // Cost of a chain under the target's cost model: the latency of its critical
+    // path, and the number of instructions it issues. A shift feeding only an add
+    // is folded into it when the target has that scale as an addressing mode
+    // (x86 LEA, ARM shifted-register operands).
+    void getMulChainCost(const MulChain& chain, Type* type, const TargetTransformInfo& TTI,
+            unsigned& latency, unsigned& instructions) {
+
+        const std::vector<MulChain::Node>& nodes = chain.nodes;
+
+        std::vector<unsigned> users(nodes.size(), 0);
+        for (const MulChain::Node& node: nodes) {
+            if (node.left >= 0) users[node.left]++;
+            if (node.right >= 0) users[node.right]++;
+        }
+
+        auto isFoldedShift = [&](int index) {
+            const MulChain::Node& node = nodes[index];
+            return node.kind == MulChain::Shl && users[index] == 1 && node.shift < 63 &&
+                !type->isVectorTy() &&
+                TTI.isLegalAddressingMode(type, nullptr, 0, true, int64_t(1) << node.shift);
+        };
+
+        auto opCost = [&](unsigned opcode, TargetTransformInfo::OperandValueKind rightKind) -> unsigned {
+            InstructionCost cost = TTI.getArithmeticInstrCost(opcode, type,
+                TargetTransformInfo::TCK_Latency, TargetTransformInfo::OK_AnyValue, rightKind);
+            return cost.isValid() ? std::max<unsigned>(*cost.getValue(), 1) : 1;
+        };
+
+        std::vector<unsigned> path(nodes.size(), 0);
+        std::vector<bool> folded(nodes.size(), false);
+        instructions = 0;
+
+        for (size_t i = 1; i < nodes.size(); i++) {
+
+            const MulChain::Node& node = nodes[i];
+            unsigned inputs = path[node.left];
+            if (node.right >= 0) {
+                inputs = std::max(inputs, path[node.right]);
+            }
+
+            switch (node.kind) {
+                case MulChain::Shl:
+                    path[i] = inputs + opCost(Instruction::Shl, TargetTransformInfo::OK_UniformConstantValue);
+                    break;
+
+                case MulChain::Add: {
+
+                    // (x << k) + y as a single LEA-like instruction: the shift costs nothing
+                    unsigned leftPath = path[node.left];
+                    unsigned rightPath = path[node.right];
+
+                    if (isFoldedShift(node.left)) {
+                        folded[node.left] = true;
+                        leftPath = path[nodes[node.left].left];
+                    }
+                    else if (isFoldedShift(node.right)) {
+                        folded[node.right] = true;
+                        rightPath = path[nodes[node.right].left];
                     }
+
+                    path[i] = std::max(leftPath, rightPath) + opCost(Instruction::Add, TargetTransformInfo::OK_AnyValue);
+                    break;
                 }
+
+                case MulChain::Sub:
+                case MulChain::Neg:
+                    path[i] = inputs + opCost(Instruction::Sub, TargetTransformInfo::OK_AnyValue);
+                    break;
+
+                case MulChain::Leaf:
+                    break;
+            }
+        }
+
+        for (size_t i = 1; i < nodes.size(); i++) {
+            if (!folded[i]) {
+                instructions++;
+            }
+        }
+
+        latency = path.back();
+    }
+
+    // Candidate chains for x*C: C = D * 2^s with D odd, and D one of 2^a+-1,
+    // 2^a+2^b+1 or a product (2^a+-1)(2^b+-1). Negative constants are also tried
+    // as the negation of a chain for -C.
+    void getMulChainCandidates(const APInt& C, std::vector<MulChain>& candidates, bool allowNeg = true) {
+
+        unsigned width = C.getBitWidth();
+        unsigned trailingZeros = C.countTrailingZeros();
+        APInt D = C.lshr(trailingZeros);
+
+        auto finish = [&](MulChain& chain, int root) {
+            if (root < 0) {
+                return;
             }
+            chain.shl(root, trailingZeros);
+            candidates.push_back(chain);
+        };
+
+        // D = 2^a +- 1
+        {
+            MulChain chain;
+            finish(chain, chain.applyTerm(0, D));
+        }
+
+        // D = 2^a + 2^b + 1
+        if (D.countPopulation() == 3) {
+            MulChain chain;
+            APInt rest = D - 1;
+            unsigned low = rest.countTrailingZeros();
+            unsigned high = rest.logBase2();
+            finish(chain, chain.add(chain.shl(0, high), chain.add(chain.shl(0, low), 0)));
+        }
+
+        // D = (2^a +- 1)(2^b +- 1)
+        for (unsigned a = 1; a < width - 1; a++) {
+
+            APInt bit = APInt::getOneBitSet(width, a);
+
+            for (const APInt& f: { bit + 1, bit - 1 }) {
+
+                if (f.ugt(D) || f.isOneValue() || !D.urem(f).isNullValue()) {
+                    continue;
+                }
+
+                MulChain chain;
+                int inner = chain.applyTerm(0, f);
+                int outer = chain.applyTerm(inner, D.udiv(f));
+
+                if (outer >= 0 && outer != inner) {
+                    finish(chain, outer);
+                }
+            }
+        }
+
+        // -C, negated
+        if (allowNeg && C.isNegative() && !C.isMinSignedValue()) {
+
+            std::vector<MulChain> negated;
+            getMulChainCandidates(-C, negated, false);
+
+            for (MulChain& chain: negated) {
+                chain.neg(chain.nodes.size() - 1);
+                candidates.push_back(chain);
+            }
+        }
+    }
+
+    // Pick the cheapest chain for x*C, if it has a shorter critical path than the multiply
+    bool chooseMulChain(const APInt& C, Type* type, const TargetTransformInfo& TTI, MulChain& best) {
+
+        InstructionCost mulCost = TTI.getArithmeticInstrCost(Instruction::Mul, type,
+            TargetTransformInfo::TCK_Latency, TargetTransformInfo::OK_AnyValue,
+            TargetTransformInfo::OK_UniformConstantValue);
+
+        unsigned mulLatency = MulLatency;
+        if (mulCost.isValid()) {
+            mulLatency = std::max<unsigned>(mulLatency, *mulCost.getValue());
+        }
+
+        std::vector<MulChain> candidates;
+        getMulChainCandidates(C, candidates);
+
+        unsigned bestLatency = mulLatency;
+        unsigned bestInstructions = 0;
+        bool found = false;
+
+        for (const MulChain& chain: candidates) {
+
+            // Never trust a candidate which does not compute the right product
+            if (chain.evaluate(C.getBitWidth()) != C) {
+                continue;
+            }
+
+            unsigned latency, instructions;
+            getMulChainCost(chain, type, TTI, latency, instructions);
+
+            if (instructions > MaxMulChainLength) {
+                continue;
+            }
+
+            if (latency < bestLatency || (found && latency == bestLatency && instructions < bestInstructions)) {
+                best = chain;
+                bestLatency = latency;
+                bestInstructions = instructions;
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    // Fold two floating point constants with the semantics of the opcode, rounding
+    // to nearest even as the default floating point environment does. Operations
+    // which create a NaN (0/0, inf-inf) or take one are left to run: the sign and
+    // payload of the NaN they produce depend on the target. Under a denormal mode
+    // other than IEEE, the hardware flushes denormal operands and results, so those
+    // are left alone too.
+    bool foldFPConstants(unsigned opcode, const APFloat& left, const APFloat* right,
+        DenormalMode mode, APFloat& result) {
+
+        if (left.isNaN() || (right && right->isNaN())) {
+            return false;
+        }
+
+        result = left;
+        APFloat::opStatus status = APFloat::opOK;
+
+        switch (opcode) {
+            case Instruction::FNeg: result.changeSign(); break;
+            case Instruction::FAdd: status = result.add(*right, APFloat::rmNearestTiesToEven); break;
+            case Instruction::FSub: status = result.subtract(*right, APFloat::rmNearestTiesToEven); break;
+            case Instruction::FMul: status = result.multiply(*right, APFloat::rmNearestTiesToEven); break;
+            case Instruction::FDiv: status = result.divide(*right, APFloat::rmNearestTiesToEven); break;
+            case Instruction::FRem: status = result.mod(*right); break;
+            default:
+                return false;
+        }
+
+        if ((status & APFloat::opInvalidOp) || result.isNaN()) {
+            return false;
+        }
+
+        if (mode != DenormalMode::getIEEE() &&
+            (left.isDenormal() || (right && right->isDenormal()) || result.isDenormal())) {
+            return false;
+        }
+
+        return true;
+    }
+
+    DenormalMode getDenormalMode(Instruction* op) {
+        return op->getFunction()->getDenormalMode(op->getType()->getScalarType()->getFltSemantics());
+    }
+
+    // Fold op for floating point constants, or fixed-width vectors of them, as
+    // foldConstantOperands() does for integers; right is nullptr for fneg
+    Constant* foldFPConstantOperands(Instruction* op, Value* left, Value* right) {
+
+        Type* type = op->getType();
+        DenormalMode mode = getDenormalMode(op);
+
+        const APFloat *lvalue, *rvalue = nullptr;
+        APFloat result(0.0);
+
+        // Scalars and splat vectors
+        if (match(left, m_APFloat(lvalue)) && (!right || match(right, m_APFloat(rvalue)))) {
+
+            if (!foldFPConstants(op->getOpcode(), *lvalue, rvalue, mode, result)) {
+                return nullptr;
+            }
+
+            return ConstantFP::get(type, result);
+        }
+
+        // Fixed-width vectors with different constants per lane are folded lane by lane
+        auto* vectorType = dyn_cast<FixedVectorType>(type);
+        Constant* leftVector = dyn_cast<Constant>(left);
+        Constant* rightVector = right ? dyn_cast<Constant>(right) : nullptr;
+
+        if (!vectorType || !leftVector || (right && !rightVector)) {
+            return nullptr;
+        }
+
+        std::vector<Constant *> lanes;
+
+        for (unsigned i = 0; i < vectorType->getNumElements(); i++) {
+
+            auto* leftLane = dyn_cast_or_null<ConstantFP>(leftVector->getAggregateElement(i));
+            auto* rightLane = right ? dyn_cast_or_null<ConstantFP>(rightVector->getAggregateElement(i)) : nullptr;
+
+            if (!leftLane || (right && !rightLane) ||
+                !foldFPConstants(op->getOpcode(), leftLane->getValueAPF(),
+                    rightLane ? &rightLane->getValueAPF() : nullptr, mode, result)) {
+                return nullptr;
+            }
+
+            lanes.push_back(ConstantFP::get(vectorType->getElementType(), result));
+        }
+
+        return ConstantVector::get(lanes);
+    }
+
+    Value* foldFPRule(Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) {
+        return foldFPConstantOperands(op, left, right);
+    }
+
+    // The reciprocal 1/C of a floating point constant (scalar or splat) for x/C -> x*(1/C).
+    // Without approximate reciprocals (arcp), only reciprocals which are exact, so that
+    // the multiply rounds to the same result as the division: C must be a power of two
+    // whose reciprocal is a normal number. With arcp, any finite nonzero C whose
+    // reciprocal is a finite normal number.
+    Constant* getReciprocal(Instruction* op, Value* right) {
+
+        const APFloat* C;
+        if (!match(right, m_APFloat(C))) {
+            return nullptr;
+        }
+
+        APFloat reciprocal(C->getSemantics());
+
+        if (C->getExactInverse(&reciprocal)) {
+            return ConstantFP::get(op->getType(), reciprocal);
+        }
+
+        if (!op->hasAllowReciprocal() || !C->isFiniteNonZero()) {
+            return nullptr;
+        }
+
+        reciprocal = APFloat(C->getSemantics(), 1);
+        APFloat::opStatus status = reciprocal.divide(*C, APFloat::rmNearestTiesToEven);
+
+        if ((status & (APFloat::opOverflow | APFloat::opUnderflow)) || !reciprocal.isNormal()) {
+            return nullptr;
+        }
+
+        return ConstantFP::get(op->getType(), reciprocal);
+    }
+
+    const Rule rules[] = {
+
+        // Constant folding, for every supported opcode
+        { Instruction::Add,  ConstantFolding, "C1+C2 -> C", foldRule },
+        { Instruction::Sub,  ConstantFolding, "C1-C2 -> C", foldRule },
+        { Instruction::Mul,  ConstantFolding, "C1*C2 -> C", foldRule },
+        { Instruction::UDiv, ConstantFolding, "C1/C2 -> C", foldRule },
+        { Instruction::SDiv, ConstantFolding, "C1/C2 -> C", foldRule },
+        { Instruction::URem, ConstantFolding, "C1%C2 -> C", foldRule },
+        { Instruction::SRem, ConstantFolding, "C1%C2 -> C", foldRule },
+        { Instruction::And,  ConstantFolding, "C1&C2 -> C", foldRule },
+        { Instruction::Or,   ConstantFolding, "C1|C2 -> C", foldRule },
+        { Instruction::Xor,  ConstantFolding, "C1^C2 -> C", foldRule },
+        { Instruction::Shl,  ConstantFolding, "C1<<C2 -> C", foldRule },
+        { Instruction::LShr, ConstantFolding, "C1>>C2 -> C", foldRule },
+        { Instruction::AShr, ConstantFolding, "C1>>C2 -> C", foldRule },
+
+        // Addition and subtraction
+        { Instruction::Add, StrengthReduction, "x+0 -> x", rightZeroIdentity },
+        { Instruction::Sub, StrengthReduction, "x-0 -> x", rightZeroIdentity },
+        { Instruction::Sub, StrengthReduction, "x-x -> 0", selfZero },
+
+        // Multiplication
+        { Instruction::Mul, StrengthReduction, "x*0 -> 0", rightZeroAbsorbs },
+        { Instruction::Mul, StrengthReduction, "x*1 -> x", rightOneIdentity },
+        { Instruction::Mul, StrengthReduction, "x*-1 -> 0-x",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                return match(right, m_AllOnes()) ? builder.CreateNeg(left) : nullptr;
+            } },
+        { Instruction::Mul, StrengthReduction, "x*2^k -> x<<k",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* C;
+                if (!match(right, m_APInt(C)) || !C->isPowerOf2()) {
+                    return nullptr;
+                }
+                return builder.CreateShl(left, C->logBase2(), "", op->hasNoUnsignedWrap());
+            } },
+        { Instruction::Mul, StrengthReduction, "x*<2^k...> -> x<<<k...>",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                Constant* shifts = getLaneLog2(right);
+                return shifts ? builder.CreateShl(left, shifts, "", op->hasNoUnsignedWrap()) : nullptr;
+            } },
+        { Instruction::Mul, StrengthReduction, "x*C -> shift/add chain",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* C;
+                MulChain chain;
+                if (!match(right, m_APInt(C)) || !chooseMulChain(*C, op->getType(), builder.TTI, chain)) {
+                    return nullptr;
+                }
+                return chain.emit(builder, left);
+            } },
+
+        // Division
+        { Instruction::UDiv, StrengthReduction, "x/1 -> x", rightOneIdentity },
+        { Instruction::SDiv, StrengthReduction, "x/1 -> x", rightOneIdentity },
+        { Instruction::UDiv, StrengthReduction, "0/x -> 0", leftZeroAbsorbs },
+        { Instruction::SDiv, StrengthReduction, "0/x -> 0", leftZeroAbsorbs },
+        { Instruction::UDiv, StrengthReduction, "x/x -> 1",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return left == right ? ConstantInt::get(op->getType(), 1) : nullptr;
+            } },
+        { Instruction::SDiv, StrengthReduction, "x/x -> 1",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return left == right ? ConstantInt::get(op->getType(), 1) : nullptr;
+            } },
+        { Instruction::SDiv, StrengthReduction, "x/-1 -> 0-x",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                return match(right, m_AllOnes()) ? builder.CreateNeg(left) : nullptr;
+            } },
+        { Instruction::UDiv, StrengthReduction, "x/2^k -> x>>k",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* C;
+                if (!match(right, m_APInt(C)) || !C->isPowerOf2()) {
+                    return nullptr;
+                }
+                return builder.CreateLShr(left, C->logBase2(), "", op->isExact());
+            } },
+        { Instruction::UDiv, StrengthReduction, "x/<2^k...> -> x>><k...>",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                Constant* shifts = getLaneLog2(right);
+                return shifts ? builder.CreateLShr(left, shifts, "", op->isExact()) : nullptr;
+            } },
+
+        // An arithmetic shift rounds towards negative infinity, so it only matches
+        // signed division when the division is known to be exact
+        { Instruction::SDiv, StrengthReduction, "x/2^k -> x>>k (exact)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* C;
+                if (!op->isExact() || !match(right, m_APInt(C)) ||
+                    !C->isNonNegative() || !C->isPowerOf2()) {
+                    return nullptr;
+                }
+                return builder.CreateAShr(left, C->logBase2(), "", true);
+            } },
+
+        // Without the exact flag, the shift is only correct for dividends known to be
+        // non-negative; otherwise the dividend is biased to round towards zero
+        { Instruction::SDiv, KnownBitsFolding, "x/2^k -> x>>k (x >= 0)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                unsigned shift;
+                if (!matchSignedPowerOf2(right, shift) || !isNonNegative(left, op)) {
+                    return nullptr;
+                }
+                return builder.CreateLShr(left, shift, "", op->isExact());
+            } },
+        { Instruction::SDiv, StrengthReduction, "x/2^k -> (x+bias)>>k",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                unsigned shift;
+                if (!matchSignedPowerOf2(right, shift)) {
+                    return nullptr;
+                }
+                return builder.CreateAShr(createBiasedDividend(builder, left, shift), shift);
+            } },
+        { Instruction::SDiv, StrengthReduction, "x/-2^k -> -((x+bias)>>k)",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* C;
+                if (!match(right, m_APInt(C)) || !C->isNegative() || C->isMinSignedValue() ||
+                    C->isAllOnesValue() || !(-*C).isPowerOf2()) {
+                    return nullptr;
+                }
+                unsigned shift = (-*C).logBase2();
+                return builder.CreateNeg(builder.CreateAShr(createBiasedDividend(builder, left, shift), shift));
+            } },
+
+        // Any other constant divisor: multiply-high by a magic number, then shift
+        { Instruction::UDiv, StrengthReduction, "x/C -> mulhi(x,M)>>s",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* d;
+                if (!matchMagicDivisor(op, right, d, false)) {
+                    return nullptr;
+                }
+                return createUnsignedDivision(builder, left, *d);
+            } },
+        { Instruction::SDiv, StrengthReduction, "x/C -> mulhi(x,M)>>s",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* d;
+                if (!matchMagicDivisor(op, right, d, true)) {
+                    return nullptr;
+                }
+                return createSignedDivision(builder, left, *d);
+            } },
+
+        // Remainder
+        { Instruction::URem, StrengthReduction, "x%1 -> 0",
+            [](Instruction* op, Value* /*left*/, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return match(right, m_One()) ? Constant::getNullValue(op->getType()) : nullptr;
+            } },
+        { Instruction::SRem, StrengthReduction, "x%1 -> 0",
+            [](Instruction* op, Value* /*left*/, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return match(right, m_One()) || match(right, m_AllOnes()) ?
+                    Constant::getNullValue(op->getType()) : nullptr;
+            } },
+        { Instruction::URem, StrengthReduction, "0%x -> 0", leftZeroAbsorbs },
+        { Instruction::SRem, StrengthReduction, "0%x -> 0", leftZeroAbsorbs },
+        { Instruction::URem, StrengthReduction, "x%x -> 0", selfZero },
+        { Instruction::SRem, StrengthReduction, "x%x -> 0", selfZero },
+        { Instruction::URem, StrengthReduction, "x%2^k -> x&(2^k-1)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* C;
+                if (!match(right, m_APInt(C)) || !C->isPowerOf2()) {
+                    return nullptr;
+                }
+                return builder.CreateAnd(left, ConstantInt::get(op->getType(), *C - 1));
+            } },
+        { Instruction::SRem, KnownBitsFolding, "x%2^k -> x&(2^k-1) (x >= 0)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* C;
+                if (!match(right, m_APInt(C)) || C->isMinSignedValue() ||
+                    !C->abs().isPowerOf2() || !isNonNegative(left, op)) {
+                    return nullptr;
+                }
+                return builder.CreateAnd(left, ConstantInt::get(op->getType(), C->abs() - 1));
+            } },
+
+        // The remainder takes the sign of the dividend, so x % -2^k == x % 2^k
+        { Instruction::SRem, StrengthReduction, "x%2^k -> x-((x+bias)&-2^k)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* C;
+                if (!match(right, m_APInt(C)) || C->isMinSignedValue() || !C->abs().isPowerOf2()) {
+                    return nullptr;
+                }
+                APInt divisor = C->abs();
+                Value* biased = createBiasedDividend(builder, left, divisor.logBase2());
+                Value* rounded = builder.CreateAnd(biased, ConstantInt::get(op->getType(), -divisor));
+                return builder.CreateSub(left, rounded);
+            } },
+        { Instruction::URem, StrengthReduction, "x%C -> x-(x/C)*C",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* d;
+                if (!matchMagicDivisor(op, right, d, false)) {
+                    return nullptr;
+                }
+                Value* q = createUnsignedDivision(builder, left, *d);
+                return builder.CreateSub(left, builder.CreateMul(q, right));
+            } },
+        { Instruction::SRem, StrengthReduction, "x%C -> x-(x/C)*C",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                const APInt* d;
+                if (!matchMagicDivisor(op, right, d, true)) {
+                    return nullptr;
+                }
+                Value* q = createSignedDivision(builder, left, *d);
+                return builder.CreateSub(left, builder.CreateMul(q, right));
+            } },
+
+        // Bitwise operators
+        { Instruction::And, StrengthReduction, "x&0 -> 0", rightZeroAbsorbs },
+        { Instruction::And, StrengthReduction, "x&~0 -> x",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return match(right, m_AllOnes()) ? left : nullptr;
+            } },
+        { Instruction::And, StrengthReduction, "x&x -> x", idempotent },
+        { Instruction::And, KnownBitsFolding, "x&C -> x (C keeps every possible one bit)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                const APInt* C;
+                if (!match(right, m_APInt(C)) || !(getKnownBits(left, op).Zero | *C).isAllOnesValue()) {
+                    return nullptr;
+                }
+                return left;
+            } },
+        { Instruction::And, KnownBitsFolding, "x&C -> 0 (C only keeps known zero bits)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                const APInt* C;
+                if (!match(right, m_APInt(C)) || !(getKnownBits(left, op).Zero | ~*C).isAllOnesValue()) {
+                    return nullptr;
+                }
+                return Constant::getNullValue(op->getType());
+            } },
+        { Instruction::Or,  StrengthReduction, "x|0 -> x", rightZeroIdentity },
+        { Instruction::Or,  StrengthReduction, "x|~0 -> ~0",
+            [](Instruction* /*op*/, Value* /*left*/, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return match(right, m_AllOnes()) ? right : nullptr;
+            } },
+        { Instruction::Or,  StrengthReduction, "x|x -> x", idempotent },
+        { Instruction::Or,  KnownBitsFolding, "x|C -> x (C only sets known one bits)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                const APInt* C;
+                if (!match(right, m_APInt(C)) || !C->isSubsetOf(getKnownBits(left, op).One)) {
+                    return nullptr;
+                }
+                return left;
+            } },
+        { Instruction::Xor, StrengthReduction, "x^0 -> x", rightZeroIdentity },
+        { Instruction::Xor, StrengthReduction, "x^x -> 0", selfZero },
+
+        // Shifts
+        { Instruction::Shl,  StrengthReduction, "x<<0 -> x", rightZeroIdentity },
+        { Instruction::LShr, StrengthReduction, "x>>0 -> x", rightZeroIdentity },
+        { Instruction::AShr, StrengthReduction, "x>>0 -> x", rightZeroIdentity },
+        { Instruction::Shl,  StrengthReduction, "0<<x -> 0", leftZeroAbsorbs },
+        { Instruction::LShr, StrengthReduction, "0>>x -> 0", leftZeroAbsorbs },
+        { Instruction::AShr, StrengthReduction, "0>>x -> 0", leftZeroAbsorbs },
+        { Instruction::AShr, StrengthReduction, "~0>>x -> ~0",
+            [](Instruction* /*op*/, Value* left, Value* /*right*/, RuleBuilder& /*builder*/) -> Value* {
+                return match(left, m_AllOnes()) ? left : nullptr;
+            } },
+
+        // Extension round-trips
+        { Instruction::Trunc, StrengthReduction, "trunc(ext x) -> x",
+            [](Instruction* op, Value* left, Value* /*right*/, RuleBuilder& /*builder*/) -> Value* {
+                Value* x;
+                if (!match(left, m_ZExtOrSExt(m_Value(x))) || x->getType() != op->getType()) {
+                    return nullptr;
+                }
+                return x;
+            } },
+        { Instruction::ZExt, KnownBitsFolding, "zext(trunc x) -> x (high bits of x are zero)",
+            [](Instruction* op, Value* left, Value* /*right*/, RuleBuilder& /*builder*/) -> Value* {
+                Value* x;
+                if (!match(left, m_Trunc(m_Value(x))) || x->getType() != op->getType()) {
+                    return nullptr;
+                }
+                unsigned droppedBits = x->getType()->getScalarSizeInBits() - left->getType()->getScalarSizeInBits();
+                return getKnownBits(x, op).countMinLeadingZeros() >= droppedBits ? x : nullptr;
+            } },
+        { Instruction::SExt, KnownBitsFolding, "sext(trunc x) -> x (high bits of x are sign bits)",
+            [](Instruction* op, Value* left, Value* /*right*/, RuleBuilder& /*builder*/) -> Value* {
+                Value* x;
+                if (!match(left, m_Trunc(m_Value(x))) || x->getType() != op->getType()) {
+                    return nullptr;
+                }
+                unsigned droppedBits = x->getType()->getScalarSizeInBits() - left->getType()->getScalarSizeInBits();
+                return getSignBits(x, op) > droppedBits ? x : nullptr;
+            } },
+
+        // Vector lanes
+        { Instruction::ExtractElement, ConstantFolding, "extract(C, i) -> C[i]",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                Constant* vector = dyn_cast<Constant>(left);
+                ConstantInt* index = dyn_cast<ConstantInt>(right);
+                if (!vector || !index || !isa<FixedVectorType>(left->getType()) ||
+                    index->getValue().uge(cast<FixedVectorType>(left->getType())->getNumElements())) {
+                    return nullptr;
+                }
+                return dyn_cast_or_null<ConstantInt>(vector->getAggregateElement(index->getZExtValue()));
+            } },
+        { Instruction::ExtractElement, StrengthReduction, "extract(insert(v, x, i), i) -> x",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                InsertElementInst* insert = dyn_cast<InsertElementInst>(left);
+                if (!insert || !isa<ConstantInt>(right) || insert->getOperand(2) != right) {
+                    return nullptr;
+                }
+                return insert->getOperand(1);
+            } },
+
+        // Floating point constant folding, rounded to nearest even
+        { Instruction::FAdd, ConstantFolding, "C1+C2 -> C", foldFPRule },
+        { Instruction::FSub, ConstantFolding, "C1-C2 -> C", foldFPRule },
+        { Instruction::FMul, ConstantFolding, "C1*C2 -> C", foldFPRule },
+        { Instruction::FDiv, ConstantFolding, "C1/C2 -> C", foldFPRule },
+        { Instruction::FRem, ConstantFolding, "C1%C2 -> C", foldFPRule },
+        { Instruction::FNeg, ConstantFolding, "-C -> C", foldFPRule },
+
+        // Floating point rewrites. Those without a condition give the same result for
+        // every operand, signed zeros and NaNs included; the others need the fast-math
+        // flags named in their pattern. fneg flips the sign of a NaN where arithmetic
+        // keeps it, hence nnan on the rules which introduce or remove one.
+        { Instruction::FAdd, StrengthReduction, "x+(-0.0) -> x",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return match(right, m_NegZeroFP()) ? left : nullptr;
+            } },
+        { Instruction::FAdd, StrengthReduction, "x+0.0 -> x (nsz)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return op->hasNoSignedZeros() && match(right, m_PosZeroFP()) ? left : nullptr;
+            } },
+        { Instruction::FSub, StrengthReduction, "x-0.0 -> x",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return match(right, m_PosZeroFP()) ? left : nullptr;
+            } },
+        { Instruction::FSub, StrengthReduction, "x-(-0.0) -> x (nsz)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return op->hasNoSignedZeros() && match(right, m_NegZeroFP()) ? left : nullptr;
+            } },
+        { Instruction::FSub, StrengthReduction, "x-x -> 0.0 (nnan)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return op->hasNoNaNs() && left == right ? Constant::getNullValue(op->getType()) : nullptr;
+            } },
+        { Instruction::FSub, StrengthReduction, "-0.0-x -> -x (nnan)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                return op->hasNoNaNs() && match(left, m_NegZeroFP()) ? builder.CreateFNegFMF(right, op) : nullptr;
+            } },
+        { Instruction::FSub, StrengthReduction, "0.0-x -> -x (nnan nsz)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                if (!op->hasNoNaNs() || !op->hasNoSignedZeros() || !match(left, m_PosZeroFP())) {
+                    return nullptr;
+                }
+                return builder.CreateFNegFMF(right, op);
+            } },
+        { Instruction::FMul, StrengthReduction, "x*1.0 -> x",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return match(right, m_FPOne()) ? left : nullptr;
+            } },
+        { Instruction::FMul, StrengthReduction, "x*2.0 -> x+x",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                return match(right, m_SpecificFP(2.0)) ? builder.CreateFAddFMF(left, left, op) : nullptr;
+            } },
+        { Instruction::FMul, StrengthReduction, "x*-1.0 -> -x (nnan)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                return op->hasNoNaNs() && match(right, m_SpecificFP(-1.0)) ? builder.CreateFNegFMF(left, op) : nullptr;
+            } },
+        { Instruction::FMul, StrengthReduction, "x*0.0 -> 0.0 (nnan nsz)",
+            [](Instruction* op, Value* /*left*/, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                if (!op->hasNoNaNs() || !op->hasNoSignedZeros() || !match(right, m_AnyZeroFP())) {
+                    return nullptr;
+                }
+                return Constant::getNullValue(op->getType());
+            } },
+        { Instruction::FMul, StrengthReduction, "(-x)*(-y) -> x*y (nnan)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                Value *x, *y;
+                if (!op->hasNoNaNs() || !match(left, m_FNeg(m_Value(x))) || !match(right, m_FNeg(m_Value(y)))) {
+                    return nullptr;
+                }
+                return builder.CreateFMulFMF(x, y, op);
+            } },
+        { Instruction::FMul, StrengthReduction, "(-x)*C -> x*(-C) (nnan)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                Value* x;
+                const APFloat* C;
+                if (!op->hasNoNaNs() || !match(left, m_FNeg(m_Value(x))) || !match(right, m_APFloat(C))) {
+                    return nullptr;
+                }
+                return builder.CreateFMulFMF(x, ConstantFP::get(op->getType(), neg(*C)), op);
+            } },
+        { Instruction::FDiv, StrengthReduction, "x/1.0 -> x",
+            [](Instruction* /*op*/, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return match(right, m_FPOne()) ? left : nullptr;
+            } },
+        { Instruction::FDiv, StrengthReduction, "x/-1.0 -> -x (nnan)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                return op->hasNoNaNs() && match(right, m_SpecificFP(-1.0)) ? builder.CreateFNegFMF(left, op) : nullptr;
+            } },
+        { Instruction::FDiv, StrengthReduction, "x/x -> 1.0 (nnan)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                return op->hasNoNaNs() && left == right ? ConstantFP::get(op->getType(), 1.0) : nullptr;
+            } },
+        { Instruction::FDiv, StrengthReduction, "(-x)/C -> x/(-C) (nnan)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                Value* x;
+                const APFloat* C;
+                if (!op->hasNoNaNs() || !match(left, m_FNeg(m_Value(x))) || !match(right, m_APFloat(C))) {
+                    return nullptr;
+                }
+                return builder.CreateFDivFMF(x, ConstantFP::get(op->getType(), neg(*C)), op);
+            } },
+        { Instruction::FDiv, StrengthReduction, "x/C -> x*(1/C) (exact 1/C, or arcp)",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& builder) -> Value* {
+                Constant* reciprocal = getReciprocal(op, right);
+                return reciprocal ? builder.CreateFMulFMF(left, reciprocal, op) : nullptr;
+            } },
+        { Instruction::FNeg, StrengthReduction, "-(-x) -> x",
+            [](Instruction* op, Value* left, Value* /*right*/, RuleBuilder& /*builder*/) -> Value* {
+                // m_FNeg also matches -0.0-x, which keeps the sign of a NaN x, so
+                // it only cancels with nnan
+                Value* x;
+                if ((isa<UnaryOperator>(left) || op->hasNoNaNs()) && match(left, m_FNeg(m_Value(x)))) {
+                    return x;
+                }
+                return nullptr;
+            } },
+        { Instruction::FNeg, StrengthReduction, "-(x-y) -> y-x (nnan nsz)",
+            [](Instruction* op, Value* left, Value* /*right*/, RuleBuilder& builder) -> Value* {
+                Value *x, *y;
+                if (!op->hasNoNaNs() || !op->hasNoSignedZeros() || !left->hasOneUse() ||
+                    !match(left, m_FSub(m_Value(x), m_Value(y)))) {
+                    return nullptr;
+                }
+
+                // The flags which hold for both the negation and the subtraction
+                FastMathFlags flags = op->getFastMathFlags();
+                flags &= cast<Instruction>(left)->getFastMathFlags();
+
+                Value* result = builder.CreateFSub(y, x);
+                if (Instruction* sub = dyn_cast<Instruction>(result)) {
+                    sub->setFastMathFlags(flags);
+                }
+                return result;
+            } },
+
+        // Comparisons decided by the known bits of both operands
+        { Instruction::ICmp, KnownBitsFolding, "icmp -> true/false",
+            [](Instruction* op, Value* left, Value* right, RuleBuilder& /*builder*/) -> Value* {
+                if (!left->getType()->isIntOrIntVectorTy()) {
+                    return nullptr;
+                }
+
+                ICmpInst* cmp = cast<ICmpInst>(op);
+                ICmpInst::Predicate pred = cmp->getPredicate();
+                bool isSigned = cmp->isSigned();
+
+                // Conflicting facts only arise in unreachable code
+                KnownBits leftKnown = getKnownBits(left, op);
+                KnownBits rightKnown = getKnownBits(right, op);
+                if (leftKnown.hasConflict() || rightKnown.hasConflict()) {
+                    return nullptr;
+                }
+
+                ConstantRange leftRange = ConstantRange::fromKnownBits(leftKnown, isSigned);
+                ConstantRange rightRange = ConstantRange::fromKnownBits(rightKnown, isSigned);
+
+                if (ConstantRange::makeSatisfyingICmpRegion(pred, rightRange).contains(leftRange)) {
+                    return ConstantInt::getTrue(op->getType());
+                }
+                if (ConstantRange::makeSatisfyingICmpRegion(cmp->getInversePredicate(), rightRange).contains(leftRange)) {
+                    return ConstantInt::getFalse(op->getType());
+                }
+                return nullptr;
+            } },
+    };
+
+    struct StrengthReductionConstFolding {
+        StrengthReductionConstFolding() {
+
+            // Index the rule table by opcode, keeping the table order within an opcode
+            for (const Rule& rule: rules) {
+                rulesByOpcode[rule.opcode].push_back(&rule);
+            }
+
+        }
+
+        std::vector<const Rule *> rulesByOpcode[Instruction::OtherOpsEnd];
+
+        // TTI is the target cost model, for rules which replace one instruction with several
+        bool run(Function& function, const TargetTransformInfo& TTI,
+            OptimizationRemarkEmitter& ORE) const {
+
+            // Vector of instructions to delete at the end of the pass (void instructions)
+            std::vector<Instruction *> instsToDelete;
+
+            LLVM_DEBUG(dbgs() << "Starting Strength Reduction & Constant Folding pass "
+                "for function: '" << function.getName() << "':\n");
+
+            // Iterate through each basic block of the function
+            for (auto& block: function) {
+
+                // Iterate through each instruction in the basic block
+                for (auto& instruction: block) {
+
+                    Instruction* op = &instruction;
+
+                    const Rule* rule;
+                    Value* result = simplify(op, TTI, rule);
+                    if (!result) {
+                        continue;
+                    }
+
+                    switch (rule->kind) {
+                        case ConstantFolding:   NumConstantFolded++; break;
+                        case StrengthReduction: NumStrengthReduced++; break;
+                        case KnownBitsFolding:  NumKnownBitsFolded++; break;
+                    }
+
+                    ORE.emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, getRemarkName(rule->kind), op)
+                            << ore::NV("Kind", getKindName(rule->kind)) << ": "
+                            << ore::NV("Pattern", rule->pattern);
+                    });
+
+                    // Replace all uses of op with the result
+                    op->replaceAllUsesWith(result);
+
+                    // Prepare to delete instruction
+                    instsToDelete.push_back(op);
+                }
+            }
+
+            LLVM_DEBUG(dbgs() << "Strength Reduction & Constant Folding pass complete!\n\n");
 
-            errs() << "Strength Reduction & Constant Folding pass complete!\n\n";
-                
             // Delete all the unnecessary instructions
             for(auto i: instsToDelete) {
                 i->eraseFromParent();
             }
 
-            return true;
+            return !instsToDelete.empty();
+
+        }
+
+        // Apply the first matching rule to op. New instructions are inserted right
+        // before op; the value replacing op is returned, or nullptr if no rule matched.
+        // matched is set to the rule which was applied.
+        Value* simplify(Instruction* op, const TargetTransformInfo& TTI, const Rule*& matched) const {
+
+            // Only integer and floating point instructions, or fixed-width vectors of
+            // them, with rules for their opcode are rewritten
+            const std::vector<const Rule *>& candidates = rulesByOpcode[op->getOpcode()];
+            Type* type = op->getType();
+            if (candidates.empty() || !(type->isIntOrIntVectorTy() || type->isFPOrFPVectorTy()) ||
+                isa<ScalableVectorType>(type)) {
+                return nullptr;
+            }
+
+            // Strict floating point functions may depend on the rounding mode and the
+            // exceptions raised at run time
+            if (type->isFPOrFPVectorTy() && op->getFunction()->hasFnAttribute(Attribute::StrictFP)) {
+                return nullptr;
+            }
+
+            Value* left = op->getOperand(0);
+            Value* right = op->getNumOperands() > 1 ? op->getOperand(1) : nullptr;
+
+            // Move a lone constant to the right of commutative operators,
+            // so that every rule only has to match one operand order
+            if (isa<BinaryOperator>(op) && op->isCommutative() &&
+                isa<Constant>(left) && !isa<Constant>(right)) {
+                std::swap(left, right);
+            }
+
+            // New instructions are inserted right before the rewritten one
+            RuleBuilder builder(op, TTI);
+
+            for (const Rule* rule: candidates) {
+
+                // An identity rule (x+0, x^0...) returns op itself for an instruction
+                // using itself, which only unreachable blocks can have; replacing op
+                // with itself would never end
+                Value* result = rule->apply(op, left, right, builder);
+                if (!result || result == op) {
+                    continue;
+                }
+
+                LLVM_DEBUG(dbgs() << getKindName(rule->kind) << ": " << rule->pattern << ":" << *op << " -> ";
+                    result->printAsOperand(dbgs(), false);
+                    dbgs() << "\n");
+
+                matched = rule;
+                return result;
+            }
+
+            return nullptr;
+
+        }
+
+    };
+
+    // The rule index is built once and shared by every run
+    const StrengthReductionConstFolding& getSRCF() {
+        static const StrengthReductionConstFolding srcf;
+        return srcf;
+    }
+}
+
+void customopt::SRCFPass::printOptions(raw_ostream& OS) {
+
+    OS << "srcf-mul-latency=" << MulLatency << "\n";
+    OS << "srcf-max-mul-chain=" << MaxMulChainLength << "\n";
+
+}
+
+Constant* customopt::SRCFPass::foldBinaryOperator(BinaryOperator* op, Constant* left, Constant* right) {
+
+    if (op->getType()->isFPOrFPVectorTy()) {
+        return foldFPConstantOperands(op, left, right);
+    }
+
+    if (!op->getType()->isIntOrIntVectorTy()) {
+        return nullptr;
+    }
+
+    return foldConstantOperands(op->getOpcode(), op->getType(), left, right);
+
+}
+
+customopt::SRCFPass::Rewrite customopt::SRCFPass::simplifyInstruction(Instruction* op,
+    const TargetTransformInfo& TTI) {
+
+    Rewrite rewrite;
+
+    const Rule* rule;
+    rewrite.result = getSRCF().simplify(op, TTI, rule);
+    if (rewrite.result) {
+        rewrite.kind = getKindName(rule->kind);
+        rewrite.pattern = rule->pattern;
+    }
+
+    return rewrite;
+
+}
+
+bool customopt::SRCFPass::runImpl(Function& function, const TargetTransformInfo& TTI,
+    OptimizationRemarkEmitter& ORE) {
+
+    return getSRCF().run(function, TTI, ORE);
+
+}
+
+PreservedAnalyses customopt::SRCFPass::run(Function& function, FunctionAnalysisManager& FAM) {
+
+    if (!runImpl(function, FAM.getResult<TargetIRAnalysis>(function),
+        FAM.getResult<OptimizationRemarkEmitterAnalysis>(function))) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+
+}
+
+namespace {
+    struct SRCFLegacyPass : public FunctionPass {
+        static char ID;
+        SRCFLegacyPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.setPreservesCFG();
+            AU.addRequired<TargetTransformInfoWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            return;
+
+        }
 
+        virtual bool runOnFunction(Function& function) override {
+            const TargetTransformInfo& TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(function);
+            OptimizationRemarkEmitter& ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+            return customopt::SRCFPass::runImpl(function, TTI, ORE);
         }
-        
     };
 }
 
-char SRCFPass::ID = 0;
+char SRCFLegacyPass::ID = 0;
 
-static RegisterPass<SRCFPass> X("srcf", "Strength Reduction & Constant Folding", false, true);
+static RegisterPass<SRCFLegacyPass> X("srcf", "Strength Reduction & Constant Folding", false, true);
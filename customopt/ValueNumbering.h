@@ -0,0 +1,209 @@
+#ifndef CUSTOMOPT_VALUENUMBERING_H
+#define CUSTOMOPT_VALUENUMBERING_H
+
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/RecyclingAllocator.h"
+
+#include <memory>
+#include <vector>
+
+// Hash-based value numbering shared by the CSE pass and the fused simplification pass
+namespace customopt {
+
+    // Key of the value numbering table: an instruction which computes a pure
+    // function of its operands. Two keys are equal when the instructions
+    // compute the same value, including commuted operands (a+b == b+a).
+    struct SimpleValue {
+        llvm::Instruction* inst;
+
+        SimpleValue(llvm::Instruction* I) : inst(I) {}
+
+        bool isSentinel() const {
+            return inst == llvm::DenseMapInfo<llvm::Instruction *>::getEmptyKey() ||
+                inst == llvm::DenseMapInfo<llvm::Instruction *>::getTombstoneKey();
+        }
+
+        // Only instructions without side effects or memory accesses can be numbered
+        static bool canHandle(llvm::Instruction* ins) {
+            return llvm::isa<llvm::BinaryOperator>(ins) || llvm::isa<llvm::UnaryOperator>(ins) ||
+                llvm::isa<llvm::CastInst>(ins) || llvm::isa<llvm::CmpInst>(ins) ||
+                llvm::isa<llvm::SelectInst>(ins) || llvm::isa<llvm::GetElementPtrInst>(ins) ||
+                llvm::isa<llvm::ExtractValueInst>(ins) || llvm::isa<llvm::InsertValueInst>(ins) ||
+                llvm::isa<llvm::ExtractElementInst>(ins) || llvm::isa<llvm::InsertElementInst>(ins) ||
+                llvm::isa<llvm::ShuffleVectorInst>(ins);
+        }
+    };
+}
+
+namespace llvm {
+    template <> struct DenseMapInfo<customopt::SimpleValue> {
+        static inline customopt::SimpleValue getEmptyKey() {
+            return DenseMapInfo<Instruction *>::getEmptyKey();
+        }
+
+        static inline customopt::SimpleValue getTombstoneKey() {
+            return DenseMapInfo<Instruction *>::getTombstoneKey();
+        }
+
+        static unsigned getHashValue(customopt::SimpleValue val) {
+
+            Instruction* ins = val.inst;
+
+            // Commutative binary operators hash their operands in a fixed order
+            if (BinaryOperator* op = dyn_cast<BinaryOperator>(ins)) {
+
+                Value* left = op->getOperand(0);
+                Value* right = op->getOperand(1);
+
+                if (op->isCommutative() && left > right) {
+                    std::swap(left, right);
+                }
+
+                return hash_combine(op->getOpcode(), left, right);
+            }
+
+            // Comparisons are canonicalized by swapping the predicate with the operands
+            if (CmpInst* cmp = dyn_cast<CmpInst>(ins)) {
+
+                Value* left = cmp->getOperand(0);
+                Value* right = cmp->getOperand(1);
+                CmpInst::Predicate pred = cmp->getPredicate();
+
+                if (left > right) {
+                    std::swap(left, right);
+                    pred = cmp->getSwappedPredicate();
+                }
+
+                return hash_combine(cmp->getOpcode(), pred, left, right);
+            }
+
+            if (ExtractValueInst* ev = dyn_cast<ExtractValueInst>(ins)) {
+                return hash_combine(ev->getOpcode(), ev->getAggregateOperand(),
+                    hash_combine_range(ev->idx_begin(), ev->idx_end()));
+            }
+
+            if (InsertValueInst* iv = dyn_cast<InsertValueInst>(ins)) {
+                return hash_combine(iv->getOpcode(), iv->getAggregateOperand(),
+                    iv->getInsertedValueOperand(),
+                    hash_combine_range(iv->idx_begin(), iv->idx_end()));
+            }
+
+            // The shuffle mask is not an operand, so it has to be hashed separately
+            if (ShuffleVectorInst* shuffle = dyn_cast<ShuffleVectorInst>(ins)) {
+                ArrayRef<int> mask = shuffle->getShuffleMask();
+                return hash_combine(shuffle->getOpcode(), shuffle->getType(),
+                    shuffle->getOperand(0), shuffle->getOperand(1),
+                    hash_combine_range(mask.begin(), mask.end()));
+            }
+
+            // Everything else (casts, selects, GEPs, unary ops, vector element
+            // accesses) hashes all of its operands
+            return hash_combine(ins->getOpcode(), ins->getType(),
+                hash_combine_range(ins->value_op_begin(), ins->value_op_end()));
+        }
+
+        static bool isEqual(customopt::SimpleValue lhs, customopt::SimpleValue rhs) {
+
+            Instruction* left = lhs.inst;
+            Instruction* right = rhs.inst;
+
+            if (lhs.isSentinel() || rhs.isSentinel()) {
+                return left == right;
+            }
+
+            if (left->getOpcode() != right->getOpcode()) {
+                return false;
+            }
+
+            if (left->isIdenticalTo(right)) {
+                return true;
+            }
+
+            // a op b == b op a, as long as the flags (nsw, nuw, exact, fast-math) agree
+            if (BinaryOperator* lop = dyn_cast<BinaryOperator>(left)) {
+
+                BinaryOperator* rop = cast<BinaryOperator>(right);
+
+                return lop->isCommutative() &&
+                    lop->getType() == rop->getType() &&
+                    lop->getRawSubclassOptionalData() == rop->getRawSubclassOptionalData() &&
+                    lop->getOperand(0) == rop->getOperand(1) &&
+                    lop->getOperand(1) == rop->getOperand(0);
+            }
+
+            // a < b == b > a
+            if (CmpInst* lcmp = dyn_cast<CmpInst>(left)) {
+
+                CmpInst* rcmp = cast<CmpInst>(right);
+
+                return lcmp->getType() == rcmp->getType() &&
+                    lcmp->getRawSubclassOptionalData() == rcmp->getRawSubclassOptionalData() &&
+                    lcmp->getPredicate() == rcmp->getSwappedPredicate() &&
+                    lcmp->getOperand(0) == rcmp->getOperand(1) &&
+                    lcmp->getOperand(1) == rcmp->getOperand(0);
+            }
+
+            return false;
+        }
+    };
+}
+
+namespace customopt {
+
+    // Value numbering table, scoped along the dominator tree. A value visible
+    // in the current scope is defined in a block which dominates the current one.
+    typedef llvm::RecyclingAllocator<llvm::BumpPtrAllocator,
+        llvm::ScopedHashTableVal<SimpleValue, llvm::Value *>> ValueTableAllocatorTy;
+    typedef llvm::ScopedHashTable<SimpleValue, llvm::Value *,
+        llvm::DenseMapInfo<SimpleValue>, ValueTableAllocatorTy> ValueTableTy;
+    typedef llvm::ScopedHashTableScope<SimpleValue, llvm::Value *,
+        llvm::DenseMapInfo<SimpleValue>, ValueTableAllocatorTy> ValueTableScopeTy;
+
+    // Call processBlock on each reachable block in dominator tree preorder, with a
+    // scope of the table (a ValueTableTy, or another ScopedHashTable) opened for the
+    // block and each of its dominators. The walk uses an explicit stack, since deep
+    // trees would overflow the call stack.
+    template <typename TableTy, typename Callback>
+    void walkDominatorTree(llvm::DominatorTree& DT, TableTy& table, Callback processBlock) {
+
+        typedef typename TableTy::ScopeTy ScopeTy;
+
+        struct StackNode {
+            llvm::DomTreeNode* node;
+            llvm::DomTreeNode::const_iterator child;
+            std::unique_ptr<ScopeTy> scope;
+            bool processed = false;
+
+            StackNode(TableTy& table, llvm::DomTreeNode* N)
+                : node(N), child(N->begin()), scope(new ScopeTy(table)) {}
+        };
+
+        std::vector<std::unique_ptr<StackNode>> stack;
+        stack.emplace_back(new StackNode(table, DT.getRootNode()));
+
+        while (!stack.empty()) {
+
+            StackNode* current = stack.back().get();
+
+            if (!current->processed) {
+                processBlock(*current->node->getBlock());
+                current->processed = true;
+            }
+
+            // Descend into the next dominated block, or leave the scope of this one
+            if (current->child != current->node->end()) {
+                llvm::DomTreeNode* next = *current->child++;
+                stack.emplace_back(new StackNode(table, next));
+            }
+            else {
+                stack.pop_back();
+            }
+        }
+    }
+}
+
+#endif
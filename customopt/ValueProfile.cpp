@@ -0,0 +1,688 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <map>
+
+#include "CustomOpt.h"
+#include "ValueNumbering.h"
+
+using namespace llvm;
+using namespace customopt;
+
+#define DEBUG_TYPE "valueprof"
+
+STATISTIC(NumSitesInstrumented, "Number of operands instrumented to record their values");
+STATISTIC(NumSitesVersioned, "Number of instructions versioned for the value their operand usually takes");
+STATISTIC(NumGuardsShared, "Number of versioned instructions sharing the guard of an earlier one");
+STATISTIC(NumFastPathShared, "Number of instructions of a fast path replaced with an identical earlier one");
+STATISTIC(NumStaleSites, "Number of profiled sites which no longer match the instruction at their index");
+
+static cl::opt<std::string> ProfileFilename("valueprof-file", cl::init("customopt.profile"),
+    cl::value_desc("filename"), cl::desc("Value profile read by -valueprof-use"));
+
+static cl::opt<unsigned> MinCount("valueprof-min-count", cl::init(100),
+    cl::desc("Minimum number of times a site ran for -valueprof-use to version it"));
+
+static cl::opt<unsigned> MinPercent("valueprof-min-percent", cl::init(80),
+    cl::desc("Minimum percentage of the runs of a site which took the hot value, for -valueprof-use"));
+
+// The number of values each site counts, CUSTOMOPT_VP_VALUES in ValueProfileRuntime.c
+static const unsigned NumSiteValues = 4;
+
+namespace {
+
+    // An operand whose values are profiled: the divisor of a division or remainder
+    // by a variable, or either operand of a multiply of two variables. A site is
+    // known by its function and its index among the sites of the function, so the
+    // profile must be used at the point of the pipeline where it was generated.
+    struct Site {
+        BinaryOperator* op;
+        unsigned operand;
+    };
+
+    void collectSites(Function& function, std::vector<Site>& sites) {
+
+        for (Instruction& instruction: instructions(function)) {
+
+            BinaryOperator* op = dyn_cast<BinaryOperator>(&instruction);
+            if (!op) {
+                continue;
+            }
+
+            // Values are recorded as 64-bit integers
+            IntegerType* type = dyn_cast<IntegerType>(op->getType());
+            if (!type || type->getBitWidth() > 64) {
+                continue;
+            }
+
+            bool constantLeft = isa<Constant>(op->getOperand(0));
+            bool constantRight = isa<Constant>(op->getOperand(1));
+
+            switch (op->getOpcode()) {
+                case Instruction::UDiv:
+                case Instruction::SDiv:
+                case Instruction::URem:
+                case Instruction::SRem:
+                    if (!constantRight) {
+                        sites.push_back({op, 1});
+                    }
+                    break;
+                case Instruction::Mul:
+                    if (!constantLeft && !constantRight) {
+                        sites.push_back({op, 0});
+                        sites.push_back({op, 1});
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+    }
+
+    // The values recorded for one site, summed over the lines of the profile
+    struct SiteProfile {
+        std::string opcode;
+        uint64_t total = 0;
+        std::map<uint64_t, uint64_t> counts;
+    };
+
+    // A site whose operand usually takes value: count of the total runs of the site
+    struct Hot {
+        Site site;
+        uint64_t value;
+        uint64_t count;
+        uint64_t total;
+    };
+
+    struct ValueProfileInstrumentation {
+
+        Module& module;
+        LLVMContext& context;
+
+        StructType* siteType;
+        FunctionCallee profileValue;
+
+        // The names of functions and opcodes, shared by their sites
+        StringMap<Constant *> strings;
+
+        ValueProfileInstrumentation(Module& module) : module(module), context(module.getContext()) {
+
+            // struct CustomOptValueSite of ValueProfileRuntime.c
+            Type* int64 = Type::getInt64Ty(context);
+            Type* string = Type::getInt8PtrTy(context);
+            ArrayType* table = ArrayType::get(int64, NumSiteValues);
+
+            siteType = StructType::create(context, "customopt.valueprof.site");
+            siteType->setBody({string, string, int64, siteType->getPointerTo(), int64, table, table});
+
+            profileValue = module.getOrInsertFunction("__customopt_profile_value",
+                Type::getVoidTy(context), siteType->getPointerTo(), int64);
+
+        }
+
+        bool run() {
+
+            LLVM_DEBUG(dbgs() << "Starting Value Profile instrumentation "
+                "for module: '" << module.getModuleIdentifier() << "':\n");
+
+            bool changed = false;
+
+            for (Function& function: module) {
+
+                if (function.isDeclaration()) {
+                    continue;
+                }
+
+                std::vector<Site> sites;
+                collectSites(function, sites);
+
+                for (unsigned i = 0; i < sites.size(); i++) {
+                    instrument(function, sites[i], i);
+                    changed = true;
+                }
+            }
+
+            LLVM_DEBUG(dbgs() << "Value Profile instrumentation complete!\n\n");
+
+            return changed;
+
+        }
+
+        Constant* getString(StringRef text) {
+
+            Constant*& string = strings[text];
+            if (!string) {
+                Constant* data = ConstantDataArray::getString(context, text);
+                GlobalVariable* global = new GlobalVariable(module, data->getType(), true,
+                    GlobalValue::PrivateLinkage, data, "__customopt_valueprof_name");
+                global->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+                string = ConstantExpr::getPointerCast(global, Type::getInt8PtrTy(context));
+            }
+            return string;
+
+        }
+
+        // call @__customopt_profile_value(site, zext operand) before the instruction
+        void instrument(Function& function, Site& site, unsigned index) {
+
+            Type* int64 = Type::getInt64Ty(context);
+
+            Constant* initializer = ConstantStruct::get(siteType, {
+                getString(function.getName()),
+                getString(site.op->getOpcodeName()),
+                ConstantInt::get(int64, index),
+                ConstantPointerNull::get(siteType->getPointerTo()),
+                ConstantInt::get(int64, 0),
+                ConstantAggregateZero::get(siteType->getElementType(5)),
+                ConstantAggregateZero::get(siteType->getElementType(6))
+            });
+
+            GlobalVariable* global = new GlobalVariable(module, siteType, false,
+                GlobalValue::PrivateLinkage, initializer, "__customopt_valueprof_site");
+
+            IRBuilder<> builder(site.op);
+            Value* value = builder.CreateZExt(site.op->getOperand(site.operand), int64);
+            builder.CreateCall(profileValue, {global, value});
+
+            NumSitesInstrumented++;
+            LLVM_DEBUG(dbgs() << "Instrumented operand " << site.operand << " of " << *site.op << "\n");
+
+        }
+    };
+
+    struct ValueProfileUse {
+
+        Module& module;
+        function_ref<const TargetTransformInfo&(Function&)> getTTI;
+
+        // The profile of each site, by function and index
+        StringMap<std::map<uint64_t, SiteProfile>> profiles;
+
+        ValueProfileUse(Module& module, function_ref<const TargetTransformInfo&(Function&)> getTTI)
+            : module(module), getTTI(getTTI) {}
+
+        bool run() {
+
+            if (!readProfile()) {
+                return false;
+            }
+
+            LLVM_DEBUG(dbgs() << "Starting Value Profile versioning "
+                "for module: '" << module.getModuleIdentifier() << "':\n");
+
+            bool changed = false;
+
+            for (Function& function: module) {
+
+                auto found = profiles.find(function.getName());
+                if (function.isDeclaration() || found == profiles.end()) {
+                    continue;
+                }
+
+                changed |= processFunction(function, found->second);
+            }
+
+            LLVM_DEBUG(dbgs() << "Value Profile versioning complete!\n\n");
+
+            return changed;
+
+        }
+
+        // <function> <index> <opcode> <total> <value>:<count> ..., one line per site
+        // and run of the program
+        bool readProfile() {
+
+            ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(ProfileFilename);
+            if (!buffer) {
+                module.getContext().diagnose(DiagnosticInfoPGOProfile(ProfileFilename.c_str(),
+                    "cannot read the value profile: " + buffer.getError().message()));
+                return false;
+            }
+
+            for (line_iterator line(**buffer); !line.is_at_eof(); ++line) {
+
+                SmallVector<StringRef, 8> fields;
+                line->split(fields, ' ', -1, false);
+
+                uint64_t index;
+                uint64_t total;
+                if (fields.size() < 4 || fields[1].getAsInteger(10, index) || fields[3].getAsInteger(10, total)) {
+                    module.getContext().diagnose(DiagnosticInfoPGOProfile(ProfileFilename.c_str(),
+                        "malformed value profile line: " + *line, DS_Warning));
+                    continue;
+                }
+
+                SiteProfile& profile = profiles[fields[0]][index];
+                profile.opcode = fields[2].str();
+                profile.total += total;
+
+                for (unsigned i = 4; i < fields.size(); i++) {
+
+                    std::pair<StringRef, StringRef> pair = fields[i].split(':');
+                    uint64_t value;
+                    uint64_t count;
+                    if (pair.first.getAsInteger(10, value) || pair.second.getAsInteger(10, count)) {
+                        continue;
+                    }
+                    profile.counts[value] += count;
+                }
+            }
+
+            return true;
+
+        }
+
+        bool processFunction(Function& function, std::map<uint64_t, SiteProfile>& functionProfile) {
+
+            std::vector<Site> sites;
+            collectSites(function, sites);
+
+            // The hot site of each instruction (a multiply has two)
+            std::vector<Hot> hot;
+            DenseMap<BinaryOperator *, unsigned> hotIndex;
+
+            for (auto& entry: functionProfile) {
+
+                uint64_t index = entry.first;
+                SiteProfile& profile = entry.second;
+
+                if (index >= sites.size() || profile.opcode != sites[index].op->getOpcodeName()) {
+                    NumStaleSites++;
+                    LLVM_DEBUG(dbgs() << "Stale profile for site " << index << " of " << function.getName() << "\n");
+                    continue;
+                }
+
+                // The most frequent value, if it is frequent enough
+                auto best = std::max_element(profile.counts.begin(), profile.counts.end(),
+                    [](const std::pair<const uint64_t, uint64_t>& a, const std::pair<const uint64_t, uint64_t>& b) {
+                        return a.second < b.second;
+                    });
+
+                if (best == profile.counts.end() || profile.total < MinCount ||
+                    best->second * 100 < profile.total * MinPercent) {
+                    continue;
+                }
+
+                Hot candidate = {sites[index], best->first, best->second, profile.total};
+
+                auto inserted = hotIndex.insert({candidate.site.op, unsigned(hot.size())});
+                if (inserted.second) {
+                    hot.push_back(candidate);
+                }
+                else if (hot[inserted.first->second].count < candidate.count) {
+                    hot[inserted.first->second] = candidate;
+                }
+            }
+
+            if (hot.empty()) {
+                return false;
+            }
+
+            // Sites of one block testing the same operand for the same value share one
+            // guard. The sites are in the order of the instructions of the function.
+            std::vector<std::vector<Hot>> groups;
+            std::vector<bool> grouped(hot.size(), false);
+
+            for (size_t i = 0; i < hot.size(); i++) {
+
+                if (grouped[i]) {
+                    continue;
+                }
+
+                groups.emplace_back();
+                groups.back().push_back(hot[i]);
+
+                BinaryOperator* first = hot[i].site.op;
+                Value* profiled = first->getOperand(hot[i].site.operand);
+
+                for (size_t j = i + 1; j < hot.size(); j++) {
+
+                    BinaryOperator* op = hot[j].site.op;
+                    if (grouped[j] || op->getParent() != first->getParent() || hot[j].value != hot[i].value ||
+                        op->getOperand(hot[j].site.operand) != profiled || !canMoveUpTo(op, groups.back())) {
+                        continue;
+                    }
+
+                    groups.back().push_back(hot[j]);
+                    grouped[j] = true;
+                }
+            }
+
+            OptimizationRemarkEmitter ORE(&function);
+            const TargetTransformInfo& TTI = getTTI(function);
+
+            bool changed = false;
+            for (std::vector<Hot>& group: groups) {
+                changed |= version(group, TTI, ORE);
+            }
+
+            return changed;
+
+        }
+
+        // op can run right after the ops of group, in their block: its operands are
+        // computed before the first one or are ops of the group (the remainder of a
+        // quotient), and everything in between runs through, so that op runs whenever the
+        // first one does and a division by zero is not made to run when it did not
+        bool canMoveUpTo(BinaryOperator* op, const std::vector<Hot>& group) {
+
+            BinaryOperator* first = group.front().site.op;
+
+            for (Value* operand: op->operands()) {
+
+                Instruction* ins = dyn_cast<Instruction>(operand);
+                if (!ins || ins->getParent() != first->getParent() || ins->comesBefore(first)) {
+                    continue;
+                }
+
+                if (none_of(group, [&](const Hot& member) { return member.site.op == ins; })) {
+                    return false;
+                }
+            }
+
+            for (Instruction* ins = first; ins != op; ins = ins->getNextNode()) {
+                if (!isGuaranteedToTransferExecutionToSuccessor(ins)) {
+                    return false;
+                }
+            }
+
+            return true;
+
+        }
+
+        // op with the operand of site replaced with constant, strength-reduced by SRCF
+        // before op; nullptr, and nothing inserted, when SRCF has no cheaper sequence
+        Value* buildFastPath(Site& site, ConstantInt* constant, const TargetTransformInfo& TTI,
+            std::vector<Instruction *>& inserted, StringRef& pattern) {
+
+            BinaryOperator* op = site.op;
+
+            // Division by zero is undefined, and stays on the generic path
+            if (constant->isZero() && site.operand == 1 && op->getOpcode() != Instruction::Mul) {
+                return nullptr;
+            }
+
+            // The fast path is built in place first, so that SRCF sees it in the function
+            Instruction* previous = op->getPrevNode();
+            Instruction* fast = op->clone();
+            fast->setOperand(site.operand, constant);
+            fast->insertBefore(op);
+
+            SRCFPass::Rewrite rewrite = SRCFPass::simplifyInstruction(fast, TTI);
+
+            // The instructions SRCF inserted, before fast
+            std::vector<Instruction *> sequence;
+            for (Instruction* i = fast->getPrevNode(); i != previous; i = i->getPrevNode()) {
+                sequence.insert(sequence.begin(), i);
+            }
+
+            fast->eraseFromParent();
+
+            if (!rewrite.result) {
+                LLVM_DEBUG(dbgs() << "No cheaper sequence for " << *op << " with " << *constant << "\n");
+                for (auto it = sequence.rbegin(); it != sequence.rend(); ++it) {
+                    (*it)->eraseFromParent();
+                }
+                return nullptr;
+            }
+
+            inserted.insert(inserted.end(), sequence.begin(), sequence.end());
+            pattern = rewrite.pattern;
+            return rewrite.result;
+
+        }
+
+        // if (operand == C) { the ops of group with C, strength-reduced by SRCF } else
+        // { the ops }, for the ops of the group for which SRCF has a cheaper sequence
+        bool version(std::vector<Hot>& group, const TargetTransformInfo& TTI,
+            OptimizationRemarkEmitter& ORE) {
+
+            Hot& leader = group.front();
+            Value* profiled = leader.site.op->getOperand(leader.site.operand);
+            ConstantInt* constant = ConstantInt::get(cast<IntegerType>(profiled->getType()), leader.value);
+
+            // The ops of the group next to each other, after the first one
+            for (size_t i = 1; i < group.size(); i++) {
+                group[i].site.op->moveAfter(group[i - 1].site.op);
+            }
+
+            struct Versioned {
+                Hot* hot;
+                Value* fast;
+                StringRef pattern;
+            };
+            std::vector<Versioned> versioned;
+            std::vector<Instruction *> inserted;
+
+            // The value of each versioned op on the fast path. An op using one which is
+            // not versioned stays after the merge, and is not versioned either.
+            DenseMap<Value *, Value *> fastValues;
+            SmallPtrSet<Value *, 4> unversioned;
+
+            for (Hot& member: group) {
+
+                BinaryOperator* op = member.site.op;
+                if (any_of(op->operands(), [&](Value* operand) { return unversioned.count(operand); })) {
+                    unversioned.insert(op);
+                    continue;
+                }
+
+                StringRef pattern;
+                Value* fast = buildFastPath(member.site, constant, TTI, inserted, pattern);
+                if (!fast) {
+                    unversioned.insert(op);
+                    continue;
+                }
+
+                versioned.push_back({&member, fast, pattern});
+                fastValues[op] = fastValues.lookup(fast) ? fastValues.lookup(fast) : fast;
+            }
+
+            if (versioned.empty()) {
+                return false;
+            }
+
+            // The fast path of an op using an earlier one uses its fast value
+            for (Instruction* i: inserted) {
+                for (Use& use: i->operands()) {
+                    if (Value* fast = fastValues.lookup(use.get())) {
+                        use.set(fast);
+                    }
+                }
+            }
+
+            BinaryOperator* first = versioned.front().hot->site.op;
+
+            IRBuilder<> builder(first);
+            Value* guard = builder.CreateICmpEQ(profiled, constant, "valueprof.hot");
+
+            MDNode* weights = MDBuilder(first->getContext()).createBranchWeights(leader.count,
+                leader.total - leader.count);
+
+            Instruction* thenTerm;
+            Instruction* elseTerm;
+            SplitBlockAndInsertIfThenElse(guard, first, &thenTerm, &elseTerm, weights);
+
+            BasicBlock* fastBlock = thenTerm->getParent();
+            BasicBlock* slowBlock = elseTerm->getParent();
+            BasicBlock* merge = first->getParent();
+            fastBlock->setName("valueprof.fast");
+            slowBlock->setName("valueprof.slow");
+            merge->setName("valueprof.merge");
+
+            for (Instruction* i: inserted) {
+                i->moveBefore(thenTerm);
+            }
+
+            for (Versioned& v: versioned) {
+                v.hot->site.op->moveBefore(elseTerm);
+            }
+
+            Instruction* insertPoint = &merge->front();
+            for (Versioned& v: versioned) {
+
+                BinaryOperator* op = v.hot->site.op;
+
+                PHINode* phi = PHINode::Create(op->getType(), 2, "", insertPoint);
+                phi->takeName(op);
+                op->setName(phi->getName() + ".slow");
+
+                // The later ops of the slow path keep using op
+                op->replaceUsesWithIf(phi, [&](Use& use) {
+                    return cast<Instruction>(use.getUser())->getParent() != slowBlock;
+                });
+                phi->addIncoming(fastValues[op], fastBlock);
+                phi->addIncoming(op, slowBlock);
+
+                NumSitesVersioned++;
+                LLVM_DEBUG(dbgs() << "Versioned " << *op << " for " << *constant << " (" << v.pattern << ")\n");
+                ORE.emit([&]() {
+                    return OptimizationRemark(DEBUG_TYPE, "Versioned", op)
+                        << "versioned " << ore::NV("Opcode", op->getOpcodeName()) << " for the value "
+                        << ore::NV("Value", constant) << " taken "
+                        << ore::NV("Count", v.hot->count) << " of " << ore::NV("Total", v.hot->total) << " times ("
+                        << ore::NV("Pattern", v.pattern) << ")";
+                });
+            }
+
+            NumGuardsShared += versioned.size() - 1;
+
+            // The sequences of the ops share their steps, e.g. the quotient of a division
+            // and of the remainder by the same value
+            shareFastPath(*fastBlock);
+
+            return true;
+
+        }
+
+        // Replace the instructions of the fast path computing the same value as an
+        // earlier one with it
+        void shareFastPath(BasicBlock& fastBlock) {
+
+            DenseMap<SimpleValue, Instruction *> available;
+
+            for (Instruction& instruction: make_early_inc_range(fastBlock)) {
+
+                if (!SimpleValue::canHandle(&instruction)) {
+                    continue;
+                }
+
+                auto found = available.insert({&instruction, &instruction});
+                if (found.second) {
+                    continue;
+                }
+
+                NumFastPathShared++;
+                instruction.replaceAllUsesWith(found.first->second);
+                instruction.eraseFromParent();
+            }
+
+        }
+    };
+}
+
+bool customopt::ValueProfileGenPass::runImpl(Module& module) {
+
+    ValueProfileInstrumentation instrumentation(module);
+    return instrumentation.run();
+
+}
+
+PreservedAnalyses customopt::ValueProfileGenPass::run(Module& module, ModuleAnalysisManager& /*MAM*/) {
+
+    if (!runImpl(module)) {
+        return PreservedAnalyses::all();
+    }
+
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+
+}
+
+bool customopt::ValueProfileUsePass::runImpl(Module& module,
+    function_ref<const TargetTransformInfo&(Function&)> getTTI) {
+
+    ValueProfileUse use(module, getTTI);
+    return use.run();
+
+}
+
+PreservedAnalyses customopt::ValueProfileUsePass::run(Module& module, ModuleAnalysisManager& MAM) {
+
+    FunctionAnalysisManager& FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(module).getManager();
+
+    auto getTTI = [&](Function& function) -> const TargetTransformInfo& {
+        return FAM.getResult<TargetIRAnalysis>(function);
+    };
+
+    if (!runImpl(module, getTTI)) {
+        return PreservedAnalyses::all();
+    }
+
+    return PreservedAnalyses::none();
+
+}
+
+namespace {
+    struct ValueProfileGenLegacyPass : public ModulePass {
+        static char ID;
+        ValueProfileGenLegacyPass() : ModulePass(ID) {}
+
+        virtual bool runOnModule(Module& module) override {
+            return customopt::ValueProfileGenPass::runImpl(module);
+        }
+    };
+
+    struct ValueProfileUseLegacyPass : public ModulePass {
+        static char ID;
+        ValueProfileUseLegacyPass() : ModulePass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const override {
+
+            AU.addRequired<TargetTransformInfoWrapperPass>();
+            return;
+
+        }
+
+        virtual bool runOnModule(Module& module) override {
+
+            auto getTTI = [this](Function& function) -> const TargetTransformInfo& {
+                return getAnalysis<TargetTransformInfoWrapperPass>().getTTI(function);
+            };
+            return customopt::ValueProfileUsePass::runImpl(module, getTTI);
+
+        }
+    };
+}
+
+char ValueProfileGenLegacyPass::ID = 0;
+char ValueProfileUseLegacyPass::ID = 0;
+
+static RegisterPass<ValueProfileGenLegacyPass> X("valueprof-gen",
+    "Value Profile instrumentation of divisions and multiplies", false, false);
+
+static RegisterPass<ValueProfileUseLegacyPass> Y("valueprof-use",
+    "Value Profile versioning of hot divisions and multiplies", false, false);
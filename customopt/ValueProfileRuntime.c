@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Runtime of the value profiles of -valueprof-gen, linked into the instrumented
+// program (libCustomOptProfileRuntime.a):
+//
+// opt -load-pass-plugin build/customopt/libCustomOptPass.so -passes=valueprof-gen foo.ll -o foo.gen.bc
+// clang foo.gen.bc build/customopt/libCustomOptProfileRuntime.a -o foo.gen
+//
+// Every profiled operand has a site, a global of the instrumented module, which
+// counts the values it takes. At exit, the sites which ran are appended to the file
+// named by CUSTOMOPT_PROFILE_FILE (customopt.profile by default), one line each:
+//
+// <function> <index> <opcode> <total> <value>:<count> ...
+//
+// Appending merges the runs: -valueprof-use adds up the lines of the same site.
+// The counters are not atomic, so counts from programs with several threads are
+// approximate.
+
+// Must match the layout of the sites created by -valueprof-gen
+#define CUSTOMOPT_VP_VALUES 4
+
+struct CustomOptValueSite {
+    const char* function;
+    const char* opcode;
+    uint64_t index;
+    struct CustomOptValueSite* next;
+    uint64_t total;
+    uint64_t values[CUSTOMOPT_VP_VALUES];
+    uint64_t counts[CUSTOMOPT_VP_VALUES];
+};
+
+// The sites which ran, linked on their first value
+static struct CustomOptValueSite* sites;
+
+static void writeProfile(void) {
+
+    const char* filename = getenv("CUSTOMOPT_PROFILE_FILE");
+    if (!filename || !*filename) {
+        filename = "customopt.profile";
+    }
+
+    FILE* file = fopen(filename, "a");
+    if (!file) {
+        perror(filename);
+        return;
+    }
+
+    for (struct CustomOptValueSite* site = sites; site; site = site->next) {
+
+        fprintf(file, "%s %llu %s %llu", site->function, (unsigned long long) site->index, site->opcode,
+            (unsigned long long) site->total);
+
+        for (int i = 0; i < CUSTOMOPT_VP_VALUES; i++) {
+            if (site->counts[i]) {
+                fprintf(file, " %llu:%llu", (unsigned long long) site->values[i],
+                    (unsigned long long) site->counts[i]);
+            }
+        }
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+
+}
+
+void __customopt_profile_value(struct CustomOptValueSite* site, uint64_t value) {
+
+    if (site->total++ == 0) {
+        if (!sites) {
+            atexit(writeProfile);
+        }
+        site->next = sites;
+        sites = site;
+    }
+
+    for (int i = 0; i < CUSTOMOPT_VP_VALUES; i++) {
+        if (site->counts[i] && site->values[i] == value) {
+            site->counts[i]++;
+            return;
+        }
+    }
+
+    for (int i = 0; i < CUSTOMOPT_VP_VALUES; i++) {
+        if (!site->counts[i]) {
+            site->values[i] = value;
+            site->counts[i] = 1;
+            return;
+        }
+    }
+
+    // The table is full: the least frequent value loses a count, and is replaced
+    // once it has none left. A value taken most of the time keeps its place.
+    int least = 0;
+    for (int i = 1; i < CUSTOMOPT_VP_VALUES; i++) {
+        if (site->counts[i] < site->counts[least]) {
+            least = i;
+        }
+    }
+
+    if (--site->counts[least] == 0) {
+        site->values[least] = value;
+        site->counts[least] = 1;
+    }
+
+}
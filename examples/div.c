@@ -0,0 +1,22 @@
+#include <stdio.h>
+
+unsigned bucket(unsigned x) {
+
+    unsigned q = x / 10; // Strength reduction (udiv -> multiply-high + shift)
+    unsigned r = x % 1000; // Strength reduction (urem -> x - (x / 1000) * 1000)
+    return q + r;
+}
+
+int scale(int x) {
+
+    int q = x / 3; // Strength reduction (sdiv -> multiply-high + sign fix-up)
+    int r = x % -7; // Strength reduction (srem -> x - (x / -7) * -7)
+    return q + r;
+}
+
+int main() {
+
+    printf("%u %d\n", bucket(123456), scale(-100));
+
+    return 0;
+}
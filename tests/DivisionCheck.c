@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Checks the divisions by constants of the corpus (DivisionCorpus.cpp), once lowered
+// by srcf and compiled, against the division of the machine by the same divisor,
+// read from the table at run time like any variable:
+//
+// division-check [random dividends per divisor] [seed]
+//
+// Every dividend is tried for widths of up to 16 bits; wider ones try the dividends
+// around 0, the limits of the type, and the multiples of the divisor, and random
+// ones (20000 per divisor by default). The first mismatches are printed, and the
+// exit code is 1 if there is any.
+
+struct division {
+    uint32_t width;
+    uint32_t operation;
+    int64_t divisor;
+    uint64_t (*function)(uint64_t);
+};
+
+enum { UDIV, SDIV, UREM, SREM };
+
+extern const struct division customopt_divisions[];
+extern const uint64_t customopt_num_divisions;
+
+static uint64_t failures;
+
+static uint64_t next_random(uint64_t* state) {
+
+    // splitmix64
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+
+}
+
+static uint64_t get_mask(uint32_t width) {
+    return width == 64 ? ~0ull : (1ull << width) - 1;
+}
+
+static int64_t sign_extend(uint64_t value, uint32_t width) {
+    return width == 64 ? (int64_t)value : (int64_t)(value << (64 - width)) >> (64 - width);
+}
+
+static void check(const struct division* division, uint64_t n) {
+
+    uint32_t width = division->width;
+    uint64_t mask = get_mask(width);
+    uint64_t d = (uint64_t)division->divisor & mask;
+    n &= mask;
+
+    int64_t signedN = sign_extend(n, width);
+    int64_t signedD = sign_extend(d, width);
+
+    // INT_MIN / -1 overflows, the IR leaves it undefined
+    if ((division->operation == SDIV || division->operation == SREM) &&
+        signedD == -1 && n == (1ull << (width - 1))) {
+        return;
+    }
+
+    uint64_t expected;
+    switch (division->operation) {
+    case UDIV: expected = n / d; break;
+    case UREM: expected = n % d; break;
+    case SDIV: expected = (uint64_t)(signedN / signedD); break;
+    default: expected = (uint64_t)(signedN % signedD); break;
+    }
+    expected &= mask;
+
+    uint64_t actual = division->function(n) & mask;
+    if (actual == expected) {
+        return;
+    }
+
+    if (failures++ < 20) {
+        static const char* names[] = {"udiv", "sdiv", "urem", "srem"};
+        fprintf(stderr, "%s i%u %llu, %lld: got %llu, expected %llu\n", names[division->operation],
+            width, (unsigned long long)n, (long long)signedD,
+            (unsigned long long)actual, (unsigned long long)expected);
+    }
+
+}
+
+int main(int argc, char** argv) {
+
+    uint64_t dividends = argc > 1 ? strtoull(argv[1], NULL, 0) : 20000;
+    uint64_t state = argc > 2 ? strtoull(argv[2], NULL, 0) : 1;
+    uint64_t checked = 0;
+
+    for (uint64_t i = 0; i < customopt_num_divisions; i++) {
+
+        const struct division* division = &customopt_divisions[i];
+        uint32_t width = division->width;
+        uint64_t mask = get_mask(width);
+
+        if (width <= 16) {
+            for (uint64_t n = 0; n <= mask; n++) {
+                check(division, n);
+            }
+            checked += mask + 1;
+            continue;
+        }
+
+        uint64_t d = (uint64_t)division->divisor & mask;
+        uint64_t limits[] = {0, 1, 2, mask, mask - 1, mask >> 1, (mask >> 1) + 1, (mask >> 1) + 2};
+        for (unsigned j = 0; j < sizeof(limits) / sizeof(limits[0]); j++) {
+            check(division, limits[j]);
+        }
+
+        for (uint64_t j = 0; j < dividends; j++) {
+
+            uint64_t n = next_random(&state) & mask;
+
+            // Half of them next to a multiple of the divisor, where the quotient changes
+            if (j & 1) {
+                uint64_t multiple = (n / d) * d;
+                n = multiple + (next_random(&state) % 3) - 1;
+            }
+
+            // and some with their high bits clear
+            if ((j & 6) == 6) {
+                n >>= next_random(&state) % width;
+            }
+
+            check(division, n);
+        }
+        checked += sizeof(limits) / sizeof(limits[0]) + dividends;
+    }
+
+    printf("%llu divisions by %llu constants checked, %llu mismatches\n", (unsigned long long)checked,
+        (unsigned long long)customopt_num_divisions, (unsigned long long)failures);
+
+    return failures ? 1 : 0;
+
+}
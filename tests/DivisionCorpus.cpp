@@ -0,0 +1,225 @@
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/ADT/APInt.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <random>
+#include <set>
+
+using namespace llvm;
+
+// Generates the corpus of divisions by constants checked by the division-corpus test:
+//
+// customopt-divcorpus -o divisions.ll
+//
+// For every width, operation (udiv, sdiv, urem, srem) and divisor, the module has a
+// function computing the operation of its argument by the constant divisor, which
+// srcf then lowers. Every divisor of the exhaustive widths is generated; the other
+// widths get the divisors around the powers of two and their negations, and random
+// ones of every length. The functions take and return i64, truncated to the width
+// and extended back, so that DivisionCheck.c calls them all the same way.
+//
+// The table @customopt_divisions lists them as { i32 width, i32 operation, i64 divisor,
+// i8* function }, with the number of entries in @customopt_num_divisions.
+
+static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename"),
+    cl::value_desc("filename"), cl::init("-"));
+
+static cl::list<unsigned> ExhaustiveWidths("exhaustive-widths", cl::CommaSeparated,
+    cl::desc("Widths for which every divisor is generated (default: 8,16)"));
+
+static cl::list<unsigned> RandomWidths("random-widths", cl::CommaSeparated,
+    cl::desc("Widths for which a sample of divisors is generated (default: 32,64)"));
+
+static cl::opt<unsigned> RandomDivisors("random-divisors", cl::init(400),
+    cl::desc("Number of random divisors per width of -random-widths"));
+
+static cl::opt<unsigned> Seed("seed", cl::init(1),
+    cl::desc("Seed of the generator, the same seed generates the same corpus"));
+
+namespace {
+
+    // The operations, in the order DivisionCheck.c numbers them
+    const Instruction::BinaryOps operations[] = {
+        Instruction::UDiv, Instruction::SDiv, Instruction::URem, Instruction::SRem
+    };
+
+    class Generator {
+    public:
+        Generator(LLVMContext& context, unsigned seed) : context(context), random(seed) {}
+
+        std::unique_ptr<Module> generate() {
+
+            module = std::make_unique<Module>("divisions", context);
+            module->setTargetTriple(sys::getDefaultTargetTriple());
+
+            // The entries of the table: { width, operation, divisor, function }
+            Type* int32 = Type::getInt32Ty(context);
+            Type* int64 = Type::getInt64Ty(context);
+            entryType = StructType::create(context, {int32, int32, int64, Type::getInt8PtrTy(context)}, "division");
+
+            for (unsigned width: ExhaustiveWidths) {
+                for (uint64_t d = 1; d < (uint64_t(1) << width); d++) {
+                    addDivisor(APInt(width, d));
+                }
+            }
+
+            for (unsigned width: RandomWidths) {
+                for (const APInt& d: getSampleDivisors(width)) {
+                    addDivisor(d);
+                }
+            }
+
+            ArrayType* tableType = ArrayType::get(entryType, entries.size());
+
+            new GlobalVariable(*module, tableType, true, GlobalValue::ExternalLinkage,
+                ConstantArray::get(tableType, entries), "customopt_divisions");
+            new GlobalVariable(*module, int64, true, GlobalValue::ExternalLinkage,
+                ConstantInt::get(int64, entries.size()), "customopt_num_divisions");
+
+            return std::move(module);
+
+        }
+
+    private:
+        LLVMContext& context;
+        std::mt19937_64 random;
+
+        std::unique_ptr<Module> module;
+        StructType* entryType = nullptr;
+        std::vector<Constant *> entries;
+
+        // The divisors tried for a width too wide to try them all
+        std::vector<APInt> getSampleDivisors(unsigned width) {
+
+            // Ordered by value, so that the corpus does not depend on the hash of APInts
+            std::set<uint64_t> divisors;
+
+            for (unsigned k = 1; k < width; k++) {
+                for (int64_t delta = -1; delta <= 1; delta++) {
+                    APInt d = APInt::getOneBitSet(width, k) + delta;
+                    divisors.insert(d.getZExtValue());
+                    divisors.insert((-d).getZExtValue());
+                }
+            }
+
+            for (uint64_t d: {3, 5, 6, 7, 10, 11, 12, 25, 100, 641, 1000, 6700417}) {
+                APInt divisor(width, d);
+                divisors.insert(divisor.getZExtValue());
+                divisors.insert((-divisor).getZExtValue());
+            }
+
+            divisors.insert(APInt::getAllOnes(width).getZExtValue());
+            divisors.insert(APInt::getSignedMinValue(width).getZExtValue());
+            divisors.insert((APInt::getSignedMinValue(width) + 1).getZExtValue());
+
+            // Random divisors of random lengths, so that small ones are tried as well
+            for (unsigned i = 0; i < RandomDivisors; i++) {
+                unsigned bits = 2 + random() % (width - 1);
+                APInt d = APInt(width, random()).lshr(width - bits);
+                if (!d.isZero()) {
+                    divisors.insert(d.getZExtValue());
+                }
+            }
+
+            divisors.erase(0);
+
+            std::vector<APInt> result;
+            for (uint64_t d: divisors) {
+                result.push_back(APInt(width, d));
+            }
+
+            return result;
+
+        }
+
+        // One function per operation for the divisor
+        void addDivisor(const APInt& d) {
+
+            unsigned width = d.getBitWidth();
+            Type* int64 = Type::getInt64Ty(context);
+            Type* type = Type::getIntNTy(context, width);
+            FunctionType* functionType = FunctionType::get(int64, {int64}, false);
+
+            for (unsigned op = 0; op < array_lengthof(operations); op++) {
+
+                // udiv.i32.7, sdiv.i32.m7 for -7
+                Instruction::BinaryOps opcode = operations[op];
+                bool isSigned = opcode == Instruction::SDiv || opcode == Instruction::SRem;
+                std::string name = (Twine(Instruction::getOpcodeName(opcode)) + ".i" + Twine(width) + "." +
+                    (isSigned && d.isNegative() ? "m" + toString(-d, 10, false) : toString(d, 10, false))).str();
+
+                Function* function = Function::Create(functionType, GlobalValue::InternalLinkage,
+                    name, module.get());
+
+                IRBuilder<> builder(BasicBlock::Create(context, "entry", function));
+                Value* n = builder.CreateTrunc(function->getArg(0), type);
+                Value* result = builder.CreateBinOp(opcode, n, ConstantInt::get(type, d));
+                builder.CreateRet(builder.CreateZExt(result, int64));
+
+                entries.push_back(ConstantStruct::get(entryType, {
+                    builder.getInt32(width), builder.getInt32(op),
+                    builder.getInt64(d.getSExtValue()),
+                    ConstantExpr::getBitCast(function, Type::getInt8PtrTy(context))
+                }));
+            }
+        }
+    };
+}
+
+int main(int argc, char** argv) {
+
+    InitLLVM X(argc, argv);
+
+    cl::ParseCommandLineOptions(argc, argv, "corpus of divisions by constants\n");
+
+    if (ExhaustiveWidths.empty() && RandomWidths.empty()) {
+        ExhaustiveWidths.push_back(8);
+        ExhaustiveWidths.push_back(16);
+        RandomWidths.push_back(32);
+        RandomWidths.push_back(64);
+    }
+
+    for (unsigned width: ExhaustiveWidths) {
+        if (width < 2 || width > 16) {
+            errs() << "error: -exhaustive-widths must be between 2 and 16\n";
+            return 1;
+        }
+    }
+    for (unsigned width: RandomWidths) {
+        if (width < 2 || width > 64) {
+            errs() << "error: -random-widths must be between 2 and 64\n";
+            return 1;
+        }
+    }
+
+    LLVMContext context;
+    Generator generator(context, Seed);
+    std::unique_ptr<Module> module = generator.generate();
+
+    if (verifyModule(*module, &errs())) {
+        return 1;
+    }
+
+    std::error_code error;
+    ToolOutputFile out(OutputFilename, error, sys::fs::OF_None);
+    if (error) {
+        errs() << OutputFilename << ": " << error.message() << "\n";
+        return 1;
+    }
+
+    module->print(out.os(), nullptr);
+    out.keep();
+
+    return 0;
+
+}
@@ -0,0 +1,33 @@
+; Values only used in unreachable blocks are dead, and are deleted with the blocks
+
+; CHECK-LABEL: define i32 @used_from_unreachable(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: ret i32 0
+; CHECK-NEXT: }
+define i32 @used_from_unreachable(i32 %a) {
+entry:
+  %x = add i32 %a, 1
+  ret i32 0
+
+dead:
+  %y = mul i32 %x, 2
+  ret i32 %y
+}
+
+; The phi is left with the value from the reachable block, and replaced with it
+; CHECK-LABEL: define i32 @phi_from_unreachable(
+; CHECK: join:
+; CHECK-NEXT: ret i32 %x
+define i32 @phi_from_unreachable(i32 %a) {
+entry:
+  %x = add i32 %a, 1
+  br label %join
+
+dead:
+  %y = mul i32 %x, 2
+  br label %join
+
+join:
+  %r = phi i32 [ %x, %entry ], [ %y, %dead ]
+  ret i32 %r
+}
@@ -0,0 +1,104 @@
+; Invariant instructions move to the preheader: pure ones freely, loads when no
+; write of the loop may change their memory, and those which may trap only when
+; they ran in every iteration anyway
+
+; CHECK-LABEL: define void @arithmetic(
+; CHECK: entry:
+; CHECK-NEXT: %m = mul i32 %a, %b
+; CHECK-NEXT: br label %loop
+; CHECK: loop:
+; CHECK-NOT: mul
+define void @arithmetic(i32* %p, i32 %a, i32 %b, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %m = mul i32 %a, %b
+  %e = getelementptr i32, i32* %p, i64 %i
+  store i32 %m, i32* %e
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; The stores only write %p, which does not alias %q
+; CHECK-LABEL: define void @load_not_written(
+; CHECK: entry:
+; CHECK-NEXT: %v = load i32, i32* %q
+; CHECK-NEXT: br label %loop
+define void @load_not_written(i32* noalias %p, i32* noalias %q, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %v = load i32, i32* %q
+  %e = getelementptr i32, i32* %p, i64 %i
+  store i32 %v, i32* %e
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; Without noalias, the stores may write %q
+; CHECK-LABEL: define void @load_may_alias(
+; CHECK: entry:
+; CHECK-NEXT: br label %loop
+; CHECK: loop:
+; CHECK-NEXT: %i = phi
+; CHECK-NEXT: %v = load i32, i32* %q
+define void @load_may_alias(i32* %p, i32* %q, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %v = load i32, i32* %q
+  %e = getelementptr i32, i32* %p, i64 %i
+  store i32 %v, i32* %e
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; %d may be zero when the division never runs: it is not speculated, while the
+; comparison guarding it is hoisted
+; CHECK-LABEL: define void @conditional_division(
+; CHECK: entry:
+; CHECK-NEXT: %z = icmp eq i32 %d, 0
+; CHECK-NEXT: br label %loop
+; CHECK: then:
+; CHECK-NEXT: %q = udiv i32 %a, %d
+define void @conditional_division(i32* %p, i32 %a, i32 %d, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %latch ]
+  %z = icmp eq i32 %d, 0
+  br i1 %z, label %latch, label %then
+
+then:
+  %q = udiv i32 %a, %d
+  %e = getelementptr i32, i32* %p, i64 %i
+  store i32 %q, i32* %e
+  br label %latch
+
+latch:
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
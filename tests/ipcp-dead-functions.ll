@@ -0,0 +1,24 @@
+; ipcp deletes the local functions whose calls it redirects to clones, and leaves
+; alone those which had no caller to begin with
+
+; CHECK-NOT: define internal i32 @scale(
+; CHECK: define internal i32 @unused(
+; CHECK: define internal i32 @scale.spec(
+; CHECK: define internal i32 @scale.spec.{{[0-9]+}}(
+
+define internal i32 @unused(i32 %x) {
+  %y = mul i32 %x, 3
+  ret i32 %y
+}
+
+define internal i32 @scale(i32 %x, i32 %k) {
+  %y = mul i32 %x, %k
+  ret i32 %y
+}
+
+define i32 @caller(i32 %a, i32 %b) {
+  %p = call i32 @scale(i32 %a, i32 4)
+  %q = call i32 @scale(i32 %b, i32 8)
+  %r = add i32 %p, %q
+  ret i32 %r
+}
@@ -0,0 +1,98 @@
+; Loads are replaced with the value of an earlier store or an earlier load only when
+; alias analysis proves the writes in between leave their memory alone
+
+; CHECK-LABEL: define i32 @forward_store(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: store i32 %v, i32* %p
+; CHECK-NEXT: ret i32 %v
+define i32 @forward_store(i32* %p, i32 %v) {
+entry:
+  store i32 %v, i32* %p
+  %l = load i32, i32* %p
+  ret i32 %l
+}
+
+; The store to %q may write %p: neither the stored value nor the first load is reused
+; CHECK-LABEL: define i32 @may_alias(
+; CHECK: %a = load i32, i32* %p
+; CHECK-NEXT: store i32 0, i32* %q
+; CHECK-NEXT: %b = load i32, i32* %p
+; CHECK-NEXT: %s = add i32 %a, %b
+define i32 @may_alias(i32* %p, i32* %q) {
+entry:
+  %a = load i32, i32* %p
+  store i32 0, i32* %q
+  %b = load i32, i32* %p
+  %s = add i32 %a, %b
+  ret i32 %s
+}
+
+; CHECK-LABEL: define i32 @may_alias_forward(
+; CHECK: store i32 %v, i32* %p
+; CHECK-NEXT: store i32 0, i32* %q
+; CHECK-NEXT: %l = load i32, i32* %p
+; CHECK-NEXT: ret i32 %l
+define i32 @may_alias_forward(i32* %p, i32* %q, i32 %v) {
+entry:
+  store i32 %v, i32* %p
+  store i32 0, i32* %q
+  %l = load i32, i32* %p
+  ret i32 %l
+}
+
+; With noalias arguments the store to %q leaves %p alone
+; CHECK-LABEL: define i32 @noalias_forward(
+; CHECK: store i32 %v, i32* %p
+; CHECK-NEXT: store i32 0, i32* %q
+; CHECK-NEXT: ret i32 %v
+define i32 @noalias_forward(i32* noalias %p, i32* noalias %q, i32 %v) {
+entry:
+  store i32 %v, i32* %p
+  store i32 0, i32* %q
+  %l = load i32, i32* %p
+  ret i32 %l
+}
+
+; A readonly call does not write memory; any other call may
+declare void @read(i32*) readonly
+declare void @write(i32*)
+
+; CHECK-LABEL: define i32 @readonly_call(
+; CHECK: %a = load i32, i32* %p
+; CHECK-NEXT: call void @read(i32* %p)
+; CHECK-NEXT: %s = add i32 %a, %a
+define i32 @readonly_call(i32* %p) {
+entry:
+  %a = load i32, i32* %p
+  call void @read(i32* %p)
+  %b = load i32, i32* %p
+  %s = add i32 %a, %b
+  ret i32 %s
+}
+
+; CHECK-LABEL: define i32 @writing_call(
+; CHECK: %a = load i32, i32* %p
+; CHECK-NEXT: call void @write(i32* %p)
+; CHECK-NEXT: %b = load i32, i32* %p
+; CHECK-NEXT: %s = add i32 %a, %b
+define i32 @writing_call(i32* %p) {
+entry:
+  %a = load i32, i32* %p
+  call void @write(i32* %p)
+  %b = load i32, i32* %p
+  %s = add i32 %a, %b
+  ret i32 %s
+}
+
+; A store of another type is not forwarded
+; CHECK-LABEL: define i8 @different_type(
+; CHECK: store i32 %v, i32* %p
+; CHECK-NEXT: %l = load i8, i8* %c
+; CHECK-NEXT: ret i8 %l
+define i8 @different_type(i32* %p, i32 %v) {
+entry:
+  %c = bitcast i32* %p to i8*
+  store i32 %v, i32* %p
+  %l = load i8, i8* %c
+  ret i8 %l
+}
@@ -0,0 +1,122 @@
+; Multiplies of an induction variable by an invariant are replaced with a phi started
+; in the preheader and incremented in the latch
+
+; CHECK-LABEL: define void @multiply_iv(
+; CHECK: loop:
+; CHECK-NEXT: %loopsr.iv = phi i64 [ %loopsr.iv.next, %loop ], [ 0, %entry ]
+; CHECK-NEXT: %i = phi i64
+; CHECK-NOT: mul
+; CHECK: getelementptr i32, i32* %p, i64 %loopsr.iv
+; CHECK: %loopsr.iv.next = add i64 %loopsr.iv, 3
+; CHECK-NEXT: br i1
+define void @multiply_iv(i32* %p, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %m = mul i64 %i, 3
+  %a = getelementptr i32, i32* %p, i64 %m
+  store i32 0, i32* %a
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; In a chain of multiplies, only the phi of the last one is left: the phi of %k
+; only fed %j, and its increment is deleted with it
+; CHECK-LABEL: define void @multiply_chain(
+; CHECK: loop:
+; CHECK-NEXT: %loopsr.iv{{[0-9]*}} = phi i64 [ %loopsr.iv.next{{[0-9]*}}, %loop ], [ 0, %entry ]
+; CHECK-NEXT: %i = phi i64
+; CHECK-NOT: phi
+; CHECK-NOT: mul
+; CHECK: add i64 %loopsr.iv{{[0-9]*}}, 12
+; CHECK-NOT: loopsr
+; CHECK: br i1
+define void @multiply_chain(i32* %p, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %k = mul i64 %i, 4
+  %j = mul i64 %k, 3
+  %a = getelementptr i32, i32* %p, i64 %j
+  store i32 0, i32* %a
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; A shift by a constant costs as much as the add which would replace it
+; CHECK-LABEL: define void @shift_iv(
+; CHECK-NOT: loopsr.iv
+; CHECK: %s = shl i64 %i, 2
+define void @shift_iv(i32* %p, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %s = shl i64 %i, 2
+  %a = getelementptr i32, i32* %p, i64 %s
+  store i32 0, i32* %a
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; The step of a multiply by a variable defined in the loop changes every iteration
+; CHECK-LABEL: define void @variant_factor(
+; CHECK-NOT: loopsr.iv
+; CHECK: %m = mul i64 %i, %f
+define void @variant_factor(i64* %p, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %f = load i64, i64* %p
+  %m = mul i64 %i, %f
+  store i64 %m, i64* %p
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; Without a preheader there is nowhere to start the phi
+; CHECK-LABEL: define void @no_preheader(
+; CHECK-NOT: loopsr.iv
+; CHECK: %m = mul i64 %i, 3
+define void @no_preheader(i32* %p, i64 %n, i1 %b) {
+entry:
+  br i1 %b, label %loop, label %other
+
+other:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ 1, %other ], [ %i.next, %loop ]
+  %m = mul i64 %i, 3
+  %a = getelementptr i32, i32* %p, i64 %m
+  store i32 0, i32* %a
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,101 @@
+; An expression computed on one side of a diamond is inserted on the other side,
+; and its copy after the join replaced with a phi
+
+; CHECK-LABEL: define i32 @diamond(
+; CHECK: then:
+; CHECK-NEXT: %x = add i32 %a, %b
+; CHECK: else:
+; CHECK-NEXT: %y.pre = add i32 %a, %b
+; CHECK-NEXT: br label %join
+; CHECK: join:
+; CHECK-NEXT: %y.pre-phi = phi i32 [ %y.pre, %else ], [ %x, %then ]
+; CHECK-NEXT: ret i32 %y.pre-phi
+define i32 @diamond(i32 %a, i32 %b, i1 %c) {
+entry:
+  br i1 %c, label %then, label %else
+
+then:
+  %x = add i32 %a, %b
+  br label %join
+
+else:
+  br label %join
+
+join:
+  %y = add i32 %a, %b
+  ret i32 %y
+}
+
+; The operands are translated through the phis of the join: %y computes %a+%b
+; from then, and %a+1 from else, where it is inserted
+; CHECK-LABEL: define i32 @phi_translation(
+; CHECK: else:
+; CHECK-NEXT: %y.pre = add i32 %a, 1
+; CHECK: join:
+; CHECK-NEXT: %y.pre-phi = phi i32 [ %y.pre, %else ], [ %x, %then ]
+; CHECK-NEXT: %p = phi i32
+; CHECK-NEXT: ret i32 %y.pre-phi
+define i32 @phi_translation(i32 %a, i32 %b, i1 %c) {
+entry:
+  br i1 %c, label %then, label %else
+
+then:
+  %x = add i32 %a, %b
+  br label %join
+
+else:
+  br label %join
+
+join:
+  %p = phi i32 [ %b, %then ], [ 1, %else ]
+  %y = add i32 %a, %p
+  ret i32 %y
+}
+
+; A division may trap where the original would not have run: it is not inserted
+; CHECK-LABEL: define i32 @trapping(
+; CHECK: else:
+; CHECK-NEXT: br label %join
+; CHECK: join:
+; CHECK-NEXT: %y = udiv i32 %a, %b
+define i32 @trapping(i32 %a, i32 %b, i1 %c) {
+entry:
+  br i1 %c, label %then, label %else
+
+then:
+  %x = udiv i32 %a, %b
+  br label %join
+
+else:
+  br label %join
+
+join:
+  %y = udiv i32 %a, %b
+  ret i32 %y
+}
+
+; The predecessor missing the value also branches elsewhere, so the expression
+; would run on paths which never compute it
+; CHECK-LABEL: define i32 @critical_edge(
+; CHECK: else:
+; CHECK-NEXT: br i1 %d, label %join, label %exit
+; CHECK: join:
+; CHECK-NEXT: %y = add i32 %a, %b
+define i32 @critical_edge(i32 %a, i32 %b, i1 %c, i1 %d) {
+entry:
+  br i1 %c, label %then, label %else
+
+then:
+  %x = add i32 %a, %b
+  br label %join
+
+else:
+  br i1 %d, label %join, label %exit
+
+join:
+  %y = add i32 %a, %b
+  ret i32 %y
+
+exit:
+  ret i32 0
+}
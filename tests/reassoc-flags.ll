@@ -0,0 +1,107 @@
+; Trees of one associative operation are rebuilt with their operands in rank order
+; and their constants combined, keeping only the wrapping flags which still hold
+
+; CHECK-LABEL: define i32 @combine_constants(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %b = add i32 %x, 3
+; CHECK-NEXT: ret i32 %b
+define i32 @combine_constants(i32 %x) {
+entry:
+  %a = add i32 %x, 1
+  %b = add i32 %a, 2
+  ret i32 %b
+}
+
+; (x+y)+z and x+(y+z) both become (x+y)+z
+; CHECK-LABEL: define i32 @canonical_order(
+; CHECK: [[L:%.*]] = add i32 %x, %y
+; CHECK-NEXT: %l = add i32 [[L]], %z
+; CHECK: [[R:%.*]] = add i32 %x, %y
+; CHECK-NEXT: %r = add i32 [[R]], %z
+define i32 @canonical_order(i32 %x, i32 %y, i32 %z) {
+entry:
+  %a = add i32 %x, %y
+  %l = add i32 %a, %z
+  %b = add i32 %y, %z
+  %r = add i32 %x, %b
+  %s = xor i32 %l, %r
+  ret i32 %s
+}
+
+; The partial sums of the rebuilt tree were never computed: signed wrapping is
+; dropped, unsigned kept when every add of the tree had it
+; CHECK-LABEL: define i32 @nsw_dropped(
+; CHECK: %a = add i32 %x, %y
+; CHECK-NEXT: %b = add i32 %a, 1
+define i32 @nsw_dropped(i32 %x, i32 %y) {
+entry:
+  %a = add nsw i32 %x, 1
+  %b = add nsw i32 %a, %y
+  ret i32 %b
+}
+
+; CHECK-LABEL: define i32 @nuw_kept(
+; CHECK: %a = add nuw i32 %x, %y
+; CHECK-NEXT: %b = add nuw i32 %a, 1
+define i32 @nuw_kept(i32 %x, i32 %y) {
+entry:
+  %a = add nuw i32 %x, 1
+  %b = add nuw i32 %a, %y
+  ret i32 %b
+}
+
+; CHECK-LABEL: define i32 @nuw_partial(
+; CHECK: %a = add i32 %x, %y
+; CHECK-NEXT: %b = add i32 %a, 1
+define i32 @nuw_partial(i32 %x, i32 %y) {
+entry:
+  %a = add nuw i32 %x, 1
+  %b = add i32 %a, %y
+  ret i32 %b
+}
+
+; A tree left in its order keeps its flags
+; CHECK-LABEL: define i32 @unchanged(
+; CHECK: %a = add nsw i32 %x, %y
+; CHECK-NEXT: %b = add nsw i32 %a, 1
+define i32 @unchanged(i32 %x, i32 %y) {
+entry:
+  %a = add nsw i32 %x, %y
+  %b = add nsw i32 %a, 1
+  ret i32 %b
+}
+
+; A node with another use is not part of the tree, and is kept as it is
+; CHECK-LABEL: define i32 @shared_node(
+; CHECK: %a = add i32 %x, 1
+; CHECK-NEXT: %b = add i32 %a, 2
+; CHECK-NEXT: %c = mul i32 %a, %b
+define i32 @shared_node(i32 %x) {
+entry:
+  %a = add i32 %x, 1
+  %b = add i32 %a, 2
+  %c = mul i32 %a, %b
+  ret i32 %c
+}
+
+; Subtraction is not associative
+; CHECK-LABEL: define i32 @subtract(
+; CHECK: %a = sub i32 %x, 1
+; CHECK-NEXT: %b = sub i32 %a, 2
+define i32 @subtract(i32 %x) {
+entry:
+  %a = sub i32 %x, 1
+  %b = sub i32 %a, 2
+  ret i32 %b
+}
+
+; x^y^x cancels to y
+; CHECK-LABEL: define i32 @xor_cancel(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: ret i32 %y
+define i32 @xor_cancel(i32 %x, i32 %y) {
+entry:
+  %a = xor i32 %x, %y
+  %b = xor i32 %a, %x
+  ret i32 %b
+}
@@ -0,0 +1,127 @@
+; Constants are propagated through the branches they decide and the phis of the
+; blocks which can execute; the other blocks are deleted
+
+; The branch on %c is always taken: %r only has the value from then
+; CHECK-LABEL: define i32 @phi_folds(
+; CHECK-NOT: else:
+; CHECK-NOT: phi
+; CHECK: ret i32 3
+define i32 @phi_folds(i32 %x) {
+entry:
+  %c = icmp eq i32 1, 1
+  br i1 %c, label %then, label %else
+
+then:
+  br label %join
+
+else:
+  %y = add i32 %x, 5
+  br label %join
+
+join:
+  %r = phi i32 [ 3, %then ], [ %y, %else ]
+  ret i32 %r
+}
+
+; A loop whose value stays the same along every executable edge
+; CHECK-LABEL: define i32 @loop_constant(
+; CHECK: ret i32 7
+define i32 @loop_constant(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %v = phi i32 [ 7, %entry ], [ %w, %latch ]
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %big = icmp sgt i32 %v, 10
+  br i1 %big, label %grow, label %latch
+
+grow:
+  %g = add i32 %v, 1
+  br label %latch
+
+latch:
+  %w = phi i32 [ %v, %loop ], [ %g, %grow ]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %v
+}
+
+; A switch on a constant goes to one successor
+; CHECK-LABEL: define i32 @switch_folds(
+; CHECK-NOT: switch
+; CHECK-NOT: one:
+; CHECK-NOT: other:
+; CHECK: ret i32 20
+define i32 @switch_folds(i32 %x) {
+entry:
+  %s = add i32 1, 1
+  switch i32 %s, label %other [
+    i32 1, label %one
+    i32 2, label %two
+  ]
+
+one:
+  br label %join
+
+two:
+  br label %join
+
+other:
+  br label %join
+
+join:
+  %r = phi i32 [ 10, %one ], [ 20, %two ], [ %x, %other ]
+  ret i32 %r
+}
+
+; The phi keeps the edges from the blocks which can execute, and loses the one
+; from the deleted block
+; CHECK-LABEL: define i32 @unreachable_edges(
+; CHECK-NOT: dead:
+; CHECK: join:
+; CHECK-NEXT: %r = phi i32 [ %x, %left ], [ %y, %right ]
+define i32 @unreachable_edges(i32 %x, i32 %y, i1 %b) {
+entry:
+  %c = icmp ne i32 0, 0
+  br i1 %c, label %dead, label %live
+
+live:
+  br i1 %b, label %left, label %right
+
+left:
+  br label %join
+
+right:
+  br label %join
+
+dead:
+  br label %join
+
+join:
+  %r = phi i32 [ %x, %left ], [ %y, %right ], [ 0, %dead ]
+  ret i32 %r
+}
+
+; %b is not known: both sides stay, and so does the phi
+; CHECK-LABEL: define i32 @unknown_condition(
+; CHECK: br i1 %b, label %then, label %else
+; CHECK: %r = phi i32 [ 3, %then ], [ 4, %else ]
+; CHECK-NEXT: ret i32 %r
+define i32 @unknown_condition(i1 %b) {
+entry:
+  br i1 %b, label %then, label %else
+
+then:
+  br label %join
+
+else:
+  br label %join
+
+join:
+  %r = phi i32 [ 3, %then ], [ 4, %else ]
+  ret i32 %r
+}
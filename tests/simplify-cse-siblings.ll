@@ -0,0 +1,86 @@
+; An expression in one arm of a diamond does not hide the duplicates of the other arm
+; from each other: simplify merges them like cse does
+
+; CHECK-LABEL: define i32 @diamond(
+; CHECK: then:
+; CHECK-NEXT: %x = add i32 %a, %b
+; CHECK-NEXT: br label %join
+; CHECK: else:
+; CHECK-NEXT: %y = add i32 %a, %b
+; CHECK-NEXT: %w = mul i32 %y, %y
+; CHECK-NEXT: br label %join
+define i32 @diamond(i32 %a, i32 %b, i1 %c) {
+entry:
+  br i1 %c, label %then, label %else
+
+then:
+  %x = add i32 %a, %b
+  br label %join
+
+else:
+  %y = add i32 %a, %b
+  %z = add i32 %b, %a
+  %w = mul i32 %y, %z
+  br label %join
+
+join:
+  %r = phi i32 [ %x, %then ], [ %w, %else ]
+  ret i32 %r
+}
+
+; The same with the arms swapped, as the arms are visited in reverse post-order
+; CHECK-LABEL: define i32 @diamond_swapped(
+; CHECK: then:
+; CHECK-NEXT: %y = add i32 %a, %b
+; CHECK-NEXT: %w = mul i32 %y, %y
+; CHECK-NEXT: br label %join
+; CHECK: else:
+; CHECK-NEXT: %x = add i32 %a, %b
+; CHECK-NEXT: br label %join
+define i32 @diamond_swapped(i32 %a, i32 %b, i1 %c) {
+entry:
+  br i1 %c, label %then, label %else
+
+then:
+  %y = add i32 %a, %b
+  %z = add i32 %b, %a
+  %w = mul i32 %y, %z
+  br label %join
+
+else:
+  %x = add i32 %a, %b
+  br label %join
+
+join:
+  %r = phi i32 [ %w, %then ], [ %x, %else ]
+  ret i32 %r
+}
+
+; The expression computed in the join block is replaced with the one before the branch,
+; which dominates it, and not with the ones of the arms
+; CHECK-LABEL: define i32 @dominating(
+; CHECK: entry:
+; CHECK-NEXT: %s = sub i32 %a, %b
+; CHECK-NOT: sub i32
+; CHECK: ret i32
+define i32 @dominating(i32 %a, i32 %b, i1 %c) {
+entry:
+  %s = sub i32 %a, %b
+  br i1 %c, label %then, label %else
+
+then:
+  %x = sub i32 %a, %b
+  %x2 = mul i32 %x, %s
+  br label %join
+
+else:
+  %y = sub i32 %a, %b
+  %y2 = xor i32 %y, %s
+  br label %join
+
+join:
+  %p = phi i32 [ %x2, %then ], [ %y2, %else ]
+  %z = sub i32 %a, %b
+  %r = add i32 %p, %z
+  ret i32 %r
+}
@@ -0,0 +1,35 @@
+; The operands of the commutative adds are lined up across lanes even when one side
+; is the same argument in every lane: %x goes left and the loads go right, so the
+; loads form one vector load and %x one splat
+
+; CHECK-LABEL: @add_invariant(
+; CHECK: %.splat = shufflevector <4 x i32> %.splatinsert, <4 x i32> poison, <4 x i32> zeroinitializer
+; CHECK: [[LOADS:%[0-9]+]] = load <4 x i32>
+; CHECK: [[SUM:%[0-9]+]] = add <4 x i32> %.splat, [[LOADS]]
+; CHECK: store <4 x i32> [[SUM]]
+; CHECK-NOT: store i32
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+define void @add_invariant(i32* %p, i32* %m, i32 %x) {
+entry:
+  %m1 = getelementptr i32, i32* %m, i64 1
+  %m2 = getelementptr i32, i32* %m, i64 2
+  %m3 = getelementptr i32, i32* %m, i64 3
+  %a0 = load i32, i32* %m
+  %a1 = load i32, i32* %m1
+  %a2 = load i32, i32* %m2
+  %a3 = load i32, i32* %m3
+  %s0 = add i32 %x, %a0
+  %s1 = add i32 %a1, %x
+  %s2 = add i32 %a2, %x
+  %s3 = add i32 %a3, %x
+  %p1 = getelementptr i32, i32* %p, i64 1
+  %p2 = getelementptr i32, i32* %p, i64 2
+  %p3 = getelementptr i32, i32* %p, i64 3
+  store i32 %s0, i32* %p
+  store i32 %s1, i32* %p1
+  store i32 %s2, i32* %p2
+  store i32 %s3, i32* %p3
+  ret void
+}
@@ -0,0 +1,171 @@
+; The floating point rewrites of srcf hold for signed zeros and NaNs, or only with
+; the fast-math flags they need; each rule is checked with and without its flag
+
+; x+(-0.0) is x for every x, x+0.0 turns -0.0 into +0.0 and needs nsz
+; CHECK-LABEL: define float @fadd_neg_zero(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: ret float %x
+define float @fadd_neg_zero(float %x) {
+entry:
+  %r = fadd float %x, -0.0
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fadd_pos_zero(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %r = fadd float %x, 0.0
+define float @fadd_pos_zero(float %x) {
+entry:
+  %r = fadd float %x, 0.0
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fadd_pos_zero_nsz(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: ret float %x
+define float @fadd_pos_zero_nsz(float %x) {
+entry:
+  %r = fadd nsz float %x, 0.0
+  ret float %r
+}
+
+; x*0.0 is NaN for NaN and infinities, and -0.0 for negative x: it needs nnan and nsz
+; CHECK-LABEL: define float @fmul_zero(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %r = fmul float %x, 0.0
+define float @fmul_zero(float %x) {
+entry:
+  %r = fmul float %x, 0.0
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fmul_zero_nnan(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %r = fmul nnan float %x, 0.0
+define float @fmul_zero_nnan(float %x) {
+entry:
+  %r = fmul nnan float %x, 0.0
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fmul_zero_nsz(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %r = fmul nsz float %x, 0.0
+define float @fmul_zero_nsz(float %x) {
+entry:
+  %r = fmul nsz float %x, 0.0
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fmul_zero_nnan_nsz(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: ret float 0.000000e+00
+define float @fmul_zero_nnan_nsz(float %x) {
+entry:
+  %r = fmul nnan nsz float %x, 0.0
+  ret float %r
+}
+
+; x/4.0 is x*0.25 exactly, x/3.0 rounds differently from x*(1/3.0) without arcp
+; CHECK-LABEL: define float @fdiv_pow2(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: [[R:%.*]] = fmul float %x, 2.500000e-01
+; CHECK-NEXT: ret float [[R]]
+define float @fdiv_pow2(float %x) {
+entry:
+  %r = fdiv float %x, 4.0
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fdiv_three(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %r = fdiv float %x, 3.000000e+00
+define float @fdiv_three(float %x) {
+entry:
+  %r = fdiv float %x, 3.0
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fdiv_three_arcp(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: [[R:%.*]] = fmul arcp float %x, 0x3FD5555560000000
+; CHECK-NEXT: ret float [[R]]
+define float @fdiv_three_arcp(float %x) {
+entry:
+  %r = fdiv arcp float %x, 3.0
+  ret float %r
+}
+
+; -(-x) cancels for fneg, which only flips the sign bit; -0.0-x keeps the sign of
+; a NaN x, so it only cancels with nnan. The unused negation is left for DCE.
+; CHECK-LABEL: define float @fneg_fneg(
+; CHECK: ret float %x
+define float @fneg_fneg(float %x) {
+entry:
+  %n = fneg float %x
+  %r = fneg float %n
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fneg_fsub(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %n = fsub float -0.000000e+00, %x
+; CHECK-NEXT: %r = fneg float %n
+define float @fneg_fsub(float %x) {
+entry:
+  %n = fsub float -0.0, %x
+  %r = fneg float %n
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fneg_fsub_nnan(
+; CHECK: ret float %x
+define float @fneg_fsub_nnan(float %x) {
+entry:
+  %n = fsub float -0.0, %x
+  %r = fneg nnan float %n
+  ret float %r
+}
+
+; Constants are folded under the IEEE denormal mode, but not when the function
+; flushes denormals: 2^-126 / 2 is a denormal
+; CHECK-LABEL: define float @fold_denormal_ieee(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: ret float 0x3800000000000000
+define float @fold_denormal_ieee() {
+entry:
+  %r = fmul float 0x3810000000000000, 0.5
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fold_denormal_flushed(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %r = fmul float 0x3810000000000000, 5.000000e-01
+define float @fold_denormal_flushed() #0 {
+entry:
+  %r = fmul float 0x3810000000000000, 0.5
+  ret float %r
+}
+
+; CHECK-LABEL: define float @fold_normal_flushed(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: ret float 3.000000e+00
+define float @fold_normal_flushed() #0 {
+entry:
+  %r = fmul float 1.5, 2.0
+  ret float %r
+}
+
+; Nothing is rewritten in strictfp functions, whose rounding mode and exceptions
+; are observable
+; CHECK-LABEL: define float @strict(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %r = fadd float %x, -0.000000e+00
+define float @strict(float %x) #1 {
+entry:
+  %r = fadd float %x, -0.0
+  ret float %r
+}
+
+attributes #0 = { "denormal-fp-math"="preserve-sign,preserve-sign" }
+attributes #1 = { strictfp }
@@ -0,0 +1,40 @@
+; An instruction of an unreachable block may use itself: the identity rules, which
+; return their operand, must leave it alone instead of replacing it with itself
+
+; CHECK-LABEL: define i32 @add_zero_self(
+; CHECK: dead:
+; CHECK-NEXT: %a = add i32 %a, 0
+define i32 @add_zero_self(i32 %x) {
+entry:
+  ret i32 %x
+
+dead:
+  %a = add i32 %a, 0
+  br label %dead
+}
+
+; CHECK-LABEL: define i32 @xor_zero_self(
+; CHECK: dead:
+; CHECK-NEXT: %a = xor i32 %a, 0
+define i32 @xor_zero_self(i32 %x) {
+entry:
+  ret i32 %x
+
+dead:
+  %a = xor i32 %a, 0
+  br label %dead
+}
+
+; Rules building new instructions from a self-referencing operand still apply
+; CHECK-LABEL: define i32 @mul_pow2_self(
+; CHECK: dead:
+; CHECK-NOT: mul
+; CHECK: shl i32
+define i32 @mul_pow2_self(i32 %x) {
+entry:
+  ret i32 %x
+
+dead:
+  %a = mul i32 %a, 8
+  br label %dead
+}
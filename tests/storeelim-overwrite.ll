@@ -0,0 +1,130 @@
+; Stores are deleted only when every path after them overwrites all their bytes, or
+; ends with their memory unread, before anything may read it
+
+; CHECK-LABEL: define void @overwritten(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: store i32 2, i32* %p
+; CHECK-NEXT: ret void
+define void @overwritten(i32* %p) {
+entry:
+  store i32 1, i32* %p
+  store i32 2, i32* %p
+  ret void
+}
+
+; The load of %q may read %p
+; CHECK-LABEL: define i32 @read_in_between(
+; CHECK: store i32 1, i32* %p
+; CHECK-NEXT: %l = load i32, i32* %q
+; CHECK-NEXT: store i32 2, i32* %p
+define i32 @read_in_between(i32* %p, i32* %q) {
+entry:
+  store i32 1, i32* %p
+  %l = load i32, i32* %q
+  store i32 2, i32* %p
+  ret i32 %l
+}
+
+; A one-byte store leaves three bytes of the first one
+; CHECK-LABEL: define void @partial_overwrite(
+; CHECK: store i32 1, i32* %p
+; CHECK-NEXT: store i8 2, i8* %c
+define void @partial_overwrite(i32* %p) {
+entry:
+  %c = bitcast i32* %p to i8*
+  store i32 1, i32* %p
+  store i8 2, i8* %c
+  ret void
+}
+
+; CHECK-LABEL: define void @full_overwrite(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %c = bitcast i32* %p to i8*
+; CHECK-NEXT: store i32 2, i32* %p
+; CHECK-NEXT: ret void
+define void @full_overwrite(i32* %p) {
+entry:
+  %c = bitcast i32* %p to i8*
+  store i8 1, i8* %c
+  store i32 2, i32* %p
+  ret void
+}
+
+; Only one of the paths overwrites the store
+; CHECK-LABEL: define void @one_path(
+; CHECK: store i32 1, i32* %p
+; CHECK: then:
+; CHECK-NEXT: store i32 2, i32* %p
+define void @one_path(i32* %p, i1 %c) {
+entry:
+  store i32 1, i32* %p
+  br i1 %c, label %then, label %exit
+
+then:
+  store i32 2, i32* %p
+  br label %exit
+
+exit:
+  ret void
+}
+
+; Memory of the caller may be read when the call unwinds or does not return
+declare void @opaque()
+
+; CHECK-LABEL: define void @call_in_between(
+; CHECK: store i32 1, i32* %p
+; CHECK-NEXT: call void @opaque()
+; CHECK-NEXT: store i32 2, i32* %p
+define void @call_in_between(i32* %p) {
+entry:
+  store i32 1, i32* %p
+  call void @opaque()
+  store i32 2, i32* %p
+  ret void
+}
+
+; Stores to an alloca which is not read again are dead
+; CHECK-LABEL: define void @unread_alloca(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %a = alloca i32
+; CHECK-NEXT: ret void
+define void @unread_alloca(i32 %v) {
+entry:
+  %a = alloca i32
+  store i32 %v, i32* %a
+  ret void
+}
+
+; CHECK-LABEL: define void @unread_argument(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: store i32 %v, i32* %p
+define void @unread_argument(i32* %p, i32 %v) {
+entry:
+  store i32 %v, i32* %p
+  ret void
+}
+
+; Storing back the value just loaded changes nothing, unless the memory was written
+; in between
+; CHECK-LABEL: define void @noop_store(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %l = load i32, i32* %p
+; CHECK-NEXT: ret void
+define void @noop_store(i32* %p) {
+entry:
+  %l = load i32, i32* %p
+  store i32 %l, i32* %p
+  ret void
+}
+
+; CHECK-LABEL: define void @noop_store_written(
+; CHECK: %l = load i32, i32* %p
+; CHECK-NEXT: store i32 0, i32* %q
+; CHECK-NEXT: store i32 %l, i32* %p
+define void @noop_store_written(i32* %p, i32* %q) {
+entry:
+  %l = load i32, i32* %p
+  store i32 0, i32* %q
+  store i32 %l, i32* %p
+  ret void
+}
@@ -0,0 +1,51 @@
+; The quotient and remainder by the same hot divisor are versioned under one guard,
+; and the remainder reuses the quotient of the fast path
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+; CHECK-LABEL: @digits(
+; CHECK: %valueprof.hot = icmp eq i32 %d, 10
+; CHECK-NOT: icmp eq
+; CHECK: valueprof.fast:
+; CHECK: [[QUOTIENT:%[0-9]+]] = lshr i32 %{{[0-9]+}}, 3
+; CHECK-NOT: lshr
+; CHECK: [[PRODUCT:%[0-9]+]] = mul i32 [[QUOTIENT]], 10
+; CHECK: [[REMAINDER:%[0-9]+]] = sub i32 %n, [[PRODUCT]]
+; CHECK: valueprof.slow:
+; CHECK-NEXT: %q.slow = udiv i32 %n, %d
+; CHECK-NEXT: %r.slow = urem i32 %n, %d
+; CHECK: valueprof.merge:
+; CHECK-NEXT: %q = phi i32 [ [[QUOTIENT]], %valueprof.fast ], [ %q.slow, %valueprof.slow ]
+; CHECK-NEXT: %r = phi i32 [ [[REMAINDER]], %valueprof.fast ], [ %r.slow, %valueprof.slow ]
+; CHECK-NEXT: store i32 %q, i32* %p
+define i32 @digits(i32 %n, i32 %d, i32* %p) {
+entry:
+  %q = udiv i32 %n, %d
+  store i32 %q, i32* %p
+  %r = urem i32 %n, %d
+  %s = add i32 %q, %r
+  ret i32 %s
+}
+
+; The remainder of the quotient uses the quotient of its own path
+; CHECK-LABEL: @chain(
+; CHECK: %valueprof.hot = icmp eq i32 %d, 10
+; CHECK-NOT: icmp eq
+; CHECK: valueprof.fast:
+; CHECK: [[QUOTIENT:%[0-9]+]] = lshr i32 %{{[0-9]+}}, 3
+; CHECK: zext i32 [[QUOTIENT]] to i64
+; CHECK: [[REMAINDER:%[0-9]+]] = sub i32 [[QUOTIENT]], %{{[0-9]+}}
+; CHECK: valueprof.slow:
+; CHECK-NEXT: %q.slow = udiv i32 %n, %d
+; CHECK-NEXT: %r.slow = urem i32 %q.slow, %d
+; CHECK: valueprof.merge:
+; CHECK-NEXT: %q = phi i32 [ [[QUOTIENT]], %valueprof.fast ], [ %q.slow, %valueprof.slow ]
+; CHECK-NEXT: %r = phi i32 [ [[REMAINDER]], %valueprof.fast ], [ %r.slow, %valueprof.slow ]
+; CHECK-NEXT: ret i32 %r
+define i32 @chain(i32 %n, i32 %d) {
+entry:
+  %q = udiv i32 %n, %d
+  %r = urem i32 %q, %d
+  ret i32 %r
+}